@@ -0,0 +1,449 @@
+defmodule PortAudio.Bench.StreamConcurrency do
+  @moduledoc """
+  Opens increasing numbers of concurrent streams, each driven by its own
+  process, and reports how the library holds up as the count grows.
+
+  Meant to be run against a software device so results are repeatable and
+  need no audio hardware, see the README for setting one up.
+  """
+
+  alias PortAudio.{Device, Stream}
+
+  @switches [
+    device: :string,
+    mode: :string,
+    read: :string,
+    streams: :string,
+    duration: :float,
+    frames: :integer,
+    channels: :integer,
+    rate: :float,
+    format: :string,
+    latency: :string,
+    json: :boolean
+  ]
+
+  @defaults [
+    mode: "playback",
+    read: "subscribe",
+    streams: "1,2,4,8",
+    duration: 5.0,
+    frames: 256,
+    channels: 2,
+    rate: 48000.0,
+    format: "int16",
+    latency: "low",
+    json: false
+  ]
+
+  @percentiles [50, 90, 99, 99.9]
+
+  @sample_sizes %{float32: 4, int32: 4, int24: 3, int16: 2, int8: 1, uint8: 1}
+
+  # How often memory is sampled while streams are running, in ms
+  @memory_interval 50
+
+  def main(argv) do
+    case OptionParser.parse(argv, strict: @switches) do
+      {opts, [], []} ->
+        opts = Keyword.merge(@defaults, opts)
+        config = config(opts)
+
+        unless opts[:json] do
+          IO.puts(
+            "#{config.mode} on #{inspect(config.device.name)}, " <>
+              "#{config.frames} frames at #{config.rate} Hz, #{opts[:duration]}s per step\n"
+          )
+        end
+
+        opts[:streams]
+        |> String.split(",")
+        |> Enum.map(&String.to_integer(String.trim(&1)))
+        |> Enum.reduce_while(:ok, fn n, :ok ->
+          case run(config, n) do
+            {:ok, result} ->
+              report(result, opts[:json])
+              {:cont, :ok}
+
+            {:error, reason} ->
+              IO.puts(:stderr, "Stopping at #{n} streams: #{inspect(reason)}")
+              {:halt, :error}
+          end
+        end)
+
+      _ ->
+        print_usage()
+    end
+  end
+
+  ############################################################
+  # Configuration
+  ############################################################
+  defp config(opts) do
+    mode = String.to_atom(opts[:mode])
+    format = String.to_atom(opts[:format])
+
+    unless mode in [:playback, :record, :duplex] do
+      raise ArgumentError, "unknown mode #{inspect(opts[:mode])}"
+    end
+
+    device = find_device(opts[:device], mode, opts[:channels])
+    frame_size = opts[:channels] * Map.fetch!(@sample_sizes, format)
+
+    %{
+      mode: mode,
+      read: String.to_atom(opts[:read]),
+      device: device,
+      frames: opts[:frames],
+      channels: opts[:channels],
+      rate: opts[:rate],
+      format: format,
+      latency: String.to_atom(opts[:latency]),
+      duration_ms: round(opts[:duration] * 1000),
+      frame_size: frame_size,
+      silence: :binary.copy(<<0>>, opts[:frames] * frame_size)
+    }
+  end
+
+  defp find_device(nil, mode, _channels) do
+    {:ok, device} =
+      if mode == :record,
+        do: PortAudio.default_input_device(),
+        else: PortAudio.default_output_device()
+
+    device
+  end
+
+  defp find_device(name, mode, channels) do
+    found =
+      Enum.find(PortAudio.devices(), fn device ->
+        String.contains?(device.name, name) and
+          (mode == :playback or device.max_input_channels >= channels) and
+          (mode == :record or device.max_output_channels >= channels)
+      end)
+
+    found || raise ArgumentError, "no device matching #{inspect(name)} for #{mode}"
+  end
+
+  ############################################################
+  # Running a step
+  ############################################################
+  defp run(config, n) do
+    parent = self()
+    workers = for _ <- 1..n, do: spawn_link(fn -> worker(parent, config) end)
+
+    ready =
+      Enum.map(workers, fn pid ->
+        receive do
+          {:ready, ^pid, result} -> result
+        end
+      end)
+
+    case Enum.find(ready, &match?({:error, _}, &1)) do
+      nil ->
+        memory = spawn_link(fn -> sample_memory(parent, :erlang.memory()) end)
+        schedulers = sample_schedulers()
+        started = System.monotonic_time(:millisecond)
+        deadline = started + config.duration_ms
+
+        Enum.each(workers, &send(&1, {:go, deadline}))
+
+        results =
+          Enum.map(workers, fn pid ->
+            receive do
+              {:done, ^pid, result} -> result
+            end
+          end)
+
+        elapsed = System.monotonic_time(:millisecond) - started
+        utilization = scheduler_utilization(schedulers)
+        send(memory, {:stop, parent})
+
+        peak =
+          receive do
+            {:memory, peak} -> peak
+          end
+
+        {:ok, summarize(config, n, elapsed, results, utilization, peak)}
+
+      error ->
+        Enum.each(workers, &send(&1, :abort))
+        error
+    end
+  end
+
+  defp worker(parent, config) do
+    case open(config) do
+      {:ok, stream} ->
+        send(parent, {:ready, self(), :ok})
+
+        receive do
+          {:go, deadline} ->
+            state = %{frames: 0, calls: [], gaps: [], errors: %{}, last: now()}
+            result = drive(config, stream, deadline, state) |> count_overflows(config, stream)
+            Stream.close(stream)
+            send(parent, {:done, self(), result})
+
+          :abort ->
+            Stream.close(stream)
+        end
+
+      {:error, reason} ->
+        send(parent, {:ready, self(), {:error, reason}})
+    end
+  end
+
+  defp open(config) do
+    params = %{
+      channel_count: config.channels,
+      sample_format: config.format,
+      suggested_latency: config.latency
+    }
+
+    with {:ok, stream} <-
+           Device.stream(config.device,
+             input: if(config.mode != :playback, do: params),
+             output: if(config.mode != :record, do: params),
+             sample_rate: config.rate,
+             frames_per_buffer: config.frames
+           ) do
+      if config.mode == :record and config.read == :subscribe do
+        Stream.subscribe(stream, self())
+      else
+        {:ok, stream}
+      end
+    end
+  end
+
+  defp drive(config, stream, deadline, state) do
+    if now() >= deadline * 1000 do
+      state
+    else
+      state = step(config, stream, state)
+      drive(config, stream, deadline, state)
+    end
+  end
+
+  defp step(%{mode: :playback} = config, stream, state) do
+    {elapsed, result} = :timer.tc(Stream, :write, [stream, config.silence])
+    record(state, result, elapsed, config.frames)
+  end
+
+  defp step(%{mode: :record, read: :subscribe} = config, stream, state) do
+    %Stream{resource: resource} = stream
+
+    receive do
+      {:portaudio_buffer, ^resource, _route, data} ->
+        {elapsed, _} = :timer.tc(Stream, :ack, [stream])
+        record(state, :ok, elapsed, div(byte_size(data), config.frame_size))
+    after
+      100 -> state
+    end
+  end
+
+  defp step(%{mode: :record} = config, stream, state) do
+    {elapsed, result} = :timer.tc(Stream, :read, [stream])
+
+    case result do
+      {:ok, data} ->
+        record(state, :ok, elapsed, div(byte_size(data), config.frame_size))
+
+      {:error, :stream_empty} ->
+        # Poll a few times per buffer
+        Process.sleep(max(div(config.frames * 250, round(config.rate)), 1))
+        state
+
+      {:error, reason} ->
+        count_error(state, reason)
+    end
+  end
+
+  # Paced by the writes, reading whatever was captured meanwhile
+  defp step(%{mode: :duplex} = config, stream, state) do
+    state = step(%{config | mode: :playback}, stream, state)
+
+    case Stream.read(stream) do
+      {:ok, _data} -> state
+      {:error, :stream_empty} -> state
+      {:error, reason} -> count_error(state, reason)
+    end
+  end
+
+  defp record(state, result, elapsed, frames) do
+    at = now()
+
+    state =
+      case result do
+        {:error, reason} -> count_error(state, reason)
+        _ -> state
+      end
+
+    %{
+      state
+      | frames: state.frames + frames,
+        calls: [elapsed | state.calls],
+        gaps: [at - state.last | state.gaps],
+        last: at
+    }
+  end
+
+  # Subscribers never see the capture thread's overflowed reads, so they are
+  # counted from its stats instead
+  defp count_overflows(state, %{mode: :record, read: :subscribe}, stream) do
+    case Stream.capture_stats(stream) do
+      {:ok, %{input_overflows: n}} when n > 0 ->
+        %{state | errors: Map.update(state.errors, :input_overflowed, n, &(&1 + n))}
+
+      _ ->
+        state
+    end
+  end
+
+  defp count_overflows(state, _config, _stream), do: state
+
+  defp count_error(state, reason) do
+    %{state | errors: Map.update(state.errors, reason, 1, &(&1 + 1))}
+  end
+
+  defp now, do: System.monotonic_time(:microsecond)
+
+  ############################################################
+  # System measurements
+  ############################################################
+  defp sample_memory(parent, peak) do
+    peak =
+      Keyword.merge(peak, :erlang.memory(), fn _key, a, b -> max(a, b) end)
+
+    receive do
+      {:stop, ^parent} -> send(parent, {:memory, peak})
+    after
+      @memory_interval -> sample_memory(parent, peak)
+    end
+  end
+
+  # Dirty scheduler utilization needs `:scheduler` from runtime_tools,
+  # available since OTP 21
+  defp sample_schedulers do
+    if Code.ensure_loaded?(:scheduler) and function_exported?(:scheduler, :sample_all, 0) do
+      :erlang.system_flag(:scheduler_wall_time, true)
+      :scheduler.sample_all()
+    end
+  end
+
+  defp scheduler_utilization(nil), do: nil
+
+  defp scheduler_utilization(sample) do
+    :scheduler.utilization(sample, :scheduler.sample_all())
+    |> Enum.flat_map(fn
+      {type, _id, util, _percent} when type in [:normal, :cpu, :io] -> [{type, util}]
+      _ -> []
+    end)
+    |> Enum.group_by(&elem(&1, 0), &elem(&1, 1))
+    |> Map.new(fn {type, utils} -> {type, Enum.sum(utils) / length(utils)} end)
+  end
+
+  ############################################################
+  # Reporting
+  ############################################################
+  defp summarize(config, n, elapsed_ms, results, utilization, memory) do
+    frames = Enum.reduce(results, 0, &(&1.frames + &2))
+    errors = Enum.reduce(results, %{}, &Map.merge(&1.errors, &2, fn _, a, b -> a + b end))
+    calls = results |> Enum.flat_map(& &1.calls) |> Enum.sort()
+    # The first gap of each stream is only the wait for its first buffer
+    gaps = results |> Enum.flat_map(&Enum.drop(&1.gaps, -1)) |> Enum.sort()
+    frames_per_sec = frames * 1000 / max(elapsed_ms, 1)
+
+    %{
+      streams: n,
+      mode: config.mode,
+      elapsed_ms: elapsed_ms,
+      frames_per_sec: round(frames_per_sec),
+      # 1.0 when every stream moved audio in real time
+      realtime_ratio: Float.round(frames_per_sec / (config.rate * n), 3),
+      buffer_period_us: round(config.frames * 1_000_000 / config.rate),
+      call_us: percentiles(calls),
+      gap_us: percentiles(gaps),
+      xruns: Map.get(errors, :output_underflowed, 0) + Map.get(errors, :input_overflowed, 0),
+      errors: errors,
+      schedulers: utilization,
+      memory_peak: Map.new(Keyword.take(memory, [:total, :processes, :binary, :system]))
+    }
+  end
+
+  defp percentiles([]), do: %{}
+
+  defp percentiles(sorted) do
+    count = length(sorted)
+    tuple = List.to_tuple(sorted)
+
+    @percentiles
+    |> Map.new(fn p ->
+      index = min(round(p / 100 * (count - 1)), count - 1)
+      {"p#{p}", elem(tuple, index)}
+    end)
+    |> Map.put("max", elem(tuple, count - 1))
+  end
+
+  defp report(result, true), do: IO.puts(to_json(result))
+
+  defp report(result, false) do
+    IO.puts("""
+    #{result.streams} stream(s): #{result.frames_per_sec} frames/s \
+    (#{result.realtime_ratio}x real time), #{result.xruns} xruns
+      call us:     #{format_percentiles(result.call_us)}
+      gap us:      #{format_percentiles(result.gap_us)} \
+    (period #{result.buffer_period_us})
+      schedulers:  #{format_utilization(result.schedulers)}
+      memory peak: #{format_memory(result.memory_peak)}
+      errors:      #{inspect(result.errors)}
+    """)
+  end
+
+  defp format_percentiles(ps) do
+    Enum.map_join(["p50", "p90", "p99", "p99.9", "max"], " ", &"#{&1}=#{ps[&1]}")
+  end
+
+  defp format_utilization(nil), do: "unavailable"
+
+  defp format_utilization(utilization) do
+    Enum.map_join([normal: "normal", cpu: "dirty cpu", io: "dirty io"], " ", fn {type, name} ->
+      "#{name}=#{Float.round(Map.get(utilization, type, 0.0) * 100, 1)}%"
+    end)
+  end
+
+  defp format_memory(memory) do
+    Enum.map_join(memory, " ", fn {key, bytes} -> "#{key}=#{div(bytes, 1024)}KiB" end)
+  end
+
+  # Enough JSON for the results, without pulling in a dependency
+  defp to_json(map) when is_map(map) do
+    "{" <> Enum.map_join(map, ",", fn {k, v} -> to_json(to_string(k)) <> ":" <> to_json(v) end) <> "}"
+  end
+
+  defp to_json(nil), do: "null"
+  defp to_json(value) when is_number(value), do: to_string(value)
+  defp to_json(value) when is_atom(value), do: to_json(Atom.to_string(value))
+  defp to_json(value) when is_binary(value), do: inspect(value)
+
+  defp print_usage do
+    IO.puts("""
+    ERROR: Invalid command line arguments.
+
+    Usage: mix run bench/stream_concurrency.exs [OPTIONS]
+
+      --device NAME      Use the first device whose name contains NAME
+      --mode MODE        playback, record or duplex (default: playback)
+      --read HOW         Record by subscribe or poll (default: subscribe)
+      --streams LIST     Stream counts to step through (default: 1,2,4,8)
+      --duration SECS    Length of each step (default: 5.0)
+      --frames N         Frames per buffer (default: 256)
+      --channels N       Channels per stream (default: 2)
+      --rate HZ          Sample rate (default: 48000.0)
+      --format FORMAT    Sample format (default: int16)
+      --latency LEVEL    Suggested latency, low or high (default: low)
+      --json             Print one JSON object per step
+    """)
+  end
+end
+
+PortAudio.Bench.StreamConcurrency.main(System.argv())
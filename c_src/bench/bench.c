@@ -0,0 +1,144 @@
+/**
+ * Microbenchmarks for the native hot paths, run outside of the BEAM
+ * against stub implementations of the NIF API and PortAudio.
+ *
+ * Usage: portaudio_nif_bench [PREFIX...]
+ *
+ * Only benchmarks whose names start with one of the given prefixes are
+ * run. Each result is printed to stdout as a line of JSON. The minimum
+ * time spent timing each run can be set in milliseconds with
+ * `BENCH_MIN_TIME_MS`.
+ */
+// For clock_gettime and the POSIX thread and time functions
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Number of timed runs per benchmark. The median is reported.
+ */
+#define BENCH_RUNS 5
+
+/**
+ * Default minimum duration of each timed run.
+ */
+#define BENCH_DEFAULT_MIN_TIME_MS 100
+
+static int _n_prefixes;
+static char **_prefixes;
+static double _min_time_ns;
+
+static volatile const void *_sink;
+
+void bench_consume(const void *ptr)
+{
+        _sink = ptr;
+}
+
+static double _now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool _matches(const char *name, const char *prefix)
+{
+        return strncmp(name, prefix, strlen(prefix)) == 0;
+}
+
+bool bench_selected(const char *prefix)
+{
+        if (_n_prefixes == 0)
+                return true;
+
+        int i;
+        for (i = 0; i < _n_prefixes; i++) {
+                // Either may be the more specific of the two
+                if (_matches(prefix, _prefixes[i]) || _matches(_prefixes[i], prefix))
+                        return true;
+        }
+        return false;
+}
+
+static bool _selected(const char *name)
+{
+        if (_n_prefixes == 0)
+                return true;
+
+        int i;
+        for (i = 0; i < _n_prefixes; i++) {
+                if (_matches(name, _prefixes[i]))
+                        return true;
+        }
+        return false;
+}
+
+static double _time_iterations(bench_fn fn, void *ctx, long iterations)
+{
+        const double start = _now_ns();
+        long i;
+        for (i = 0; i < iterations; i++)
+                fn(ctx);
+        return _now_ns() - start;
+}
+
+static int _compare_doubles(const void *a, const void *b)
+{
+        const double x = *(const double *) a;
+        const double y = *(const double *) b;
+        return (x > y) - (x < y);
+}
+
+void bench_run(const char *name, const char *unit, long items, size_t bytes,
+               bench_fn fn, void *ctx)
+{
+        if (!_selected(name))
+                return;
+
+        // Warm up, then find how many iterations fill the minimum time
+        long iterations = 1;
+        double elapsed = _time_iterations(fn, ctx, iterations);
+        while (elapsed < _min_time_ns / 10) {
+                iterations *= 2;
+                elapsed = _time_iterations(fn, ctx, iterations);
+        }
+        iterations = (long) (iterations * _min_time_ns / elapsed) + 1;
+
+        double per_item[BENCH_RUNS];
+        int run;
+        for (run = 0; run < BENCH_RUNS; run++)
+                per_item[run] = _time_iterations(fn, ctx, iterations) / iterations / items;
+        qsort(per_item, BENCH_RUNS, sizeof(double), &_compare_doubles);
+
+        const double median = per_item[BENCH_RUNS / 2];
+        printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"items\":%ld,\"iterations\":%ld,"
+               "\"ns_per_%s\":%.3f,\"ns_per_%s_min\":%.3f,\"%ss_per_sec\":%.0f",
+               name, unit, items, iterations,
+               unit, median, unit, per_item[0], unit, 1e9 / median);
+        if (bytes > 0)
+                printf(",\"mb_per_sec\":%.1f", bytes / (median * items) * 1e3);
+        printf("}\n");
+        fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+        _n_prefixes = argc - 1;
+        _prefixes = argv + 1;
+
+        const char *min_time = getenv("BENCH_MIN_TIME_MS");
+        _min_time_ns = (min_time != NULL ? atof(min_time) : BENCH_DEFAULT_MIN_TIME_MS) * 1e6;
+        if (_min_time_ns <= 0)
+                _min_time_ns = BENCH_DEFAULT_MIN_TIME_MS * 1e6;
+
+        bench_native();
+        bench_nif();
+
+        return 0;
+}
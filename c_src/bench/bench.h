@@ -0,0 +1,39 @@
+#ifndef _PORTAUDIO_BENCH_
+#define _PORTAUDIO_BENCH_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Run a single iteration of a benchmark.
+ */
+typedef void (*bench_fn)(void *ctx);
+
+/**
+ * Time `fn` and print the result as a line of JSON.
+ *
+ * `unit` names what each iteration processes `items` of, usually `"frame"`
+ * or `"call"`. If `bytes` is non-zero, the throughput in megabytes per
+ * second is reported as well.
+ *
+ * Does nothing if the benchmark wasn't selected on the command line.
+ */
+void bench_run(const char *name, const char *unit, long items, size_t bytes,
+               bench_fn fn, void *ctx);
+
+/**
+ * Returns whether any benchmark starting with `prefix` was selected, to
+ * skip setting up benchmarks that won't run.
+ */
+bool bench_selected(const char *prefix);
+
+/**
+ * Keep a result alive so the compiler can't optimize away the work that
+ * produced it.
+ */
+void bench_consume(const void *ptr);
+
+void bench_native(void);
+void bench_nif(void);
+
+#endif // _PORTAUDIO_BENCH_
@@ -0,0 +1,417 @@
+/**
+ * Benchmarks of the native building blocks, called directly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <portaudio.h>
+
+#include "bench.h"
+#include "erl_nif.h"
+#include "portaudio_nif/coalescer.h"
+#include "portaudio_nif/erl_interop.h"
+#include "portaudio_nif/jitter_buffer.h"
+#include "portaudio_nif/pa_conversions.h"
+#include "portaudio_nif/resampler.h"
+#include "portaudio_nif/routing.h"
+#include "portaudio_nif/samples.h"
+#include "portaudio_nif/spectrum.h"
+#include "portaudio_nif/util.h"
+
+#define SAMPLE_RATE 48000.0
+
+/**
+ * Frames converted per iteration, about one host buffer at high latency.
+ */
+#define CONVERT_FRAMES 4096
+
+/**
+ * Frames per packet or host buffer, 10ms at 48kHz.
+ */
+#define PACKET_FRAMES 480
+
+struct samples_ctx {
+        PaSampleFormat format;
+        int channels;
+        unsigned char *raw;
+        float *floats;
+};
+
+static const struct {
+        const char *name;
+        PaSampleFormat format;
+} _formats[] = {
+        { "float32", paFloat32 },
+        { "int32",   paInt32 },
+        { "int24",   paInt24 },
+        { "int16",   paInt16 },
+        { "int8",    paInt8 },
+        { "uint8",   paUInt8 }
+};
+
+static void _to_float(void *arg)
+{
+        struct samples_ctx *ctx = arg;
+        samples_to_float(ctx->format, ctx->raw, ctx->floats, CONVERT_FRAMES * ctx->channels);
+        bench_consume(ctx->floats);
+}
+
+static void _from_float(void *arg)
+{
+        struct samples_ctx *ctx = arg;
+        samples_from_float(ctx->format, ctx->floats, ctx->raw, CONVERT_FRAMES * ctx->channels);
+        bench_consume(ctx->raw);
+}
+
+static void _bench_samples(void)
+{
+        if (!bench_selected("samples"))
+                return;
+
+        struct samples_ctx ctx = { .channels = 2 };
+        ctx.raw = malloc(CONVERT_FRAMES * ctx.channels * 4);
+        ctx.floats = malloc(sizeof(float) * CONVERT_FRAMES * ctx.channels);
+        ensure(ctx.raw != NULL && ctx.floats != NULL);
+
+        long i;
+        for (i = 0; i < CONVERT_FRAMES * ctx.channels; i++)
+                ctx.floats[i] = (float) (i % 200 - 100) / 100.0f;
+
+        size_t f;
+        char name[64];
+        for (f = 0; f < sizeof(_formats) / sizeof(*_formats); f++) {
+                ctx.format = _formats[f].format;
+                const size_t bytes = CONVERT_FRAMES * ctx.channels * Pa_GetSampleSize(ctx.format);
+
+                samples_from_float(ctx.format, ctx.floats, ctx.raw, CONVERT_FRAMES * ctx.channels);
+
+                snprintf(name, sizeof(name), "samples/to_float/%s", _formats[f].name);
+                bench_run(name, "frame", CONVERT_FRAMES, bytes, &_to_float, &ctx);
+
+                snprintf(name, sizeof(name), "samples/from_float/%s", _formats[f].name);
+                bench_run(name, "frame", CONVERT_FRAMES, bytes, &_from_float, &ctx);
+        }
+
+        free(ctx.raw);
+        free(ctx.floats);
+}
+
+struct terms_ctx {
+        ErlNifEnv *env;
+        ERL_NIF_TERM params;
+};
+
+static void _sample_format_to_term(void *arg)
+{
+        struct terms_ctx *ctx = arg;
+        bench_consume((void *) pa_sample_format_to_term(ctx->env, paInt24));
+        enif_clear_env(ctx->env);
+}
+
+static void _stream_params_from_tuple(void *arg)
+{
+        struct terms_ctx *ctx = arg;
+        PaStreamParameters *params;
+        pa_stream_params_from_tuple(ctx->env, ctx->params, &params);
+        bench_consume(params);
+        enif_free(params);
+}
+
+static void _error_tuple(void *arg)
+{
+        struct terms_ctx *ctx = arg;
+        bench_consume((void *) pa_error_to_error_tuple(ctx->env, paOutputUnderflowed));
+        enif_clear_env(ctx->env);
+}
+
+static void _map_from_array(void *arg)
+{
+        struct terms_ctx *ctx = arg;
+        ErlNifEnv *env = ctx->env;
+
+#define N_FIELDS 8
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "running", erli_make_bool(env, true)),
+                make_kw_item(env, "ratio", enif_make_double(env, 1.0)),
+                make_kw_item(env, "drift_ppm", enif_make_double(env, 12.5)),
+                make_kw_item(env, "queued_frames", enif_make_double(env, 480.0)),
+                make_kw_item(env, "target_frames", enif_make_double(env, 480.0)),
+                make_kw_item(env, "input_overflows", enif_make_ulong(env, 0)),
+                make_kw_item(env, "output_underflows", enif_make_ulong(env, 0)),
+                make_kw_item(env, "frames", enif_make_ulong(env, 48000))
+        };
+        bench_consume((void *) erli_make_map_from_array(env, fields, N_FIELDS));
+#undef N_FIELDS
+
+        enif_clear_env(env);
+}
+
+static void _bench_terms(void)
+{
+        if (!bench_selected("pa_conversions") && !bench_selected("erl_interop"))
+                return;
+
+        struct terms_ctx ctx = { .env = enif_alloc_env() };
+        ErlNifEnv *params_env = enif_alloc_env();
+        ctx.params = enif_make_tuple4(params_env,
+                                      enif_make_uint(params_env, 0),
+                                      enif_make_uint(params_env, 2),
+                                      enif_make_atom(params_env, "int16"),
+                                      enif_make_double(params_env, 0.02));
+
+        bench_run("pa_conversions/sample_format_to_term", "call", 1, 0,
+                  &_sample_format_to_term, &ctx);
+        bench_run("pa_conversions/stream_params_from_tuple", "call", 1, 0,
+                  &_stream_params_from_tuple, &ctx);
+        bench_run("pa_conversions/error_to_error_tuple", "call", 1, 0, &_error_tuple, &ctx);
+        bench_run("erl_interop/make_map_from_array", "call", 1, 0, &_map_from_array, &ctx);
+
+        enif_free_env(ctx.env);
+        enif_free_env(params_env);
+}
+
+struct coalescer_ctx {
+        struct coalescer coalescer;
+        unsigned char *buffer;
+        ErlNifTime now;
+};
+
+static void _coalesce(void *arg)
+{
+        struct coalescer_ctx *ctx = arg;
+
+        // Pushes two host buffers per chunk and takes it once full
+        coalescer_push(&ctx->coalescer, ctx->buffer, PACKET_FRAMES, ctx->now);
+        if (coalescer_ready(&ctx->coalescer, ctx->now)) {
+                ErlNifBinary bin;
+                coalescer_take(&ctx->coalescer, &bin);
+                bench_consume(bin.data);
+                enif_release_binary(&bin);
+        }
+}
+
+static void _bench_coalescer(void)
+{
+        if (!bench_selected("coalescer"))
+                return;
+
+        struct coalescer_ctx ctx = { .now = 0 };
+        const size_t frame_size = 2 * sizeof(int16_t);
+        coalescer_init(&ctx.coalescer, frame_size, SAMPLE_RATE,
+                       2 * PACKET_FRAMES / SAMPLE_RATE, 1.0);
+        ctx.buffer = calloc(PACKET_FRAMES, frame_size);
+        ensure(ctx.buffer != NULL);
+
+        bench_run("coalescer/push_take", "frame", PACKET_FRAMES, PACKET_FRAMES * frame_size,
+                  &_coalesce, &ctx);
+
+        coalescer_destroy(&ctx.coalescer);
+        free(ctx.buffer);
+}
+
+struct routing_ctx {
+        struct routing *routing;
+        int route;
+        unsigned char *input;
+        unsigned char *output;
+};
+
+static void _route(void *arg)
+{
+        struct routing_ctx *ctx = arg;
+        routing_apply(ctx->routing, ctx->route, ctx->input, CONVERT_FRAMES, ctx->output);
+        bench_consume(ctx->output);
+}
+
+static void _bench_routing(void)
+{
+        if (!bench_selected("routing"))
+                return;
+
+        const int channels = 8;
+        ErlNifEnv *env = enif_alloc_env();
+
+        // A direct copy of two channels, and a mix of four down to one
+        const ERL_NIF_TERM half = enif_make_double(env, 0.25);
+        const ERL_NIF_TERM mix = enif_make_list(env, 4,
+                                                enif_make_tuple2(env, enif_make_int(env, 4), half),
+                                                enif_make_tuple2(env, enif_make_int(env, 5), half),
+                                                enif_make_tuple2(env, enif_make_int(env, 6), half),
+                                                enif_make_tuple2(env, enif_make_int(env, 7), half));
+        const ERL_NIF_TERM routes =
+                enif_make_list(env, 2,
+                               enif_make_tuple2(env, enif_make_atom(env, "direct"),
+                                                enif_make_list(env, 2,
+                                                               enif_make_int(env, 0),
+                                                               enif_make_int(env, 1))),
+                               enif_make_tuple2(env, enif_make_atom(env, "mix"),
+                                                enif_make_list(env, 1, mix)));
+
+        struct routing_ctx ctx = {
+                .routing = routing_from_term(env, routes, paInt16, channels),
+                .input = calloc(CONVERT_FRAMES, channels * sizeof(int16_t)),
+                .output = calloc(CONVERT_FRAMES, channels * sizeof(int16_t))
+        };
+        ensure(ctx.routing != NULL && ctx.input != NULL && ctx.output != NULL);
+
+        const size_t bytes = CONVERT_FRAMES * channels * sizeof(int16_t);
+        ctx.route = 0;
+        bench_run("routing/direct/int16", "frame", CONVERT_FRAMES, bytes, &_route, &ctx);
+        ctx.route = 1;
+        bench_run("routing/mix/int16", "frame", CONVERT_FRAMES, bytes, &_route, &ctx);
+
+        routing_destroy(ctx.routing);
+        free(ctx.input);
+        free(ctx.output);
+        enif_free_env(env);
+}
+
+struct resampler_ctx {
+        struct resampler resampler;
+        float *input;
+        float *output;
+};
+
+static void _resample(void *arg)
+{
+        struct resampler_ctx *ctx = arg;
+        resampler_process(&ctx->resampler, ctx->input, CONVERT_FRAMES, ctx->output, 1.0001);
+        bench_consume(ctx->output);
+}
+
+static void _bench_resampler(void)
+{
+        if (!bench_selected("resampler"))
+                return;
+
+        const int channels = 2;
+        struct resampler_ctx ctx;
+        resampler_init(&ctx.resampler, channels, SAMPLE_RATE, 44100.0);
+        ctx.input = calloc(CONVERT_FRAMES * channels, sizeof(float));
+        ctx.output = calloc(resampler_max_output(&ctx.resampler, CONVERT_FRAMES, 1.0001) * channels,
+                            sizeof(float));
+        ensure(ctx.input != NULL && ctx.output != NULL);
+
+        bench_run("resampler/48000_to_44100", "frame", CONVERT_FRAMES, 0, &_resample, &ctx);
+
+        resampler_destroy(&ctx.resampler);
+        free(ctx.input);
+        free(ctx.output);
+}
+
+struct jitter_ctx {
+        struct jitter_buffer jitter;
+        uint32_t seq;
+        float *output;
+};
+
+static void _jitter(void *arg)
+{
+        struct jitter_ctx *ctx = arg;
+        const int channels = ctx->jitter.channels;
+
+        // Every fourth pair of packets arrives swapped
+        const uint32_t seq = ctx->seq % 8 == 2 ? ctx->seq + 1
+                : ctx->seq % 8 == 3 ? ctx->seq - 1
+                : ctx->seq;
+        float *packet = enif_alloc(sizeof(float) * PACKET_FRAMES * channels);
+        memset(packet, 0, sizeof(float) * PACKET_FRAMES * channels);
+        jitter_buffer_push(&ctx->jitter, seq, seq * PACKET_FRAMES, packet, PACKET_FRAMES,
+                           (ErlNifTime) ctx->seq * 10000);
+        ctx->seq++;
+
+        jitter_buffer_pull(&ctx->jitter, ctx->output, PACKET_FRAMES);
+        bench_consume(ctx->output);
+}
+
+static void _bench_jitter_buffer(void)
+{
+        if (!bench_selected("jitter_buffer"))
+                return;
+
+        const int channels = 2;
+        struct jitter_ctx ctx = { .seq = 0 };
+        jitter_buffer_init(&ctx.jitter, channels, SAMPLE_RATE, 0.02, 0.2, JITTER_CONCEAL_REPEAT);
+        ctx.output = calloc(PACKET_FRAMES * channels, sizeof(float));
+        ensure(ctx.output != NULL);
+
+        bench_run("jitter_buffer/push_pull", "frame", PACKET_FRAMES, 0, &_jitter, &ctx);
+
+        jitter_buffer_destroy(&ctx.jitter);
+        free(ctx.output);
+}
+
+struct spectrum_ctx {
+        struct spectrum *spectrum;
+        int16_t *input;
+        float *output;
+};
+
+static void _analyze(void *arg)
+{
+        struct spectrum_ctx *ctx = arg;
+        spectrum_process(ctx->spectrum, (const unsigned char *) ctx->input, PACKET_FRAMES,
+                         ctx->output);
+        bench_consume(ctx->output);
+}
+
+static void _bench_spectrum(void)
+{
+        if (!bench_selected("spectrum"))
+                return;
+
+        const int channels = 2;
+        ErlNifEnv *env = enif_alloc_env();
+
+        static const struct {
+                const char *name;
+                const char *bands;
+                int mel_bands;
+        } analyses[] = {
+                { "spectrum/2048_hann/bins", "nil", 0 },
+                { "spectrum/2048_hann/mel64", NULL, 64 },
+                { "spectrum/2048_hann/third_octave", "third_octave", 0 }
+        };
+
+        size_t a;
+        for (a = 0; a < sizeof(analyses) / sizeof(*analyses); a++) {
+                const ERL_NIF_TERM bands = analyses[a].bands != NULL
+                        ? enif_make_atom(env, analyses[a].bands)
+                        : enif_make_tuple2(env, enif_make_atom(env, "mel"),
+                                           enif_make_int(env, analyses[a].mel_bands));
+                const ERL_NIF_TERM term = enif_make_tuple4(env,
+                                                           enif_make_int(env, 2048),
+                                                           enif_make_int(env, 512),
+                                                           enif_make_atom(env, "hann"),
+                                                           bands);
+
+                struct spectrum_ctx ctx = {
+                        .spectrum = spectrum_from_term(env, term, paInt16, channels, SAMPLE_RATE),
+                        .input = calloc(PACKET_FRAMES * channels, sizeof(int16_t))
+                };
+                ensure(ctx.spectrum != NULL && ctx.input != NULL);
+                ctx.output = malloc(spectrum_max_outputs(ctx.spectrum, PACKET_FRAMES)
+                                    * spectrum_output_size(ctx.spectrum));
+                ensure(ctx.output != NULL);
+
+                bench_run(analyses[a].name, "frame", PACKET_FRAMES,
+                          PACKET_FRAMES * channels * sizeof(int16_t), &_analyze, &ctx);
+
+                spectrum_destroy(ctx.spectrum);
+                free(ctx.input);
+                free(ctx.output);
+        }
+
+        enif_free_env(env);
+}
+
+void bench_native(void)
+{
+        _bench_samples();
+        _bench_terms();
+        _bench_coalescer();
+        _bench_routing();
+        _bench_resampler();
+        _bench_jitter_buffer();
+        _bench_spectrum();
+}
@@ -0,0 +1,207 @@
+/**
+ * Benchmarks of the read and write paths, called through the NIF table as
+ * the BEAM would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "erl_nif.h"
+#include "portaudio_nif/util.h"
+#include "stubs.h"
+
+/**
+ * Frames available on each read, 10ms at 48kHz.
+ */
+#define READ_FRAMES 480
+
+/**
+ * Frames passed to each write.
+ */
+#define WRITE_FRAMES 4096
+
+#define CHANNELS 2
+#define FRAME_SIZE (CHANNELS * 2)
+
+ErlNifEntry *nif_init(void);
+
+typedef ERL_NIF_TERM (*nif_fn)(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+
+struct nif_ctx {
+        nif_fn fn;
+        int argc;
+        ERL_NIF_TERM argv[4];
+        // Cleared after every call, like the environment of a NIF call
+        ErlNifEnv *env;
+};
+
+static ErlNifEntry *_entry;
+
+static nif_fn _find(const char *name, unsigned arity)
+{
+        int i;
+        for (i = 0; i < _entry->num_of_funcs; i++) {
+                const ErlNifFunc *func = &_entry->funcs[i];
+                if (strcmp(func->name, name) == 0 && func->arity == arity)
+                        return func->fptr;
+        }
+
+        fprintf(stderr, "NIF %s/%u not found\n", name, arity);
+        abort();
+}
+
+static ERL_NIF_TERM _call(ErlNifEnv *env, const char *name, int argc, const ERL_NIF_TERM argv[])
+{
+        return _find(name, argc)(env, argc, argv);
+}
+
+static void _call_nif(void *arg)
+{
+        struct nif_ctx *ctx = arg;
+        bench_consume((void *) ctx->fn(ctx->env, ctx->argc, ctx->argv));
+        enif_clear_env(ctx->env);
+}
+
+/**
+ * Open and start a stub stream, returning the stream term.
+ */
+static ERL_NIF_TERM _open_stream(ErlNifEnv *env, bool input)
+{
+        const ERL_NIF_TERM params = enif_make_tuple4(env,
+                                                     enif_make_uint(env, 0),
+                                                     enif_make_uint(env, CHANNELS),
+                                                     enif_make_atom(env, "int16"),
+                                                     enif_make_double(env, 0.02));
+        const ERL_NIF_TERM nil = enif_make_atom(env, "nil");
+        const ERL_NIF_TERM argv[5] = {
+                input ? params : nil,
+                input ? nil : params,
+                enif_make_double(env, 48000.0),
+                enif_make_list(env, 0),
+                enif_make_ulong(env, READ_FRAMES)
+        };
+
+        const ERL_NIF_TERM ret = _call(env, "stream_open", 5, argv);
+        int arity;
+        const ERL_NIF_TERM *tuple;
+        ensure(enif_get_tuple(env, ret, &arity, &tuple) && arity == 2);
+
+        const ERL_NIF_TERM stream = tuple[1];
+        _call(env, "stream_start", 1, &stream);
+        return stream;
+}
+
+static void _bench_read(ErlNifEnv *env)
+{
+        if (!bench_selected("nif/stream_read"))
+                return;
+
+        const ERL_NIF_TERM stream = _open_stream(env, true);
+        portaudio_stub_set_read_available(READ_FRAMES);
+
+        struct nif_ctx ctx = {
+                .fn = _find("stream_read", 1),
+                .argc = 1,
+                .argv = { stream },
+                .env = enif_alloc_env()
+        };
+        const size_t bytes = READ_FRAMES * FRAME_SIZE;
+
+        bench_run("nif/stream_read/raw", "frame", READ_FRAMES, bytes, &_call_nif, &ctx);
+
+        // Two reads make up each chunk
+        const ERL_NIF_TERM delivery[3] = {
+                stream,
+                enif_make_double(env, 2 * READ_FRAMES / 48000.0),
+                enif_make_double(env, 1.0)
+        };
+        _call(env, "stream_set_delivery", 3, delivery);
+        bench_run("nif/stream_read/coalesced", "frame", READ_FRAMES, bytes, &_call_nif, &ctx);
+
+        const ERL_NIF_TERM no_delivery[3] = {
+                stream, enif_make_atom(env, "nil"), enif_make_double(env, 0.0)
+        };
+        _call(env, "stream_set_delivery", 3, no_delivery);
+
+        const ERL_NIF_TERM routing[2] = {
+                stream,
+                enif_make_list(env, 2,
+                               enif_make_tuple2(env, enif_make_atom(env, "left"),
+                                                enif_make_list(env, 1, enif_make_int(env, 0))),
+                               enif_make_tuple2(env, enif_make_atom(env, "mono"),
+                                                enif_make_list(env, 1,
+                                                               enif_make_list(env, 2,
+                                                                              enif_make_tuple2(env, enif_make_int(env, 0), enif_make_double(env, 0.5)),
+                                                                              enif_make_tuple2(env, enif_make_int(env, 1), enif_make_double(env, 0.5))))))
+        };
+        _call(env, "stream_set_routing", 2, routing);
+        bench_run("nif/stream_read/routed", "frame", READ_FRAMES, bytes, &_call_nif, &ctx);
+
+        _call(env, "stream_close", 1, &stream);
+        enif_free_env(ctx.env);
+}
+
+static void _bench_write(ErlNifEnv *env)
+{
+        if (!bench_selected("nif/stream_write"))
+                return;
+
+        const ERL_NIF_TERM stream = _open_stream(env, false);
+        const size_t bytes = WRITE_FRAMES * FRAME_SIZE;
+
+        ERL_NIF_TERM binary;
+        memset(enif_make_new_binary(env, bytes, &binary), 0, bytes);
+
+        struct nif_ctx ctx = {
+                .fn = _find("stream_write", 2),
+                .argc = 2,
+                .argv = { stream, binary },
+                .env = enif_alloc_env()
+        };
+        bench_run("nif/stream_write/binary", "frame", WRITE_FRAMES, bytes, &_call_nif, &ctx);
+
+        // The same audio split in to four binaries, which has to be copied
+        ERL_NIF_TERM parts[4];
+        int i;
+        for (i = 0; i < 4; i++)
+                memset(enif_make_new_binary(env, bytes / 4, &parts[i]), 0, bytes / 4);
+        ctx.argv[1] = enif_make_list(env, 4, parts[0], parts[1], parts[2], parts[3]);
+        bench_run("nif/stream_write/iolist", "frame", WRITE_FRAMES, bytes, &_call_nif, &ctx);
+
+        _call(env, "stream_close", 1, &stream);
+        enif_free_env(ctx.env);
+}
+
+static void _bench_device_info(ErlNifEnv *env)
+{
+        struct nif_ctx ctx = {
+                .fn = _find("device_info", 1),
+                .argc = 1,
+                .argv = { enif_make_int(env, 0) },
+                .env = enif_alloc_env()
+        };
+        bench_run("nif/device_info", "call", 1, 0, &_call_nif, &ctx);
+
+        enif_free_env(ctx.env);
+}
+
+void bench_nif(void)
+{
+        if (!bench_selected("nif"))
+                return;
+
+        _entry = nif_init();
+
+        ErlNifEnv *env = enif_alloc_env();
+        void *priv_data = NULL;
+        ensure(_entry->load(env, &priv_data, enif_make_int(env, 0)) == 0);
+
+        _bench_device_info(env);
+        _bench_read(env);
+        _bench_write(env);
+
+        if (_entry->unload != NULL)
+                _entry->unload(env, priv_data);
+        enif_free_env(env);
+}
@@ -0,0 +1,1054 @@
+/**
+ * A minimal stand-in for the parts of the NIF API used by the library, so
+ * the native code can be benchmarked without a running BEAM.
+ *
+ * Terms are pointers to cells allocated from an arena owned by their
+ * environment. Atoms and pids live for the lifetime of the program. Binaries
+ * and resources are reference counted, with every environment holding a
+ * reference to those it has made terms of until it's cleared.
+ *
+ * Costs are in the same ballpark as the real thing for the calls the
+ * library makes, but the absolute numbers of anything building terms
+ * should only be compared against earlier runs of this harness.
+ */
+// For clock_gettime and the POSIX thread and time functions
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "erl_nif.h"
+#include "portaudio_nif/util.h"
+#include "stubs.h"
+
+/**
+ * Size of each block of an environment's arena.
+ */
+#define STUB_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Number of slots in the atom table, which never grows.
+ */
+#define STUB_ATOM_SLOTS 4096
+
+atomic_ulong erl_nif_stub_messages_sent;
+
+enum stub_type {
+        // In the standard term order
+        STUB_NUMBER,
+        STUB_ATOM,
+        STUB_RESOURCE,
+        STUB_PID,
+        STUB_TUPLE,
+        STUB_MAP,
+        STUB_NIL,
+        STUB_CONS,
+        STUB_BINARY
+};
+
+struct stub_refc {
+        atomic_long refs;
+        // Called when the last reference is released
+        void (*release)(struct stub_refc *refc);
+};
+
+struct stub_binary {
+        struct stub_refc refc;
+        size_t size;
+        unsigned char data[];
+};
+
+struct enif_resource_type_t {
+        const char *name;
+        ErlNifResourceDtor *dtor;
+        ErlNifResourceDown *down;
+};
+
+struct stub_resource {
+        struct stub_refc refc;
+        ErlNifResourceType *type;
+        max_align_t data[];
+};
+
+struct stub_term {
+        enum stub_type type;
+        bool is_float;
+        union {
+                int64_t i;
+                double d;
+                const char *atom;
+                struct {
+                        ERL_NIF_TERM head;
+                        ERL_NIF_TERM tail;
+                } cons;
+                struct {
+                        size_t size;
+                        unsigned char *data;
+                        struct stub_refc *refc;
+                } bin;
+                struct stub_resource *resource;
+        } u;
+        // Elements of tuples, or the keys followed by the values of maps
+        size_t n;
+        ERL_NIF_TERM elems[];
+};
+
+struct stub_block {
+        struct stub_block *next;
+        size_t used;
+        size_t size;
+        max_align_t data[];
+};
+
+struct enif_environment_t {
+        struct stub_block *blocks;
+        struct stub_refc **owned;
+        size_t n_owned;
+        size_t cap_owned;
+};
+
+struct ErlDrvMutex_ {
+        pthread_mutex_t mutex;
+};
+
+struct ErlDrvCond_ {
+        pthread_cond_t cond;
+};
+
+struct ErlDrvRWLock_ {
+        pthread_rwlock_t rwlock;
+};
+
+struct ErlDrvTid_ {
+        pthread_t thread;
+};
+
+static struct stub_term _nil = { .type = STUB_NIL };
+static struct stub_term _self = { .type = STUB_PID, .u.i = 1 };
+
+static pthread_mutex_t _atom_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stub_term *_atoms[STUB_ATOM_SLOTS];
+
+static struct stub_term *_cell(ERL_NIF_TERM term)
+{
+        return (struct stub_term *) (uintptr_t) term;
+}
+
+static ERL_NIF_TERM _term(const struct stub_term *cell)
+{
+        return (ERL_NIF_TERM) (uintptr_t) cell;
+}
+
+static void *_arena_alloc(ErlNifEnv *env, size_t size)
+{
+        size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+        struct stub_block *block = env->blocks;
+        if (block == NULL || block->size - block->used < size) {
+                const size_t block_size = size > STUB_BLOCK_SIZE ? size : STUB_BLOCK_SIZE;
+                block = malloc(sizeof(*block) + block_size);
+                ensure(block != NULL);
+                block->next = env->blocks;
+                block->used = 0;
+                block->size = block_size;
+                env->blocks = block;
+        }
+
+        void *ptr = (unsigned char *) block->data + block->used;
+        block->used += size;
+        return ptr;
+}
+
+static struct stub_term *_make_cell(ErlNifEnv *env, enum stub_type type, size_t n_elems)
+{
+        struct stub_term *cell = _arena_alloc(env, sizeof(*cell) + sizeof(ERL_NIF_TERM) * n_elems);
+        cell->type = type;
+        cell->is_float = false;
+        cell->n = n_elems;
+        return cell;
+}
+
+static void _refc_keep(struct stub_refc *refc)
+{
+        atomic_fetch_add(&refc->refs, 1);
+}
+
+static void _refc_release(struct stub_refc *refc)
+{
+        if (atomic_fetch_sub(&refc->refs, 1) == 1)
+                refc->release(refc);
+}
+
+/**
+ * Hand a reference over to the environment, to be released when cleared.
+ */
+static void _own(ErlNifEnv *env, struct stub_refc *refc)
+{
+        if (env->n_owned == env->cap_owned) {
+                env->cap_owned = env->cap_owned * 2 + 16;
+                env->owned = realloc(env->owned, sizeof(*env->owned) * env->cap_owned);
+                ensure(env->owned != NULL);
+        }
+        env->owned[env->n_owned++] = refc;
+}
+
+/*
+ * Memory
+ */
+
+void *enif_alloc(size_t size)
+{
+        return malloc(size);
+}
+
+void *enif_realloc(void *ptr, size_t size)
+{
+        return realloc(ptr, size);
+}
+
+void enif_free(void *ptr)
+{
+        free(ptr);
+}
+
+/*
+ * Environments
+ */
+
+ErlNifEnv *enif_alloc_env(void)
+{
+        ErlNifEnv *env = calloc(1, sizeof(*env));
+        ensure(env != NULL);
+        return env;
+}
+
+void enif_clear_env(ErlNifEnv *env)
+{
+        size_t i;
+        for (i = 0; i < env->n_owned; i++)
+                _refc_release(env->owned[i]);
+        env->n_owned = 0;
+
+        // Keep the newest block around for reuse
+        struct stub_block *block = env->blocks;
+        if (block == NULL)
+                return;
+
+        struct stub_block *next = block->next;
+        while (next != NULL) {
+                struct stub_block *tmp = next->next;
+                free(next);
+                next = tmp;
+        }
+        block->next = NULL;
+        block->used = 0;
+}
+
+void enif_free_env(ErlNifEnv *env)
+{
+        enif_clear_env(env);
+        free(env->blocks);
+        free(env->owned);
+        free(env);
+}
+
+/*
+ * Making terms
+ */
+
+ERL_NIF_TERM enif_make_atom(ErlNifEnv *env, const char *name)
+{
+        unused(env);
+
+        uint32_t hash = 2166136261u;
+        const char *c;
+        for (c = name; *c != '\0'; c++)
+                hash = (hash ^ (unsigned char) *c) * 16777619u;
+
+        pthread_mutex_lock(&_atom_lock);
+
+        size_t slot = hash % STUB_ATOM_SLOTS;
+        while (_atoms[slot] != NULL && strcmp(_atoms[slot]->u.atom, name) != 0)
+                slot = (slot + 1) % STUB_ATOM_SLOTS;
+
+        if (_atoms[slot] == NULL) {
+                struct stub_term *atom = calloc(1, sizeof(*atom));
+                ensure(atom != NULL);
+                atom->type = STUB_ATOM;
+                atom->u.atom = strdup(name);
+                ensure(atom->u.atom != NULL);
+                _atoms[slot] = atom;
+        }
+
+        const ERL_NIF_TERM term = _term(_atoms[slot]);
+
+        pthread_mutex_unlock(&_atom_lock);
+
+        return term;
+}
+
+ERL_NIF_TERM enif_make_badarg(ErlNifEnv *env)
+{
+        return enif_make_atom(env, "badarg");
+}
+
+ERL_NIF_TERM enif_raise_exception(ErlNifEnv *env, ERL_NIF_TERM reason)
+{
+        unused(env);
+        return reason;
+}
+
+static ERL_NIF_TERM _make_integer(ErlNifEnv *env, int64_t i)
+{
+        struct stub_term *cell = _make_cell(env, STUB_NUMBER, 0);
+        cell->u.i = i;
+        return _term(cell);
+}
+
+ERL_NIF_TERM enif_make_int(ErlNifEnv *env, int i)
+{
+        return _make_integer(env, i);
+}
+
+ERL_NIF_TERM enif_make_uint(ErlNifEnv *env, unsigned i)
+{
+        return _make_integer(env, i);
+}
+
+ERL_NIF_TERM enif_make_long(ErlNifEnv *env, long i)
+{
+        return _make_integer(env, i);
+}
+
+ERL_NIF_TERM enif_make_ulong(ErlNifEnv *env, unsigned long i)
+{
+        return _make_integer(env, (int64_t) i);
+}
+
+ERL_NIF_TERM enif_make_double(ErlNifEnv *env, double d)
+{
+        struct stub_term *cell = _make_cell(env, STUB_NUMBER, 0);
+        cell->is_float = true;
+        cell->u.d = d;
+        return _term(cell);
+}
+
+ERL_NIF_TERM enif_make_tuple(ErlNifEnv *env, unsigned cnt, ...)
+{
+        struct stub_term *cell = _make_cell(env, STUB_TUPLE, cnt);
+
+        va_list ap;
+        va_start(ap, cnt);
+        unsigned i;
+        for (i = 0; i < cnt; i++)
+                cell->elems[i] = va_arg(ap, ERL_NIF_TERM);
+        va_end(ap);
+
+        return _term(cell);
+}
+
+ERL_NIF_TERM enif_make_list_cell(ErlNifEnv *env, ERL_NIF_TERM car, ERL_NIF_TERM cdr)
+{
+        struct stub_term *cell = _make_cell(env, STUB_CONS, 0);
+        cell->u.cons.head = car;
+        cell->u.cons.tail = cdr;
+        return _term(cell);
+}
+
+ERL_NIF_TERM enif_make_list(ErlNifEnv *env, unsigned cnt, ...)
+{
+        ERL_NIF_TERM elems[cnt + 1];
+
+        va_list ap;
+        va_start(ap, cnt);
+        unsigned i;
+        for (i = 0; i < cnt; i++)
+                elems[i] = va_arg(ap, ERL_NIF_TERM);
+        va_end(ap);
+
+        ERL_NIF_TERM list = _term(&_nil);
+        for (i = cnt; i > 0; i--)
+                list = enif_make_list_cell(env, elems[i - 1], list);
+
+        return list;
+}
+
+ERL_NIF_TERM enif_make_new_map(ErlNifEnv *env)
+{
+        return _term(_make_cell(env, STUB_MAP, 0));
+}
+
+int enif_make_map_put(ErlNifEnv *env, ERL_NIF_TERM map_in, ERL_NIF_TERM key,
+                      ERL_NIF_TERM value, ERL_NIF_TERM *map_out)
+{
+        const struct stub_term *in = _cell(map_in);
+        if (in->type != STUB_MAP)
+                return 0;
+
+        const size_t n = in->n / 2;
+        size_t i;
+        for (i = 0; i < n && enif_compare(in->elems[i], key) != 0; i++)
+                ;
+
+        // Maps are immutable, so every put copies
+        const size_t out_n = i == n ? n + 1 : n;
+        struct stub_term *out = _make_cell(env, STUB_MAP, out_n * 2);
+        memcpy(out->elems, in->elems, sizeof(ERL_NIF_TERM) * n);
+        memcpy(out->elems + out_n, in->elems + n, sizeof(ERL_NIF_TERM) * n);
+        out->elems[i] = key;
+        out->elems[out_n + i] = value;
+
+        *map_out = _term(out);
+        return 1;
+}
+
+static void _binary_release(struct stub_refc *refc)
+{
+        free(refc);
+}
+
+static struct stub_binary *_binary_alloc(size_t size)
+{
+        struct stub_binary *bin = malloc(sizeof(*bin) + size);
+        ensure(bin != NULL);
+        atomic_init(&bin->refc.refs, 1);
+        bin->refc.release = &_binary_release;
+        bin->size = size;
+        return bin;
+}
+
+static ERL_NIF_TERM _make_binary_term(ErlNifEnv *env, struct stub_binary *bin)
+{
+        struct stub_term *cell = _make_cell(env, STUB_BINARY, 0);
+        cell->u.bin.size = bin->size;
+        cell->u.bin.data = bin->data;
+        cell->u.bin.refc = &bin->refc;
+        return _term(cell);
+}
+
+int enif_alloc_binary(size_t size, ErlNifBinary *bin)
+{
+        struct stub_binary *refc = _binary_alloc(size);
+        bin->size = size;
+        bin->data = refc->data;
+        bin->ref_bin = refc;
+        return 1;
+}
+
+int enif_realloc_binary(ErlNifBinary *bin, size_t size)
+{
+        struct stub_binary *refc = realloc(bin->ref_bin, sizeof(*refc) + size);
+        if (refc == NULL)
+                return 0;
+
+        refc->size = size;
+        bin->size = size;
+        bin->data = refc->data;
+        bin->ref_bin = refc;
+        return 1;
+}
+
+void enif_release_binary(ErlNifBinary *bin)
+{
+        if (bin->ref_bin != NULL)
+                _refc_release(bin->ref_bin);
+        bin->ref_bin = NULL;
+}
+
+ERL_NIF_TERM enif_make_binary(ErlNifEnv *env, ErlNifBinary *bin)
+{
+        // The environment takes over the caller's reference
+        struct stub_binary *refc = bin->ref_bin;
+        assert(refc != NULL);
+        refc->size = bin->size;
+        _own(env, &refc->refc);
+        bin->ref_bin = NULL;
+        return _make_binary_term(env, refc);
+}
+
+unsigned char *enif_make_new_binary(ErlNifEnv *env, size_t size, ERL_NIF_TERM *termp)
+{
+        struct stub_binary *bin = _binary_alloc(size);
+        _own(env, &bin->refc);
+        *termp = _make_binary_term(env, bin);
+        return bin->data;
+}
+
+static void _resource_release(struct stub_refc *refc)
+{
+        static struct enif_environment_t dtor_env;
+
+        struct stub_resource *res = (struct stub_resource *) refc;
+        if (res->type->dtor != NULL)
+                res->type->dtor(&dtor_env, res->data);
+        free(res);
+}
+
+static struct stub_resource *_resource_header(void *obj)
+{
+        return (struct stub_resource *) ((unsigned char *) obj - offsetof(struct stub_resource, data));
+}
+
+ErlNifResourceType *enif_open_resource_type(ErlNifEnv *env, const char *module_str,
+                                            const char *name_str, ErlNifResourceDtor *dtor,
+                                            ErlNifResourceFlags flags,
+                                            ErlNifResourceFlags *tried)
+{
+        unused(env); unused(module_str); unused(flags);
+
+        ErlNifResourceType *type = calloc(1, sizeof(*type));
+        ensure(type != NULL);
+        type->name = name_str;
+        type->dtor = dtor;
+        if (tried != NULL)
+                *tried = flags;
+        return type;
+}
+
+ErlNifResourceType *enif_open_resource_type_x(ErlNifEnv *env, const char *name_str,
+                                              const ErlNifResourceTypeInit *init,
+                                              ErlNifResourceFlags flags,
+                                              ErlNifResourceFlags *tried)
+{
+        ErlNifResourceType *type =
+                enif_open_resource_type(env, NULL, name_str, init->dtor, flags, tried);
+        type->down = init->down;
+        return type;
+}
+
+void *enif_alloc_resource(ErlNifResourceType *type, size_t size)
+{
+        struct stub_resource *res = malloc(sizeof(*res) + size);
+        ensure(res != NULL);
+        atomic_init(&res->refc.refs, 1);
+        res->refc.release = &_resource_release;
+        res->type = type;
+        return res->data;
+}
+
+void enif_keep_resource(void *obj)
+{
+        _refc_keep(&_resource_header(obj)->refc);
+}
+
+void enif_release_resource(void *obj)
+{
+        _refc_release(&_resource_header(obj)->refc);
+}
+
+ERL_NIF_TERM enif_make_resource(ErlNifEnv *env, void *obj)
+{
+        struct stub_resource *res = _resource_header(obj);
+        _refc_keep(&res->refc);
+        _own(env, &res->refc);
+
+        struct stub_term *cell = _make_cell(env, STUB_RESOURCE, 0);
+        cell->u.resource = res;
+        return _term(cell);
+}
+
+ERL_NIF_TERM enif_make_copy(ErlNifEnv *dst_env, ERL_NIF_TERM src_term)
+{
+        const struct stub_term *src = _cell(src_term);
+        struct stub_term *dst;
+        size_t i;
+
+        switch (src->type) {
+        case STUB_ATOM:
+        case STUB_PID:
+        case STUB_NIL:
+                return src_term;
+        case STUB_CONS:
+                return enif_make_list_cell(dst_env,
+                                           enif_make_copy(dst_env, src->u.cons.head),
+                                           enif_make_copy(dst_env, src->u.cons.tail));
+        case STUB_BINARY:
+                _refc_keep(src->u.bin.refc);
+                _own(dst_env, src->u.bin.refc);
+                break;
+        case STUB_RESOURCE:
+                _refc_keep(&src->u.resource->refc);
+                _own(dst_env, &src->u.resource->refc);
+                break;
+        default:
+                break;
+        }
+
+        dst = _make_cell(dst_env, src->type, src->n);
+        dst->is_float = src->is_float;
+        dst->u = src->u;
+        for (i = 0; i < src->n; i++)
+                dst->elems[i] = enif_make_copy(dst_env, src->elems[i]);
+
+        return _term(dst);
+}
+
+/*
+ * Reading terms
+ */
+
+int enif_is_atom(ErlNifEnv *env, ERL_NIF_TERM term)
+{
+        unused(env);
+        return _cell(term)->type == STUB_ATOM;
+}
+
+int enif_is_tuple(ErlNifEnv *env, ERL_NIF_TERM term)
+{
+        unused(env);
+        return _cell(term)->type == STUB_TUPLE;
+}
+
+int enif_is_map(ErlNifEnv *env, ERL_NIF_TERM term)
+{
+        unused(env);
+        return _cell(term)->type == STUB_MAP;
+}
+
+int enif_is_list(ErlNifEnv *env, ERL_NIF_TERM term)
+{
+        unused(env);
+        const enum stub_type type = _cell(term)->type;
+        return type == STUB_CONS || type == STUB_NIL;
+}
+
+static bool _get_integer(ERL_NIF_TERM term, int64_t min, int64_t max, int64_t *i)
+{
+        const struct stub_term *cell = _cell(term);
+        if (cell->type != STUB_NUMBER || cell->is_float || cell->u.i < min || cell->u.i > max)
+                return false;
+
+        *i = cell->u.i;
+        return true;
+}
+
+int enif_get_int(ErlNifEnv *env, ERL_NIF_TERM term, int *ip)
+{
+        unused(env);
+        int64_t i;
+        if (!_get_integer(term, INT32_MIN, INT32_MAX, &i))
+                return 0;
+        *ip = (int) i;
+        return 1;
+}
+
+int enif_get_uint(ErlNifEnv *env, ERL_NIF_TERM term, unsigned *ip)
+{
+        unused(env);
+        int64_t i;
+        if (!_get_integer(term, 0, UINT32_MAX, &i))
+                return 0;
+        *ip = (unsigned) i;
+        return 1;
+}
+
+int enif_get_long(ErlNifEnv *env, ERL_NIF_TERM term, long *ip)
+{
+        unused(env);
+        int64_t i;
+        if (!_get_integer(term, INT64_MIN, INT64_MAX, &i))
+                return 0;
+        *ip = (long) i;
+        return 1;
+}
+
+int enif_get_ulong(ErlNifEnv *env, ERL_NIF_TERM term, unsigned long *ip)
+{
+        unused(env);
+        int64_t i;
+        if (!_get_integer(term, 0, INT64_MAX, &i))
+                return 0;
+        *ip = (unsigned long) i;
+        return 1;
+}
+
+int enif_get_double(ErlNifEnv *env, ERL_NIF_TERM term, double *dp)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(term);
+        if (cell->type != STUB_NUMBER || !cell->is_float)
+                return 0;
+        *dp = cell->u.d;
+        return 1;
+}
+
+int enif_get_tuple(ErlNifEnv *env, ERL_NIF_TERM tpl, int *arity, const ERL_NIF_TERM **array)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(tpl);
+        if (cell->type != STUB_TUPLE)
+                return 0;
+        *arity = (int) cell->n;
+        *array = cell->elems;
+        return 1;
+}
+
+int enif_get_map_value(ErlNifEnv *env, ERL_NIF_TERM map, ERL_NIF_TERM key,
+                       ERL_NIF_TERM *value)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(map);
+        if (cell->type != STUB_MAP)
+                return 0;
+
+        const size_t n = cell->n / 2;
+        size_t i;
+        for (i = 0; i < n; i++) {
+                if (enif_compare(cell->elems[i], key) == 0) {
+                        *value = cell->elems[n + i];
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+int enif_get_list_cell(ErlNifEnv *env, ERL_NIF_TERM term, ERL_NIF_TERM *head,
+                       ERL_NIF_TERM *tail)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(term);
+        if (cell->type != STUB_CONS)
+                return 0;
+        *head = cell->u.cons.head;
+        *tail = cell->u.cons.tail;
+        return 1;
+}
+
+int enif_get_list_length(ErlNifEnv *env, ERL_NIF_TERM term, unsigned *len)
+{
+        unused(env);
+        unsigned n = 0;
+        const struct stub_term *cell = _cell(term);
+        while (cell->type == STUB_CONS) {
+                n++;
+                cell = _cell(cell->u.cons.tail);
+        }
+        if (cell->type != STUB_NIL)
+                return 0;
+        *len = n;
+        return 1;
+}
+
+int enif_get_resource(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifResourceType *type, void **objp)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(term);
+        if (cell->type != STUB_RESOURCE || cell->u.resource->type != type)
+                return 0;
+        *objp = cell->u.resource->data;
+        return 1;
+}
+
+int enif_inspect_binary(ErlNifEnv *env, ERL_NIF_TERM bin_term, ErlNifBinary *bin)
+{
+        unused(env);
+        const struct stub_term *cell = _cell(bin_term);
+        if (cell->type != STUB_BINARY)
+                return 0;
+        bin->size = cell->u.bin.size;
+        bin->data = cell->u.bin.data;
+        bin->ref_bin = NULL;
+        return 1;
+}
+
+static bool _iolist_size(ERL_NIF_TERM term, size_t *size)
+{
+        const struct stub_term *cell = _cell(term);
+        switch (cell->type) {
+        case STUB_BINARY:
+                *size += cell->u.bin.size;
+                return true;
+        case STUB_NUMBER:
+                *size += 1;
+                return !cell->is_float && cell->u.i >= 0 && cell->u.i <= 255;
+        case STUB_NIL:
+                return true;
+        case STUB_CONS:
+                return _iolist_size(cell->u.cons.head, size)
+                        && _iolist_size(cell->u.cons.tail, size);
+        default:
+                return false;
+        }
+}
+
+static unsigned char *_iolist_copy(ERL_NIF_TERM term, unsigned char *dst)
+{
+        const struct stub_term *cell = _cell(term);
+        switch (cell->type) {
+        case STUB_BINARY:
+                memcpy(dst, cell->u.bin.data, cell->u.bin.size);
+                return dst + cell->u.bin.size;
+        case STUB_NUMBER:
+                *dst = (unsigned char) cell->u.i;
+                return dst + 1;
+        case STUB_CONS:
+                dst = _iolist_copy(cell->u.cons.head, dst);
+                return _iolist_copy(cell->u.cons.tail, dst);
+        default:
+                return dst;
+        }
+}
+
+int enif_inspect_iolist_as_binary(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifBinary *bin)
+{
+        if (enif_inspect_binary(env, term, bin))
+                return 1;
+
+        size_t size = 0;
+        if (_cell(term)->type != STUB_CONS || !_iolist_size(term, &size))
+                return 0;
+
+        bin->size = size;
+        bin->data = _arena_alloc(env, size);
+        bin->ref_bin = NULL;
+        _iolist_copy(term, bin->data);
+        return 1;
+}
+
+static int _compare_values(int64_t a, int64_t b)
+{
+        return (a > b) - (a < b);
+}
+
+int enif_compare(ERL_NIF_TERM lhs, ERL_NIF_TERM rhs)
+{
+        if (lhs == rhs)
+                return 0;
+
+        const struct stub_term *a = _cell(lhs);
+        const struct stub_term *b = _cell(rhs);
+        if (a->type != b->type)
+                return a->type < b->type ? -1 : 1;
+
+        size_t i;
+        int ret;
+        switch (a->type) {
+        case STUB_NUMBER: {
+                const double x = a->is_float ? a->u.d : (double) a->u.i;
+                const double y = b->is_float ? b->u.d : (double) b->u.i;
+                return (x > y) - (x < y);
+        }
+        case STUB_ATOM:
+                return strcmp(a->u.atom, b->u.atom);
+        case STUB_PID:
+                return _compare_values(a->u.i, b->u.i);
+        case STUB_RESOURCE:
+                return _compare_values((intptr_t) a->u.resource, (intptr_t) b->u.resource);
+        case STUB_TUPLE:
+        case STUB_MAP:
+                if (a->n != b->n)
+                        return a->n < b->n ? -1 : 1;
+                for (i = 0; i < a->n; i++) {
+                        ret = enif_compare(a->elems[i], b->elems[i]);
+                        if (ret != 0)
+                                return ret;
+                }
+                return 0;
+        case STUB_CONS:
+                ret = enif_compare(a->u.cons.head, b->u.cons.head);
+                return ret != 0 ? ret : enif_compare(a->u.cons.tail, b->u.cons.tail);
+        case STUB_BINARY: {
+                const size_t n = a->u.bin.size < b->u.bin.size ? a->u.bin.size : b->u.bin.size;
+                ret = memcmp(a->u.bin.data, b->u.bin.data, n);
+                return ret != 0 ? ret : _compare_values(a->u.bin.size, b->u.bin.size);
+        }
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Processes and scheduling
+ */
+
+ErlNifPid *enif_self(ErlNifEnv *caller_env, ErlNifPid *pid)
+{
+        unused(caller_env);
+        pid->pid = _term(&_self);
+        return pid;
+}
+
+int enif_get_local_pid(ErlNifEnv *env, ERL_NIF_TERM term, ErlNifPid *pid)
+{
+        unused(env);
+        if (_cell(term)->type != STUB_PID)
+                return 0;
+        pid->pid = term;
+        return 1;
+}
+
+int enif_send(ErlNifEnv *caller_env, const ErlNifPid *to_pid, ErlNifEnv *msg_env,
+              ERL_NIF_TERM msg)
+{
+        unused(caller_env); unused(to_pid); unused(msg);
+
+        atomic_fetch_add(&erl_nif_stub_messages_sent, 1);
+        if (msg_env != NULL)
+                enif_clear_env(msg_env);
+        return 1;
+}
+
+int enif_monitor_process(ErlNifEnv *caller_env, void *obj, const ErlNifPid *target_pid,
+                         ErlNifMonitor *mon)
+{
+        unused(caller_env); unused(obj); unused(target_pid);
+        memset(mon, 0, sizeof(*mon));
+        return 0;
+}
+
+int enif_demonitor_process(ErlNifEnv *caller_env, void *obj, const ErlNifMonitor *mon)
+{
+        unused(caller_env); unused(obj); unused(mon);
+        return 0;
+}
+
+int enif_consume_timeslice(ErlNifEnv *env, int percent)
+{
+        unused(env); unused(percent);
+        return 0;
+}
+
+ERL_NIF_TERM enif_schedule_nif(ErlNifEnv *caller_env, const char *fun_name, int flags,
+                               ERL_NIF_TERM (*fp)(ErlNifEnv *env, int argc,
+                                                  const ERL_NIF_TERM argv[]),
+                               int argc, const ERL_NIF_TERM argv[])
+{
+        unused(fun_name); unused(flags);
+        return fp(caller_env, argc, argv);
+}
+
+ErlNifTime enif_monotonic_time(ErlNifTimeUnit unit)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        const ErlNifTime nsec = (ErlNifTime) ts.tv_sec * 1000000000 + ts.tv_nsec;
+        switch (unit) {
+        case ERL_NIF_SEC:
+                return nsec / 1000000000;
+        case ERL_NIF_MSEC:
+                return nsec / 1000000;
+        case ERL_NIF_USEC:
+                return nsec / 1000;
+        default:
+                return nsec;
+        }
+}
+
+/*
+ * Threads
+ */
+
+ErlNifMutex *enif_mutex_create(char *name)
+{
+        unused(name);
+        ErlNifMutex *mtx = malloc(sizeof(*mtx));
+        ensure(mtx != NULL);
+        pthread_mutex_init(&mtx->mutex, NULL);
+        return mtx;
+}
+
+void enif_mutex_destroy(ErlNifMutex *mtx)
+{
+        pthread_mutex_destroy(&mtx->mutex);
+        free(mtx);
+}
+
+void enif_mutex_lock(ErlNifMutex *mtx)
+{
+        pthread_mutex_lock(&mtx->mutex);
+}
+
+void enif_mutex_unlock(ErlNifMutex *mtx)
+{
+        pthread_mutex_unlock(&mtx->mutex);
+}
+
+ErlNifCond *enif_cond_create(char *name)
+{
+        unused(name);
+        ErlNifCond *cnd = malloc(sizeof(*cnd));
+        ensure(cnd != NULL);
+        pthread_cond_init(&cnd->cond, NULL);
+        return cnd;
+}
+
+void enif_cond_destroy(ErlNifCond *cnd)
+{
+        pthread_cond_destroy(&cnd->cond);
+        free(cnd);
+}
+
+void enif_cond_signal(ErlNifCond *cnd)
+{
+        pthread_cond_signal(&cnd->cond);
+}
+
+void enif_cond_broadcast(ErlNifCond *cnd)
+{
+        pthread_cond_broadcast(&cnd->cond);
+}
+
+void enif_cond_wait(ErlNifCond *cnd, ErlNifMutex *mtx)
+{
+        pthread_cond_wait(&cnd->cond, &mtx->mutex);
+}
+
+ErlNifRWLock *enif_rwlock_create(char *name)
+{
+        unused(name);
+        ErlNifRWLock *rwlck = malloc(sizeof(*rwlck));
+        ensure(rwlck != NULL);
+        pthread_rwlock_init(&rwlck->rwlock, NULL);
+        return rwlck;
+}
+
+void enif_rwlock_destroy(ErlNifRWLock *rwlck)
+{
+        pthread_rwlock_destroy(&rwlck->rwlock);
+        free(rwlck);
+}
+
+void enif_rwlock_rlock(ErlNifRWLock *rwlck)
+{
+        pthread_rwlock_rdlock(&rwlck->rwlock);
+}
+
+void enif_rwlock_runlock(ErlNifRWLock *rwlck)
+{
+        pthread_rwlock_unlock(&rwlck->rwlock);
+}
+
+void enif_rwlock_rwlock(ErlNifRWLock *rwlck)
+{
+        pthread_rwlock_wrlock(&rwlck->rwlock);
+}
+
+void enif_rwlock_rwunlock(ErlNifRWLock *rwlck)
+{
+        pthread_rwlock_unlock(&rwlck->rwlock);
+}
+
+int enif_thread_create(char *name, ErlNifTid *tid, void *(*func)(void *), void *args,
+                       ErlNifThreadOpts *opts)
+{
+        unused(name); unused(opts);
+
+        *tid = malloc(sizeof(**tid));
+        ensure(*tid != NULL);
+        return pthread_create(&(*tid)->thread, NULL, func, args);
+}
+
+int enif_thread_join(ErlNifTid tid, void **respp)
+{
+        const int ret = pthread_join(tid->thread, respp);
+        free(tid);
+        return ret;
+}
@@ -0,0 +1,361 @@
+/**
+ * A stand-in for PortAudio with a single device whose streams never block.
+ * Reads copy from a buffer of synthetic audio and writes copy in to a sink,
+ * so the copies the host would do are still accounted for.
+ */
+// For clock_gettime and the POSIX thread and time functions
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <portaudio.h>
+
+#include "portaudio_nif/util.h"
+#include "stubs.h"
+
+/**
+ * Frames of synthetic audio each stream cycles through, and the size of
+ * the sink writes go to.
+ */
+#define STUB_STREAM_FRAMES 16384
+
+/**
+ * Frames every output stream reports as writable.
+ */
+#define STUB_WRITE_AVAILABLE 65536
+
+struct stub_stream {
+        PaStreamInfo info;
+        bool active;
+
+        long input_frame_size;
+        unsigned char *source;
+        long source_pos;
+
+        long output_frame_size;
+        unsigned char *sink;
+        long sink_pos;
+};
+
+static long _read_available = 512;
+
+static const PaHostApiInfo _host_api = {
+        .structVersion = 1,
+        .name = "Stub",
+        .type = paInDevelopment,
+        .deviceCount = 1,
+        .defaultInputDevice = 0,
+        .defaultOutputDevice = 0
+};
+
+static const PaDeviceInfo _device = {
+        .structVersion = 2,
+        .name = "Stub Device",
+        .hostApi = 0,
+        .maxInputChannels = 32,
+        .maxOutputChannels = 32,
+        .defaultLowInputLatency = 0.005,
+        .defaultLowOutputLatency = 0.005,
+        .defaultHighInputLatency = 0.02,
+        .defaultHighOutputLatency = 0.02,
+        .defaultSampleRate = 48000.0
+};
+
+void portaudio_stub_set_read_available(long frames)
+{
+        _read_available = frames;
+}
+
+int Pa_GetVersion(void)
+{
+        return 0;
+}
+
+const char *Pa_GetVersionText(void)
+{
+        return "PortAudio stub";
+}
+
+const char *Pa_GetErrorText(PaError errorCode)
+{
+        unused(errorCode);
+        return "Stub error";
+}
+
+PaError Pa_Initialize(void)
+{
+        return paNoError;
+}
+
+PaError Pa_Terminate(void)
+{
+        return paNoError;
+}
+
+PaHostApiIndex Pa_GetHostApiCount(void)
+{
+        return 1;
+}
+
+PaHostApiIndex Pa_GetDefaultHostApi(void)
+{
+        return 0;
+}
+
+const PaHostApiInfo *Pa_GetHostApiInfo(PaHostApiIndex hostApi)
+{
+        return hostApi == 0 ? &_host_api : NULL;
+}
+
+PaHostApiIndex Pa_HostApiTypeIdToHostApiIndex(PaHostApiTypeId type)
+{
+        return type == paInDevelopment ? 0 : paHostApiNotFound;
+}
+
+PaDeviceIndex Pa_HostApiDeviceIndexToDeviceIndex(PaHostApiIndex hostApi, int hostApiDeviceIndex)
+{
+        return hostApi == 0 && hostApiDeviceIndex == 0 ? 0 : paInvalidDevice;
+}
+
+PaDeviceIndex Pa_GetDeviceCount(void)
+{
+        return 1;
+}
+
+PaDeviceIndex Pa_GetDefaultInputDevice(void)
+{
+        return 0;
+}
+
+PaDeviceIndex Pa_GetDefaultOutputDevice(void)
+{
+        return 0;
+}
+
+const PaDeviceInfo *Pa_GetDeviceInfo(PaDeviceIndex device)
+{
+        return device == 0 ? &_device : NULL;
+}
+
+PaError Pa_GetSampleSize(PaSampleFormat format)
+{
+        switch (format) {
+        case paFloat32:
+        case paInt32:
+                return 4;
+        case paInt24:
+                return 3;
+        case paInt16:
+                return 2;
+        case paInt8:
+        case paUInt8:
+                return 1;
+        default:
+                return paSampleFormatNotSupported;
+        }
+}
+
+static PaError _check_params(const PaStreamParameters *params)
+{
+        if (params == NULL)
+                return paNoError;
+        if (params->device != 0)
+                return paInvalidDevice;
+        if (params->channelCount < 1 || params->channelCount > 32)
+                return paInvalidChannelCount;
+        if (Pa_GetSampleSize(params->sampleFormat) < 0)
+                return paSampleFormatNotSupported;
+        return paNoError;
+}
+
+PaError Pa_IsFormatSupported(const PaStreamParameters *inputParameters,
+                             const PaStreamParameters *outputParameters,
+                             double sampleRate)
+{
+        if (sampleRate <= 0)
+                return paInvalidSampleRate;
+
+        const PaError err = _check_params(inputParameters);
+        return err != paNoError ? err : _check_params(outputParameters);
+}
+
+PaError Pa_OpenStream(PaStream **stream,
+                      const PaStreamParameters *inputParameters,
+                      const PaStreamParameters *outputParameters,
+                      double sampleRate,
+                      unsigned long framesPerBuffer,
+                      PaStreamFlags streamFlags,
+                      PaStreamCallback *streamCallback,
+                      void *userData)
+{
+        unused(framesPerBuffer); unused(streamFlags); unused(userData);
+
+        if (streamCallback != NULL)
+                return paInternalError;
+
+        const PaError err = Pa_IsFormatSupported(inputParameters, outputParameters, sampleRate);
+        if (err != paFormatIsSupported)
+                return err;
+
+        struct stub_stream *s = calloc(1, sizeof(*s));
+        ensure(s != NULL);
+        s->info.structVersion = 1;
+        s->info.sampleRate = sampleRate;
+
+        if (inputParameters != NULL) {
+                s->info.inputLatency = inputParameters->suggestedLatency;
+                s->input_frame_size = Pa_GetSampleSize(inputParameters->sampleFormat)
+                        * inputParameters->channelCount;
+                s->source = malloc(STUB_STREAM_FRAMES * s->input_frame_size);
+                ensure(s->source != NULL);
+
+                long i;
+                unsigned int seed = 1;
+                for (i = 0; i < STUB_STREAM_FRAMES * s->input_frame_size; i++) {
+                        seed = seed * 1103515245 + 12345;
+                        s->source[i] = (unsigned char) (seed >> 16);
+                }
+        }
+
+        if (outputParameters != NULL) {
+                // Writing checks for a latency to tell output streams apart
+                s->info.outputLatency = outputParameters->suggestedLatency > 0
+                        ? outputParameters->suggestedLatency
+                        : _device.defaultLowOutputLatency;
+                s->output_frame_size = Pa_GetSampleSize(outputParameters->sampleFormat)
+                        * outputParameters->channelCount;
+                s->sink = malloc(STUB_STREAM_FRAMES * s->output_frame_size);
+                ensure(s->sink != NULL);
+        }
+
+        *stream = s;
+        return paNoError;
+}
+
+PaError Pa_CloseStream(PaStream *stream)
+{
+        struct stub_stream *s = stream;
+        free(s->source);
+        free(s->sink);
+        free(s);
+        return paNoError;
+}
+
+PaError Pa_StartStream(PaStream *stream)
+{
+        struct stub_stream *s = stream;
+        if (s->active)
+                return paStreamIsNotStopped;
+        s->active = true;
+        return paNoError;
+}
+
+PaError Pa_StopStream(PaStream *stream)
+{
+        struct stub_stream *s = stream;
+        if (!s->active)
+                return paStreamIsStopped;
+        s->active = false;
+        return paNoError;
+}
+
+PaError Pa_AbortStream(PaStream *stream)
+{
+        return Pa_StopStream(stream);
+}
+
+PaError Pa_IsStreamStopped(PaStream *stream)
+{
+        return !((struct stub_stream *) stream)->active;
+}
+
+PaError Pa_IsStreamActive(PaStream *stream)
+{
+        return ((struct stub_stream *) stream)->active;
+}
+
+const PaStreamInfo *Pa_GetStreamInfo(PaStream *stream)
+{
+        return &((struct stub_stream *) stream)->info;
+}
+
+PaTime Pa_GetStreamTime(PaStream *stream)
+{
+        unused(stream);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Copy `frames` frames between a stream buffer and `ring`, wrapping around
+ * at the end of the ring.
+ */
+static void _ring_copy(unsigned char *ring, long *pos, long frame_size,
+                       unsigned char *buffer, unsigned long frames, bool to_ring)
+{
+        while (frames > 0) {
+                long n = STUB_STREAM_FRAMES - *pos;
+                if ((unsigned long) n > frames)
+                        n = frames;
+
+                unsigned char *at = ring + *pos * frame_size;
+                if (to_ring)
+                        memcpy(at, buffer, n * frame_size);
+                else
+                        memcpy(buffer, at, n * frame_size);
+
+                buffer += n * frame_size;
+                frames -= n;
+                *pos = (*pos + n) % STUB_STREAM_FRAMES;
+        }
+}
+
+PaError Pa_ReadStream(PaStream *stream, void *buffer, unsigned long frames)
+{
+        struct stub_stream *s = stream;
+        if (s->source == NULL)
+                return paCanNotReadFromAnOutputOnlyStream;
+        if (!s->active)
+                return paStreamIsStopped;
+
+        _ring_copy(s->source, &s->source_pos, s->input_frame_size, buffer, frames, false);
+        return paNoError;
+}
+
+PaError Pa_WriteStream(PaStream *stream, const void *buffer, unsigned long frames)
+{
+        struct stub_stream *s = stream;
+        if (s->sink == NULL)
+                return paCanNotWriteToAnInputOnlyStream;
+        if (!s->active)
+                return paStreamIsStopped;
+
+        _ring_copy(s->sink, &s->sink_pos, s->output_frame_size, (unsigned char *) buffer,
+                   frames, true);
+        return paNoError;
+}
+
+signed long Pa_GetStreamReadAvailable(PaStream *stream)
+{
+        struct stub_stream *s = stream;
+        return s->source != NULL ? _read_available : paCanNotReadFromAnOutputOnlyStream;
+}
+
+signed long Pa_GetStreamWriteAvailable(PaStream *stream)
+{
+        struct stub_stream *s = stream;
+        return s->sink != NULL ? STUB_WRITE_AVAILABLE : paCanNotWriteToAnInputOnlyStream;
+}
+
+void Pa_Sleep(long msec)
+{
+        const struct timespec ts = {
+                .tv_sec = msec / 1000,
+                .tv_nsec = (msec % 1000) * 1000000
+        };
+        nanosleep(&ts, NULL);
+}
@@ -0,0 +1,16 @@
+#ifndef _PORTAUDIO_BENCH_STUBS_
+#define _PORTAUDIO_BENCH_STUBS_
+
+#include <stdatomic.h>
+
+/**
+ * Messages passed to `enif_send`, which the stub runtime drops.
+ */
+extern atomic_ulong erl_nif_stub_messages_sent;
+
+/**
+ * Set the number of frames stub input streams report as available to read.
+ */
+void portaudio_stub_set_read_available(long frames);
+
+#endif // _PORTAUDIO_BENCH_STUBS_
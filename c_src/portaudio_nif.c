@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -9,6 +10,19 @@
 #include "portaudio_nif/util.h"
 #include "portaudio_nif/erl_interop.h"
 #include "portaudio_nif/pa_conversions.h"
+#include "portaudio_nif/coalescer.h"
+#include "portaudio_nif/capabilities.h"
+#include "portaudio_nif/routing.h"
+#include "portaudio_nif/spectrum.h"
+#include "portaudio_nif/stream.h"
+#include "portaudio_nif/capture.h"
+#include "portaudio_nif/playback.h"
+#include "portaudio_nif/jitter_buffer.h"
+#include "portaudio_nif/output_queue.h"
+#include "portaudio_nif/generator.h"
+#include "portaudio_nif/schedule.h"
+#include "portaudio_nif/bridge.h"
+#include "portaudio_nif/realtime.h"
 
 static ERL_NIF_TERM portaudio_version_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
@@ -20,6 +34,14 @@ static ERL_NIF_TERM portaudio_version_nif(ErlNifEnv *env, int argc, const ERL_NI
                                 erli_str_to_binary(env, version_str));
 }
 
+static ERL_NIF_TERM portaudio_realtime_status_nif(ErlNifEnv *env, int argc,
+                                                  const ERL_NIF_TERM argv[])
+{
+        unused(argc); unused(argv);
+
+        return realtime_status_to_term(env);
+}
+
 ////////////////////////////////////////////////////////////
 // Native host API's
 ////////////////////////////////////////////////////////////
@@ -189,22 +211,26 @@ static ERL_NIF_TERM portaudio_device_info_nif(ErlNifEnv *env, int argc, const ER
 #undef N_FIELDS
 }
 
+static ERL_NIF_TERM portaudio_device_capabilities_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        int idx;
+        if (argc != 1 || !enif_get_int(env, argv[0], &idx)) {
+                return enif_make_badarg(env);
+        }
+
+        struct device_capabilities caps;
+        if (!capabilities_get(idx, &caps))
+                return erli_make_error_tuple(env, "not_found");
+
+        return erli_make_ok_tuple(env, capabilities_to_term(env, &caps));
+}
+
 ////////////////////////////////////////////////////////////
 // Streams
 ////////////////////////////////////////////////////////////
 
 static ErlNifResourceType *PORTAUDIO_STREAM_RESOURCE = NULL;
 
-struct erl_stream_resource {
-        PaStream *stream;
-
-        short input_sample_size;
-        short input_frame_size;
-
-        short output_sample_size;
-        short output_frame_size;
-};
-
 static struct erl_stream_resource *erl_stream_resource_alloc(void)
 {
         struct erl_stream_resource *handle;
@@ -212,6 +238,17 @@ static struct erl_stream_resource *erl_stream_resource_alloc(void)
                                      sizeof(*handle));
         ensure(handle != NULL);
         handle->stream = NULL;
+        handle->delivery = NULL;
+        handle->routing = NULL;
+        handle->spectrum = NULL;
+        handle->capture = NULL;
+        handle->playback = NULL;
+        handle->bridge = NULL;
+        atomic_init(&handle->frames_written, 0);
+        handle->lock = enif_rwlock_create("portaudio_stream_lock");
+        ensure(handle->lock != NULL);
+        handle->read_lock = enif_mutex_create("portaudio_stream_read_lock");
+        ensure(handle->read_lock != NULL);
         return handle;
 }
 
@@ -222,18 +259,63 @@ static void erl_stream_resource_release(ErlNifEnv *env, void *data)
         struct erl_stream_resource *res = (struct erl_stream_resource *) data;
         assert(res != NULL);
 
-        if(res->stream && Pa_IsStreamActive(res->stream))
-                Pa_StopStream(res->stream);
+        // The playback thread doesn't keep the stream alive, so may still be
+        // running here with sources attached, and a capture thread whose
+        // last subscriber went down may not have been joined yet
+        playback_stop(res);
+        capture_stop(res);
+
+        // Closing an active stream aborts it, discarding pending buffers
+        if (res->stream)
+                Pa_CloseStream(res->stream);
+        res->stream = NULL;
+
+        if (res->delivery) {
+                coalescer_destroy(res->delivery);
+                enif_free(res->delivery);
+        }
+
+        if (res->routing)
+                routing_destroy(res->routing);
+
+        if (res->spectrum)
+                spectrum_destroy(res->spectrum);
+
+        if (res->capture)
+                capture_destroy(res->capture);
+
+        if (res->playback)
+                playback_destroy(res->playback);
+
+        enif_rwlock_destroy(res->lock);
+        enif_mutex_destroy(res->read_lock);
+}
+
+static void erl_stream_resource_down(ErlNifEnv *env, void *data, ErlNifPid *pid,
+                                     ErlNifMonitor *monitor)
+{
+        unused(monitor);
+
+        struct erl_stream_resource *res = (struct erl_stream_resource *) data;
+        assert(res != NULL);
+
+        // Only subscribers are monitored
+        capture_down(env, res, pid);
 }
 
 static bool erl_stream_resource_register(ErlNifEnv *env)
 {
         const ErlNifResourceFlags rt_flags =
                 ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER;
-        ErlNifResourceType *rt = enif_open_resource_type(env, NULL,
-                                                         "PORTAUDIO_STREAM_RESOURCE",
-                                                         &erl_stream_resource_release,
-                                                         rt_flags, NULL);
+        const ErlNifResourceTypeInit rt_init = {
+                .dtor = &erl_stream_resource_release,
+                .stop = NULL,
+                .down = &erl_stream_resource_down
+        };
+        ErlNifResourceType *rt = enif_open_resource_type_x(env,
+                                                           "PORTAUDIO_STREAM_RESOURCE",
+                                                           &rt_init,
+                                                           rt_flags, NULL);
         if (rt == NULL)
                 return false;
         PORTAUDIO_STREAM_RESOURCE = rt;
@@ -250,6 +332,31 @@ static bool erl_stream_resource_get(ErlNifEnv *env,
         return ret == 1;
 }
 
+typedef ERL_NIF_TERM (*erl_stream_fn)(ErlNifEnv *env,
+                                      struct erl_stream_resource *res,
+                                      const ERL_NIF_TERM argv[]);
+
+/**
+ * Call `fn` while holding a read lock on the stream, returning
+ * `{:error, :stream_closed}` instead if the stream has been closed.
+ */
+static ERL_NIF_TERM erl_stream_resource_run(ErlNifEnv *env,
+                                            struct erl_stream_resource *res,
+                                            erl_stream_fn fn,
+                                            const ERL_NIF_TERM argv[])
+{
+        ERL_NIF_TERM ret;
+
+        enif_rwlock_rlock(res->lock);
+        if (res->stream == NULL)
+                ret = erli_make_error_tuple(env, "stream_closed");
+        else
+                ret = fn(env, res, argv);
+        enif_rwlock_runlock(res->lock);
+
+        return ret;
+}
+
 static ERL_NIF_TERM portaudio_stream_format_supported_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         PaStreamParameters *input = NULL;
@@ -265,25 +372,31 @@ static ERL_NIF_TERM portaudio_stream_format_supported_nif(ErlNifEnv *env, int ar
                 return enif_make_badarg(env);
         }
 
+        const PaError err = Pa_IsFormatSupported(input, output, sample_rate);
+
         enif_safe_free(input);
         enif_safe_free(output);
 
-        const PaError err = Pa_IsFormatSupported(input, output, sample_rate);
         return erli_make_bool(env, err == paFormatIsSupported);
 }
 
 static ERL_NIF_TERM portaudio_stream_open_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
-        PaStreamParameters *input_params;
-        PaStreamParameters *output_params;
+        PaStreamParameters *input_params = NULL;
+        PaStreamParameters *output_params = NULL;
         double sample_rate;
         PaStreamFlags stream_flags;
+        unsigned long frames_per_buffer = paFramesPerBufferUnspecified;
 
-        if (argc != 4
+        if (argc != 5
             || !pa_stream_params_from_tuple(env, argv[0], &input_params)
             || !pa_stream_params_from_tuple(env, argv[1], &output_params)
             || !enif_get_double(env, argv[2], &sample_rate)
-            || !pa_stream_flags_from_list(env, argv[3], &stream_flags)) {
+            || !pa_stream_flags_from_list(env, argv[3], &stream_flags)
+            || !(erli_is_nil(env, argv[4])
+                 || enif_get_ulong(env, argv[4], &frames_per_buffer))) {
+                enif_safe_free(input_params);
+                enif_safe_free(output_params);
                 return enif_make_badarg(env);
         }
 
@@ -292,35 +405,52 @@ static ERL_NIF_TERM portaudio_stream_open_nif(ErlNifEnv *env, int argc, const ER
                                           input_params,
                                           output_params,
                                           sample_rate,
-                                          paFramesPerBufferUnspecified,
+                                          frames_per_buffer,
                                           stream_flags,
                                           NULL, NULL);
 
         ERL_NIF_TERM ret;
 
         if (pa_is_error(err)) {
+                // Never let the destructor close a stream that failed to open
+                res->stream = NULL;
                 ret = pa_error_to_error_tuple(env, err);
                 goto cleanup;
         }
 
         if (input_params != NULL) {
+                res->input_format = input_params->sampleFormat;
+                res->input_channels = input_params->channelCount;
                 res->input_sample_size = Pa_GetSampleSize(input_params->sampleFormat);
                 res->input_frame_size =
                         res->input_sample_size * input_params->channelCount;
+                res->capture = capture_create(res);
         } else {
+                res->input_format = 0;
+                res->input_channels = 0;
                 res->input_sample_size = 0;
                 res->input_frame_size = 0;
         }
 
         if (output_params != NULL) {
+                res->output_format = output_params->sampleFormat;
+                res->output_channels = output_params->channelCount;
                 res->output_sample_size = Pa_GetSampleSize(output_params->sampleFormat);
                 res->output_frame_size =
                         res->output_sample_size * output_params->channelCount;
         } else {
+                res->output_format = 0;
+                res->output_channels = 0;
                 res->output_sample_size = 0;
-                res->input_frame_size = 0;
+                res->output_frame_size = 0;
         }
 
+        res->sample_rate = sample_rate;
+        res->frames_per_buffer = frames_per_buffer;
+
+        if (output_params != NULL)
+                res->playback = playback_create(res);
+
         /* enif_release_resource(res); */
         ret = enif_make_tuple2(env,
                                enif_make_atom(env, "ok"),
@@ -328,9 +458,20 @@ static ERL_NIF_TERM portaudio_stream_open_nif(ErlNifEnv *env, int argc, const ER
 
  cleanup:
         enif_release_resource(res);
+        enif_safe_free(input_params);
+        enif_safe_free(output_params);
         return ret;
 }
 
+static ERL_NIF_TERM _stream_start(ErlNifEnv *env, struct erl_stream_resource *res,
+                                  const ERL_NIF_TERM argv[])
+{
+        unused(argv);
+
+        handle_pa_error(env, Pa_StartStream(res->stream));
+        return enif_make_atom(env, "ok");
+}
+
 static ERL_NIF_TERM portaudio_stream_start_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         struct erl_stream_resource *res;
@@ -338,7 +479,15 @@ static ERL_NIF_TERM portaudio_stream_start_nif(ErlNifEnv *env, int argc, const E
         if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
-        handle_pa_error(env, Pa_StartStream(res->stream));
+        return erl_stream_resource_run(env, res, &_stream_start, argv);
+}
+
+static ERL_NIF_TERM _stream_stop(ErlNifEnv *env, struct erl_stream_resource *res,
+                                 const ERL_NIF_TERM argv[])
+{
+        unused(argv);
+
+        handle_pa_error(env, Pa_StopStream(res->stream));
         return enif_make_atom(env, "ok");
 }
 
@@ -349,8 +498,15 @@ static ERL_NIF_TERM portaudio_stream_stop_nif(ErlNifEnv *env, int argc, const ER
         if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
+        return erl_stream_resource_run(env, res, &_stream_stop, argv);
+}
+
+static ERL_NIF_TERM _stream_abort(ErlNifEnv *env, struct erl_stream_resource *res,
+                                  const ERL_NIF_TERM argv[])
+{
+        unused(argv);
 
-        handle_pa_error(env, Pa_StopStream(res->stream));
+        handle_pa_error(env, Pa_AbortStream(res->stream));
         return enif_make_atom(env, "ok");
 }
 
@@ -361,50 +517,124 @@ static ERL_NIF_TERM portaudio_stream_abort_nif(ErlNifEnv *env, int argc, const E
         if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
-
-        handle_pa_error(env, Pa_AbortStream(res->stream));
-        return enif_make_atom(env, "ok");
+        return erl_stream_resource_run(env, res, &_stream_abort, argv);
 }
 
-static ERL_NIF_TERM portaudio_stream_is_active_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+static ERL_NIF_TERM portaudio_stream_close_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         struct erl_stream_resource *res;
 
-        if(argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
+        // Subscribers and sources are kept, but nothing more is read or
+        // played
+        capture_stop(res);
+        playback_stop(res);
+
+        // Waits for any in-flight reads or writes to finish
+        enif_rwlock_rwlock(res->lock);
+        PaStream *stream = res->stream;
+        res->stream = NULL;
+        enif_rwlock_rwunlock(res->lock);
+
+        if (stream == NULL)
+                return erli_make_error_tuple(env, "stream_closed");
+
+        handle_pa_error(env, Pa_CloseStream(stream));
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM _stream_is_active(ErlNifEnv *env, struct erl_stream_resource *res,
+                                      const ERL_NIF_TERM argv[])
+{
+        unused(argv);
+
         const PaError status = Pa_IsStreamActive(res->stream);
         if (status < 0)
                 return enif_raise_exception(env, enif_make_atom(env, "bad_status"));
         return erli_make_bool(env, status == 1);
 }
 
-static ERL_NIF_TERM portaudio_stream_is_stopped_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+static ERL_NIF_TERM portaudio_stream_is_active_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         struct erl_stream_resource *res;
 
         if(argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
+        return erl_stream_resource_run(env, res, &_stream_is_active, argv);
+}
+
+static ERL_NIF_TERM _stream_is_stopped(ErlNifEnv *env, struct erl_stream_resource *res,
+                                       const ERL_NIF_TERM argv[])
+{
+        unused(argv);
+
         const PaError status = Pa_IsStreamStopped(res->stream);
         if (pa_is_error(status))
                 return enif_raise_exception(env, enif_make_atom(env, "bad_status"));
         return erli_make_bool(env, status == 1);
 }
 
-static ERL_NIF_TERM portaudio_stream_read_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+static ERL_NIF_TERM portaudio_stream_is_stopped_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         struct erl_stream_resource *res;
 
-        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+        if(argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
                 return enif_make_badarg(env);
 
-        // Ensure we're not reading from an output-only stream
-        const PaStreamInfo *stream_info = Pa_GetStreamInfo(res->stream);
-        assert(stream_info != NULL);
-        if (stream_info->inputLatency == 0)
-                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+        return erl_stream_resource_run(env, res, &_stream_is_stopped, argv);
+}
+
+/**
+ * Build the result of a read from the frames in `bin`, routing them to
+ * their outputs if the stream has a routing matrix.
+ */
+static ERL_NIF_TERM _stream_read_result(ErlNifEnv *env, struct erl_stream_resource *res,
+                                        ErlNifBinary *bin)
+{
+        if (res->routing == NULL)
+                return erli_make_ok_tuple(env, enif_make_binary(env, bin));
+
+        const long frames = bin->size / res->input_frame_size;
+        const ERL_NIF_TERM routed = routing_apply_to_map(env, res->routing, bin->data, frames);
+        enif_release_binary(bin);
+        return erli_make_ok_tuple(env, routed);
+}
+
+/**
+ * Read up to a chunk of the available frames in to the stream's delivery
+ * coalescer, returning the chunk once it is ready.
+ */
+static ERL_NIF_TERM _stream_read_coalesced(ErlNifEnv *env, struct erl_stream_resource *res,
+                                           long frames_available)
+{
+        struct coalescer *c = res->delivery;
+
+        long frames = coalescer_space(c);
+        if (frames > frames_available)
+                frames = frames_available;
+
+        if (frames > 0) {
+                handle_pa_error(env, Pa_ReadStream(res->stream, coalescer_tail(c), frames));
+                coalescer_commit(c, frames, enif_monotonic_time(ERL_NIF_USEC));
+        }
+
+        if (!coalescer_ready(c, enif_monotonic_time(ERL_NIF_USEC)))
+                return erli_make_error_tuple(env, "stream_empty");
+
+        ErlNifBinary chunk;
+        coalescer_take(c, &chunk);
+        return _stream_read_result(env, res, &chunk);
+}
 
+/**
+ * Read the frames that are already available on the stream, holding its
+ * read lock.
+ */
+static ERL_NIF_TERM _stream_read_available(ErlNifEnv *env, struct erl_stream_resource *res)
+{
         // For some reason PA doesn't return an error message when the stream
         // is not initialized and we try and read from it.
         if (!Pa_IsStreamActive(res->stream))
@@ -412,6 +642,10 @@ static ERL_NIF_TERM portaudio_stream_read_nif(ErlNifEnv *env, int argc, const ER
 
         const long frames_available = Pa_GetStreamReadAvailable(res->stream);
         handle_pa_error(env, frames_available);
+
+        if (res->delivery != NULL)
+                return _stream_read_coalesced(env, res, frames_available);
+
         if (frames_available == 0)
                 return erli_make_error_tuple(env, "stream_empty");
 
@@ -422,19 +656,770 @@ static ERL_NIF_TERM portaudio_stream_read_nif(ErlNifEnv *env, int argc, const ER
         ensure(enif_alloc_binary(bytes_available, &input_bin));
 
         const PaError err = Pa_ReadStream(res->stream, input_bin.data, frames_available);
-        handle_pa_error(env, err);
-        return enif_make_tuple2(env,
-                                enif_make_atom(env, "ok"),
-                                enif_make_binary(env, &input_bin));
+        if (pa_is_error(err)) {
+                enif_release_binary(&input_bin);
+                return pa_error_to_error_tuple(env, err);
+        }
+
+        return _stream_read_result(env, res, &input_bin);
 }
 
-static ERL_NIF_TERM portaudio_stream_write_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+/**
+ * Read the frames that are already available on the stream. Never blocks,
+ * so can safely run on a normal scheduler.
+ */
+static ERL_NIF_TERM _stream_read(ErlNifEnv *env, struct erl_stream_resource *res,
+                                 const ERL_NIF_TERM argv[])
+{
+        unused(argv);
+
+        // Ensure we're not reading from an output-only stream
+        const PaStreamInfo *stream_info = Pa_GetStreamInfo(res->stream);
+        assert(stream_info != NULL);
+        if (stream_info->inputLatency == 0)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        // A bridge owns all reads while attached, as does the capture thread
+        // while it has subscribers
+        if (res->bridge != NULL)
+                return erli_make_error_tuple(env, "stream_bridged");
+        if (capture_is_running(res))
+                return erli_make_error_tuple(env, "stream_subscribed");
+
+        // Only holding the stream lock for reading, so concurrent reads
+        // must still wait for each other
+        enif_mutex_lock(res->read_lock);
+        const ERL_NIF_TERM ret = _stream_read_available(env, res);
+        enif_mutex_unlock(res->read_lock);
+
+        return ret;
+}
+
+static ERL_NIF_TERM portaudio_stream_read_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
 {
         struct erl_stream_resource *res;
-        ErlNifBinary input_bin;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        return erl_stream_resource_run(env, res, &_stream_read, argv);
+}
+
+static ERL_NIF_TERM portaudio_stream_set_delivery_nif(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        double chunk_duration = 0;
+        double max_latency;
+
+        if (argc != 3
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !(erli_is_nil(env, argv[1])
+                 || enif_get_double(env, argv[1], &chunk_duration))
+            || !enif_get_double(env, argv[2], &max_latency)
+            || chunk_duration < 0 || max_latency < 0) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->input_frame_size == 0)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        struct coalescer *delivery = NULL;
+        if (chunk_duration > 0) {
+                delivery = enif_alloc(sizeof(*delivery));
+                ensure(delivery != NULL);
+                coalescer_init(delivery, res->input_frame_size, res->sample_rate,
+                               chunk_duration, max_latency);
+        }
+
+        // Frames still buffered by the old policy are dropped
+        enif_rwlock_rwlock(res->lock);
+        struct coalescer *old = res->delivery;
+        res->delivery = delivery;
+        enif_rwlock_rwunlock(res->lock);
+
+        if (old != NULL) {
+                coalescer_destroy(old);
+                enif_free(old);
+        }
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_set_routing_nif(ErlNifEnv *env, int argc,
+                                                     const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        if (res->input_frame_size == 0)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        struct routing *routing = NULL;
+        if (!erli_is_nil(env, argv[1])) {
+                routing = routing_from_term(env, argv[1], res->input_format, res->input_channels);
+                if (routing == NULL)
+                        return enif_make_badarg(env);
+        }
+
+        enif_rwlock_rwlock(res->lock);
+        struct routing *old = res->routing;
+        res->routing = routing;
+        enif_rwlock_rwunlock(res->lock);
+
+        if (old != NULL)
+                routing_destroy(old);
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_set_spectrum_nif(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        if (res->input_frame_size == 0)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        struct spectrum *spectrum = NULL;
+        if (!erli_is_nil(env, argv[1])) {
+                spectrum = spectrum_from_term(env, argv[1], res->input_format,
+                                              res->input_channels, res->sample_rate);
+                if (spectrum == NULL)
+                        return enif_make_badarg(env);
+        }
+
+        enif_rwlock_rwlock(res->lock);
+        struct spectrum *old = res->spectrum;
+        res->spectrum = spectrum;
+        enif_rwlock_rwunlock(res->lock);
+
+        if (old != NULL)
+                spectrum_destroy(old);
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_spectrum_info_nif(ErlNifEnv *env, int argc,
+                                                       const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        enif_rwlock_rlock(res->lock);
+        const ERL_NIF_TERM info = res->spectrum != NULL
+                ? erli_make_ok_tuple(env, spectrum_info_to_term(env, res->spectrum))
+                : erli_make_error_tuple(env, "no_spectrum");
+        enif_rwlock_runlock(res->lock);
+
+        return info;
+}
+
+/**
+ * Returns `NULL` if the stream is open and not bridged, otherwise the error
+ * to return. Checked under a brief read lock by calls which mustn't hold it
+ * while starting or stopping the capture or playback thread.
+ */
+static const char *_stream_unavailable(struct erl_stream_resource *res)
+{
+        const char *reason = NULL;
+
+        enif_rwlock_rlock(res->lock);
+        if (res->stream == NULL)
+                reason = "stream_closed";
+        else if (res->bridge != NULL)
+                reason = "stream_bridged";
+        enif_rwlock_runlock(res->lock);
+
+        return reason;
+}
+
+static ERL_NIF_TERM _stream_subscribe(ErlNifEnv *env, struct erl_stream_resource *res,
+                                      const ErlNifPid *pid, ERL_NIF_TERM route, bool spectrum,
+                                      unsigned int max_queue)
+{
+        if (res->capture == NULL)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        const char *reason = _stream_unavailable(res);
+        if (reason != NULL)
+                return erli_make_error_tuple(env, reason);
+
+        if (!spectrum && !erli_is_nil(env, route)) {
+                enif_rwlock_rlock(res->lock);
+                const bool known = res->routing != NULL && routing_find(res->routing, route) >= 0;
+                enif_rwlock_runlock(res->lock);
+
+                if (!known)
+                        return erli_make_error_tuple(env, "unknown_route");
+        }
+
+        if (!capture_subscribe(env, res, pid, route, spectrum, max_queue))
+                return erli_make_error_tuple(env, "noproc");
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_subscribe_nif(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ErlNifPid pid;
+        unsigned int max_queue;
+
+        if (argc != 4
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !enif_get_local_pid(env, argv[1], &pid)
+            || !enif_is_atom(env, argv[2])
+            || !enif_get_uint(env, argv[3], &max_queue)) {
+                return enif_make_badarg(env);
+        }
+
+        return _stream_subscribe(env, res, &pid, argv[2], false, max_queue);
+}
+
+static ERL_NIF_TERM portaudio_stream_subscribe_spectrum_nif(ErlNifEnv *env, int argc,
+                                                            const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ErlNifPid pid;
+        unsigned int max_queue;
+
+        if (argc != 3
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !enif_get_local_pid(env, argv[1], &pid)
+            || !enif_get_uint(env, argv[2], &max_queue)) {
+                return enif_make_badarg(env);
+        }
+
+        return _stream_subscribe(env, res, &pid, erli_make_nil(env), true, max_queue);
+}
+
+static ERL_NIF_TERM portaudio_stream_unsubscribe_nif(ErlNifEnv *env, int argc,
+                                                     const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ErlNifPid pid;
+
         if (argc != 2
             || !erl_stream_resource_get(env, argv[0], &res)
-            || !enif_inspect_iolist_as_binary(env, argv[1], &input_bin)) {
+            || !enif_get_local_pid(env, argv[1], &pid)) {
+                return enif_make_badarg(env);
+        }
+
+        if (!capture_unsubscribe(env, res, &pid))
+                return erli_make_error_tuple(env, "not_subscribed");
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_ack_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ErlNifPid pid;
+        unsigned int n;
+
+        if (argc != 2
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !enif_get_uint(env, argv[1], &n)) {
+                return enif_make_badarg(env);
+        }
+
+        if (!capture_ack(res, enif_self(env, &pid), n))
+                return erli_make_error_tuple(env, "not_subscribed");
+
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_subscribers_nif(ErlNifEnv *env, int argc,
+                                                     const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        return capture_subscribers_to_term(env, res);
+}
+
+static ERL_NIF_TERM portaudio_stream_capture_stats_nif(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        if (res->capture == NULL)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+
+        return erli_make_ok_tuple(env, capture_stats_to_term(env, res));
+}
+
+static ERL_NIF_TERM portaudio_stream_set_jitter_buffer_nif(ErlNifEnv *env, int argc,
+                                                          const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        int arity;
+        const ERL_NIF_TERM *opts;
+        double min_depth;
+        double max_depth;
+        enum jitter_concealment concealment;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        const bool remove = erli_is_nil(env, argv[1]);
+        if (!remove
+            && (!enif_get_tuple(env, argv[1], &arity, &opts)
+                || arity != 3
+                || !enif_get_double(env, opts[0], &min_depth)
+                || !enif_get_double(env, opts[1], &max_depth)
+                || !jitter_concealment_from_atom(env, opts[2], &concealment)
+                || min_depth < 0 || max_depth < min_depth)) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        const char *reason = _stream_unavailable(res);
+        if (reason != NULL)
+                return erli_make_error_tuple(env, reason);
+
+        struct jitter_buffer *jitter = NULL;
+        if (!remove) {
+                jitter = enif_alloc(sizeof(*jitter));
+                ensure(jitter != NULL);
+                jitter_buffer_init(jitter, res->output_channels, res->sample_rate,
+                                   min_depth, max_depth, concealment);
+        }
+
+        playback_set_jitter_buffer(res, jitter);
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_set_underrun_policy_nif(ErlNifEnv *env, int argc,
+                                                            const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        int arity;
+        const ERL_NIF_TERM *opts;
+        enum underrun_policy policy;
+        double max_queue;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        const bool remove = erli_is_nil(env, argv[1]);
+        if (!remove
+            && (!enif_get_tuple(env, argv[1], &arity, &opts)
+                || arity != 2
+                || !underrun_policy_from_atom(env, opts[0], &policy)
+                || !enif_get_double(env, opts[1], &max_queue)
+                || max_queue <= 0
+                || max_queue > PLAYBACK_MAX_QUEUE)) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        const char *reason = _stream_unavailable(res);
+        if (reason != NULL)
+                return erli_make_error_tuple(env, reason);
+
+        struct output_queue *queue = NULL;
+        if (!remove) {
+                long capacity = (long) (max_queue * res->sample_rate);
+                if (capacity < 1)
+                        capacity = 1;
+
+                queue = enif_alloc(sizeof(*queue));
+                ensure(queue != NULL);
+                output_queue_init(queue, res->output_channels, capacity, policy);
+        }
+
+        playback_set_queue(res, queue);
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_set_generator_nif(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+
+        struct generator *generator = NULL;
+        if (!erli_is_nil(env, argv[1])) {
+                generator = generator_from_term(env, argv[1], res->output_channels,
+                                                res->sample_rate);
+                if (generator == NULL)
+                        return enif_make_badarg(env);
+        }
+
+        const char *reason = _stream_unavailable(res);
+        if (reason != NULL) {
+                if (generator != NULL)
+                        generator_destroy(generator);
+                return erli_make_error_tuple(env, reason);
+        }
+
+        playback_set_generator(res, generator);
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_stream_queue_stats_nif(ErlNifEnv *env, int argc,
+                                                    const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        const ERL_NIF_TERM stats = playback_queue_stats_to_term(env, res);
+        if (erli_is_nil(env, stats))
+                return erli_make_error_tuple(env, "no_write_queue");
+
+        return erli_make_ok_tuple(env, stats);
+}
+
+static ERL_NIF_TERM portaudio_stream_jitter_push_nif(ErlNifEnv *env, int argc,
+                                                    const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        unsigned int seq;
+        unsigned int timestamp;
+        ErlNifBinary packet;
+
+        if (argc != 4
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !enif_get_uint(env, argv[1], &seq)
+            || !enif_get_uint(env, argv[2], &timestamp)
+            || !enif_inspect_iolist_as_binary(env, argv[3], &packet)) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        if (packet.size == 0 || packet.size % res->output_frame_size != 0)
+                return enif_make_badarg(env);
+
+        switch (playback_jitter_push(res, seq, timestamp, &packet)) {
+        case -1:
+                return erli_make_error_tuple(env, "no_jitter_buffer");
+        case 0:
+                return erli_make_error_tuple(env, "discarded");
+        default:
+                return enif_make_atom(env, "ok");
+        }
+}
+
+static ERL_NIF_TERM portaudio_stream_jitter_stats_nif(ErlNifEnv *env, int argc,
+                                                     const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        const ERL_NIF_TERM stats = playback_jitter_stats_to_term(env, res);
+        if (erli_is_nil(env, stats))
+                return erli_make_error_tuple(env, "no_jitter_buffer");
+
+        return erli_make_ok_tuple(env, stats);
+}
+
+static ERL_NIF_TERM portaudio_stream_set_schedule_nif(ErlNifEnv *env, int argc,
+                                                     const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        double max_queue;
+
+        if (argc != 2 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        // Bounded before converting, so the frame count can't overflow, and
+        // must come to at least a frame
+        const bool remove = erli_is_nil(env, argv[1]);
+        if (!remove
+            && (!enif_get_double(env, argv[1], &max_queue)
+                || max_queue > PLAYBACK_MAX_QUEUE
+                || max_queue * res->sample_rate < 1.0)) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        const char *reason = _stream_unavailable(res);
+        if (reason != NULL)
+                return erli_make_error_tuple(env, reason);
+
+        struct schedule *schedule = NULL;
+        if (!remove) {
+                schedule = enif_alloc(sizeof(*schedule));
+                ensure(schedule != NULL);
+                schedule_init(schedule, res->output_channels, res->sample_rate,
+                              (long) (max_queue * res->sample_rate));
+        }
+
+        playback_set_schedule(res, schedule);
+        return enif_make_atom(env, "ok");
+}
+
+/**
+ * Parse when to start a scheduled clip, one of `next`, `{frame, index}` or
+ * `{time, stream_time}`. Sets `time` to `NULL` unless given a stream time.
+ */
+static bool _get_schedule_target(ErlNifEnv *env, ERL_NIF_TERM term, long *start,
+                                  double **time, double *time_value)
+{
+        int arity;
+        const ERL_NIF_TERM *target;
+
+        *time = NULL;
+        if (enif_compare(term, enif_make_atom(env, "next")) == 0) {
+                *start = SCHEDULE_NEXT;
+                return true;
+        }
+
+        if (!enif_get_tuple(env, term, &arity, &target) || arity != 2)
+                return false;
+
+        if (enif_compare(target[0], enif_make_atom(env, "frame")) == 0)
+                return enif_get_long(env, target[1], start) && *start >= 0;
+
+        if (enif_compare(target[0], enif_make_atom(env, "time")) == 0
+            && enif_get_double(env, target[1], time_value)) {
+                *time = time_value;
+                return true;
+        }
+
+        return false;
+}
+
+static ERL_NIF_TERM portaudio_stream_schedule_nif(ErlNifEnv *env, int argc,
+                                                 const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ErlNifBinary clip;
+        long start;
+        double *time;
+        double time_value;
+        double crossfade;
+
+        if (argc != 4
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !enif_inspect_iolist_as_binary(env, argv[1], &clip)
+            || !_get_schedule_target(env, argv[2], &start, &time, &time_value)
+            || !enif_get_double(env, argv[3], &crossfade)
+            || !(crossfade >= 0 && crossfade <= PLAYBACK_MAX_QUEUE)) {
+                return enif_make_badarg(env);
+        }
+
+        if (res->playback == NULL)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        if (clip.size == 0 || clip.size % res->output_frame_size != 0)
+                return enif_make_badarg(env);
+        // Bounded before converting to a frame, leaving room for the
+        // schedule's anchor to be added
+        if (time != NULL && !(fabs(*time) < LONG_MAX / 2 / res->sample_rate))
+                return enif_make_badarg(env);
+
+        long started;
+        switch (playback_schedule(res, &clip, start, time,
+                                  (long) (crossfade * res->sample_rate), &started)) {
+        case -1:
+                return erli_make_error_tuple(env, "no_schedule");
+        case -2:
+                return erli_make_error_tuple(env, "stream_time_unknown");
+        case -3:
+                return enif_make_badarg(env);
+        case SCHEDULE_TOO_LATE:
+                return erli_make_error_tuple(env, "too_late");
+        case SCHEDULE_FULL:
+                return erli_make_error_tuple(env, "schedule_full");
+        default:
+                return erli_make_ok_tuple(env, enif_make_long(env, started));
+        }
+}
+
+static ERL_NIF_TERM portaudio_stream_schedule_info_nif(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        const ERL_NIF_TERM info = playback_schedule_info_to_term(env, res);
+        if (erli_is_nil(env, info))
+                return erli_make_error_tuple(env, "no_schedule");
+
+        return erli_make_ok_tuple(env, info);
+}
+
+/**
+ * Frames moved at a time by a bridge when neither it nor the input stream
+ * specify a buffer size.
+ */
+#define BRIDGE_DEFAULT_FRAMES 256
+
+static ERL_NIF_TERM portaudio_bridge_start_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *input;
+        struct erl_stream_resource *output;
+        double target_latency;
+        unsigned long chunk_frames = 0;
+
+        if (argc != 4
+            || !erl_stream_resource_get(env, argv[0], &input)
+            || !erl_stream_resource_get(env, argv[1], &output)
+            || !enif_get_double(env, argv[2], &target_latency)
+            || !(erli_is_nil(env, argv[3]) || enif_get_ulong(env, argv[3], &chunk_frames))
+            || target_latency < 0
+            || target_latency > BRIDGE_MAX_LATENCY) {
+                return enif_make_badarg(env);
+        }
+
+        if (input->input_frame_size == 0)
+                return pa_error_to_error_tuple(env, paCanNotReadFromAnOutputOnlyStream);
+        if (output->output_frame_size == 0)
+                return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+
+        if (chunk_frames == 0)
+                chunk_frames = input->frames_per_buffer != 0
+                        ? input->frames_per_buffer
+                        : BRIDGE_DEFAULT_FRAMES;
+        if (chunk_frames > BRIDGE_MAX_CHUNK_FRAMES)
+                return enif_make_badarg(env);
+
+        // Fails if either stream is already subscribed, playing or bridged
+        const char *reason;
+        struct bridge *bridge = bridge_start(input, output, target_latency, chunk_frames,
+                                             &reason);
+        if (bridge == NULL)
+                return erli_make_error_tuple(env, reason);
+
+        const ERL_NIF_TERM ret = erli_make_ok_tuple(env, enif_make_resource(env, bridge));
+        enif_release_resource(bridge);
+        return ret;
+}
+
+static ERL_NIF_TERM portaudio_bridge_stop_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        struct bridge *bridge;
+
+        if (argc != 1 || !bridge_resource_get(env, argv[0], &bridge))
+                return enif_make_badarg(env);
+
+        bridge_stop(bridge);
+        return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM portaudio_bridge_stats_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        struct bridge *bridge;
+
+        if (argc != 1 || !bridge_resource_get(env, argv[0], &bridge))
+                return enif_make_badarg(env);
+
+        return bridge_stats_to_term(env, bridge);
+}
+
+/**
+ * Largest number of frames written before checking whether the calling NIF
+ * has used up its timeslice.
+ */
+#define WRITE_CHUNK_FRAMES 4096
+
+/**
+ * Length of a normal scheduler timeslice in microseconds, used to report
+ * how much of it a write has consumed.
+ */
+#define TIMESLICE_USEC 1000
+
+static ERL_NIF_TERM portaudio_stream_write_continue_nif(ErlNifEnv *env, int argc,
+                                                        const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM portaudio_stream_write_blocking_nif(ErlNifEnv *env, int argc,
+                                                        const ERL_NIF_TERM argv[]);
+
+/**
+ * Returns a binary term holding the data of `iolist`, which is needed to
+ * pass the data on when rescheduling.
+ */
+static bool _iolist_to_binary_term(ErlNifEnv *env, ERL_NIF_TERM iolist,
+                                   ERL_NIF_TERM *term, ErlNifBinary *bin)
+{
+        if (enif_inspect_binary(env, iolist, bin)) {
+                *term = iolist;
+                return true;
+        }
+
+        ErlNifBinary tmp;
+        if (!enif_inspect_iolist_as_binary(env, iolist, &tmp))
+                return false;
+
+        unsigned char *data = enif_make_new_binary(env, tmp.size, term);
+        ensure(data != NULL);
+        memcpy(data, tmp.data, tmp.size);
+        return enif_inspect_binary(env, *term, bin);
+}
+
+/**
+ * Report the time spent since `start` to the scheduler. Returns `true` if
+ * the timeslice is used up and the NIF should yield.
+ */
+static bool _timeslice_used(ErlNifEnv *env, ErlNifTime start)
+{
+        const ErlNifTime elapsed = enif_monotonic_time(ERL_NIF_USEC) - start;
+        int percent = (int) (elapsed * 100 / TIMESLICE_USEC);
+        if (percent < 1)
+                percent = 1;
+        else if (percent > 100)
+                percent = 100;
+
+        return enif_consume_timeslice(env, percent);
+}
+
+static ERL_NIF_TERM _stream_write_reschedule(ErlNifEnv *env, const ERL_NIF_TERM argv[],
+                                             long offset, bool blocking)
+{
+        const ERL_NIF_TERM args[3] = {
+                argv[0], argv[1], enif_make_long(env, offset)
+        };
+
+        return blocking
+                ? enif_schedule_nif(env, "stream_write", ERL_NIF_DIRTY_JOB_IO_BOUND,
+                                    &portaudio_stream_write_blocking_nif, 3, args)
+                : enif_schedule_nif(env, "stream_write", 0,
+                                    &portaudio_stream_write_continue_nif, 3, args);
+}
+
+/**
+ * Write frames that fit in the stream's buffer without blocking, starting
+ * from the frame offset given by `argv[2]`.
+ *
+ * Runs on a normal scheduler, yielding when the timeslice is used up and
+ * moving to a dirty scheduler only once the stream's buffer is full.
+ */
+static ERL_NIF_TERM _stream_write(ErlNifEnv *env, struct erl_stream_resource *res,
+                                  const ERL_NIF_TERM argv[])
+{
+        ErlNifBinary input_bin;
+        long offset;
+        if (!enif_inspect_binary(env, argv[1], &input_bin)
+            || !enif_get_long(env, argv[2], &offset)) {
                 return enif_make_badarg(env);
         }
 
@@ -443,15 +1428,167 @@ static ERL_NIF_TERM portaudio_stream_write_nif(ErlNifEnv *env, int argc, const E
         assert(stream_info != NULL);
         if (stream_info->outputLatency == 0)
                 return pa_error_to_error_tuple(env, paCanNotWriteToAnInputOnlyStream);
+        if (res->bridge != NULL)
+                return erli_make_error_tuple(env, "stream_bridged");
 
         const long frames_to_write = input_bin.size / res->output_frame_size;
-        const PaError err = Pa_WriteStream(res->stream, input_bin.data, frames_to_write);
+
+        // With an underrun policy writes go through the playback queue in
+        // chunks, waiting on a dirty scheduler once it's full
+        int result;
+        do {
+                long frames = frames_to_write - offset;
+                if (frames > WRITE_CHUNK_FRAMES)
+                        frames = WRITE_CHUNK_FRAMES;
+
+                const ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+                long queued;
+                result = playback_queue_write(res, input_bin.data + offset * res->output_frame_size,
+                                              frames, false, &queued);
+                if (result < 0)
+                        break;
+                atomic_fetch_add(&res->frames_written, queued);
+                offset += queued;
+
+                if (queued < frames)
+                        return _stream_write_reschedule(env, argv, offset, true);
+                if (offset < frames_to_write && _timeslice_used(env, start))
+                        return _stream_write_reschedule(env, argv, offset, false);
+        } while (offset < frames_to_write);
+
+        if (result >= 0)
+                return enif_make_atom(env, "ok");
+
+        // Otherwise the playback thread owns all writes while it has sources
+        if (playback_is_running(res))
+                return erli_make_error_tuple(env, "stream_playing");
+
+        while (offset < frames_to_write) {
+                const long frames_available = Pa_GetStreamWriteAvailable(res->stream);
+                handle_pa_error(env, frames_available);
+                if (frames_available == 0)
+                        return _stream_write_reschedule(env, argv, offset, true);
+
+                long frames = frames_to_write - offset;
+                if (frames > frames_available)
+                        frames = frames_available;
+                if (frames > WRITE_CHUNK_FRAMES)
+                        frames = WRITE_CHUNK_FRAMES;
+
+                const ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+                const PaError err = Pa_WriteStream(res->stream,
+                                                   input_bin.data + offset * res->output_frame_size,
+                                                   frames);
+                handle_pa_error(env, err);
+                atomic_fetch_add(&res->frames_written, frames);
+                offset += frames;
+
+                if (offset < frames_to_write && _timeslice_used(env, start))
+                        return _stream_write_reschedule(env, argv, offset, false);
+        }
+
+        return enif_make_atom(env, "ok");
+}
+
+/**
+ * Write the remaining frames from the offset given by `argv[2]`, blocking
+ * until the stream has accepted all of them. Must run on a dirty scheduler.
+ */
+static ERL_NIF_TERM _stream_write_blocking(ErlNifEnv *env, struct erl_stream_resource *res,
+                                           const ERL_NIF_TERM argv[])
+{
+        ErlNifBinary input_bin;
+        long offset;
+        if (!enif_inspect_binary(env, argv[1], &input_bin)
+            || !enif_get_long(env, argv[2], &offset)) {
+                return enif_make_badarg(env);
+        }
+
+        // Bridged while rescheduling
+        if (res->bridge != NULL)
+                return erli_make_error_tuple(env, "stream_bridged");
+
+        const long frames_to_write = input_bin.size / res->output_frame_size;
+        const unsigned char *data = input_bin.data + offset * res->output_frame_size;
+
+        long queued = 0;
+        const int result = playback_queue_write(res, data, frames_to_write - offset, true, &queued);
+        atomic_fetch_add(&res->frames_written, queued);
+
+        switch (result) {
+        case -1:
+                // Sources attached since moving here own the stream's writes
+                if (playback_is_running(res))
+                        return erli_make_error_tuple(env, "stream_playing");
+                break;
+        case QUEUE_WRITE_REMOVED:
+                return erli_make_error_tuple(env, "no_write_queue");
+        case QUEUE_WRITE_STOPPED:
+                return erli_make_error_tuple(env, "stream_stopped");
+        case QUEUE_WRITE_CLOSING:
+                return erli_make_error_tuple(env, "stream_closed");
+        default:
+                return enif_make_atom(env, "ok");
+        }
+
+        const PaError err = Pa_WriteStream(res->stream, data, frames_to_write - offset);
         handle_pa_error(env, err);
+        atomic_fetch_add(&res->frames_written, frames_to_write - offset);
         return enif_make_atom(env, "ok");
 }
 
+static ERL_NIF_TERM portaudio_stream_frames_written_nif(ErlNifEnv *env, int argc,
+                                                       const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 1 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        return enif_make_ulong(env, atomic_load(&res->frames_written));
+}
+
+static ERL_NIF_TERM portaudio_stream_write_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+        ERL_NIF_TERM data;
+        ErlNifBinary input_bin;
+
+        if (argc != 2
+            || !erl_stream_resource_get(env, argv[0], &res)
+            || !_iolist_to_binary_term(env, argv[1], &data, &input_bin)) {
+                return enif_make_badarg(env);
+        }
+
+        const ERL_NIF_TERM args[3] = { argv[0], data, enif_make_long(env, 0) };
+        return erl_stream_resource_run(env, res, &_stream_write, args);
+}
+
+static ERL_NIF_TERM portaudio_stream_write_continue_nif(ErlNifEnv *env, int argc,
+                                                        const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 3 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        return erl_stream_resource_run(env, res, &_stream_write, argv);
+}
+
+static ERL_NIF_TERM portaudio_stream_write_blocking_nif(ErlNifEnv *env, int argc,
+                                                        const ERL_NIF_TERM argv[])
+{
+        struct erl_stream_resource *res;
+
+        if (argc != 3 || !erl_stream_resource_get(env, argv[0], &res))
+                return enif_make_badarg(env);
+
+        return erl_stream_resource_run(env, res, &_stream_write_blocking, argv);
+}
+
 static ErlNifFunc portaudio_nif_funcs[] = {
         {"version", 0, portaudio_version_nif, 0},
+        {"realtime_status", 0, portaudio_realtime_status_nif, 0},
         // Native Host API
         {"host_api_count",             0, portaudio_host_api_count_nif,             0},
         {"host_api_info",              1, portaudio_host_api_info_nif,              0},
@@ -463,25 +1600,69 @@ static ErlNifFunc portaudio_nif_funcs[] = {
         {"device_info",                 1, portaudio_device_info_nif,                 0},
         {"default_input_device_index",  0, portaudio_default_input_device_index_nif,  0},
         {"default_output_device_index", 0, portaudio_default_output_device_index_nif, 0},
+        // Probing may open the device, so is done on a dirty scheduler
+        {"device_capabilities",         1, portaudio_device_capabilities_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
         // Streams
         {"stream_format_supported", 3, portaudio_stream_format_supported_nif, 0},
-        {"stream_open",             4, portaudio_stream_open_nif,             0},
+        {"stream_open",             5, portaudio_stream_open_nif,             0},
         {"stream_start",            1, portaudio_stream_start_nif,            0},
         {"stream_stop",             1, portaudio_stream_stop_nif,             0},
         {"stream_abort",            1, portaudio_stream_abort_nif,            0},
+        {"stream_close",            1, portaudio_stream_close_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
         {"stream_is_active",        1, portaudio_stream_is_active_nif,        0},
         {"stream_is_stopped",       1, portaudio_stream_is_stopped_nif,       0},
-        {"stream_read",             1, portaudio_stream_read_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
-        {"stream_write",            2, portaudio_stream_write_nif, ERL_NIF_DIRTY_JOB_IO_BOUND}
+        // Reads never block and writes move to a dirty scheduler when needed
+        {"stream_read",             1, portaudio_stream_read_nif,             0},
+        {"stream_write",            2, portaudio_stream_write_nif,            0},
+        {"stream_frames_written",   1, portaudio_stream_frames_written_nif,   0},
+        // Wait for in-flight reads to swap the read policy
+        {"stream_set_delivery",     3, portaudio_stream_set_delivery_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_set_routing",      2, portaudio_stream_set_routing_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_set_spectrum",     2, portaudio_stream_set_spectrum_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_spectrum_info",    1, portaudio_stream_spectrum_info_nif,    0},
+        // Wait for a capture thread left by a subscriber that went down
+        {"stream_subscribe",        4, portaudio_stream_subscribe_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_subscribe_spectrum", 3, portaudio_stream_subscribe_spectrum_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        // Waits for the capture thread to exit when removing the last subscriber
+        {"stream_unsubscribe",      2, portaudio_stream_unsubscribe_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_ack",              2, portaudio_stream_ack_nif,              0},
+        {"stream_subscribers",      1, portaudio_stream_subscribers_nif,      0},
+        {"stream_capture_stats",    1, portaudio_stream_capture_stats_nif,    0},
+        // Waits for the playback thread to exit when removing the jitter buffer
+        {"stream_set_jitter_buffer", 2, portaudio_stream_set_jitter_buffer_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_jitter_push",      4, portaudio_stream_jitter_push_nif,      0},
+        {"stream_jitter_stats",     1, portaudio_stream_jitter_stats_nif,     0},
+        // As do these when removing the last source
+        {"stream_set_underrun_policy", 2, portaudio_stream_set_underrun_policy_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_set_generator",    2, portaudio_stream_set_generator_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"stream_queue_stats",      1, portaudio_stream_queue_stats_nif,      0},
+        {"stream_set_schedule",     2, portaudio_stream_set_schedule_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        // Converts whole clips, which may be long
+        {"stream_schedule",         4, portaudio_stream_schedule_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+        {"stream_schedule_info",    1, portaudio_stream_schedule_info_nif,    0},
+        // Bridges take the write lock on both streams, waiting for in-flight
+        // reads and writes
+        {"bridge_start",            4, portaudio_bridge_start_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"bridge_stop",             1, portaudio_bridge_stop_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+        {"bridge_stats",            1, portaudio_bridge_stats_nif,            0}
 };
 
 static int on_load(ErlNifEnv *env, void **priv_data, ERL_NIF_TERM load_info)
 {
-        unused(priv_data); unused(load_info);
+        unused(priv_data);
+
+        if (!realtime_init(env, load_info))
+                return -1;
 
         if(!erl_stream_resource_register(env))
                 return -1;
 
+        if (!bridge_resource_register(env))
+                return -1;
+
+        if (!capabilities_init())
+                return -1;
+
         // Initialize portaudio
         const PaError err = Pa_Initialize();
         if (err != paNoError)
@@ -494,6 +1675,7 @@ static void on_unload(ErlNifEnv *env, void *priv_data)
 {
         unused(env); unused(priv_data);
 
+        capabilities_destroy();
         Pa_Terminate();
 }
 
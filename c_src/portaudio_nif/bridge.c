@@ -0,0 +1,457 @@
+#include "bridge.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "capture.h"
+#include "erl_interop.h"
+#include "pa_conversions.h"
+#include "playback.h"
+#include "realtime.h"
+#include "samples.h"
+#include "util.h"
+
+/**
+ * Largest correction applied to the resampling ratio. Real clock drift is
+ * in the order of a hundred parts per million.
+ */
+#define BRIDGE_MAX_CORRECTION 0.005
+
+/**
+ * Gains of the drift controller, acting on the error in seconds.
+ */
+#define BRIDGE_KP 0.05
+#define BRIDGE_KI 0.005
+
+/**
+ * Smoothing applied to the measured output depth, which jumps by whole
+ * host buffers.
+ */
+#define BRIDGE_DEPTH_SMOOTHING 0.05
+
+static ErlNifResourceType *PORTAUDIO_BRIDGE_RESOURCE = NULL;
+
+static void _bridge_resource_release(ErlNifEnv *env, void *data)
+{
+        unused(env);
+
+        struct bridge *bridge = data;
+        bridge_stop(bridge);
+
+        resampler_destroy(&bridge->resampler);
+        enif_mutex_destroy(bridge->stats_lock);
+        realtime_free(bridge->in_float);
+        realtime_free(bridge->out_float);
+        realtime_free(bridge->in_buffer);
+        realtime_free(bridge->out_buffer);
+        realtime_free(bridge->silence);
+
+        enif_release_resource(bridge->input);
+        enif_release_resource(bridge->output);
+}
+
+bool bridge_resource_register(ErlNifEnv *env)
+{
+        const ErlNifResourceFlags rt_flags =
+                ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER;
+        ErlNifResourceType *rt = enif_open_resource_type(env, NULL,
+                                                         "PORTAUDIO_BRIDGE_RESOURCE",
+                                                         &_bridge_resource_release,
+                                                         rt_flags, NULL);
+        if (rt == NULL)
+                return false;
+        PORTAUDIO_BRIDGE_RESOURCE = rt;
+
+        return true;
+}
+
+bool bridge_resource_get(ErlNifEnv *env, ERL_NIF_TERM term, struct bridge **bridge)
+{
+        return enif_get_resource(env, term, PORTAUDIO_BRIDGE_RESOURCE, (void **) bridge) == 1;
+}
+
+/**
+ * Feed the measured output depth in to the controller, returning the new
+ * adjustment for the resampling step.
+ */
+static double _update_drift(struct bridge *bridge, long queued, long frames_written)
+{
+        const double rate = bridge->output->sample_rate;
+
+        enif_mutex_lock(bridge->stats_lock);
+
+        bridge->queued_frames +=
+                BRIDGE_DEPTH_SMOOTHING * (queued - bridge->queued_frames);
+
+        // Too much queued means the output runs slow, so consume input
+        // faster and produce fewer frames
+        const double error = (bridge->queued_frames - bridge->target_frames) / rate;
+        bridge->integral += error * (frames_written / rate);
+
+        double correction = BRIDGE_KP * error + BRIDGE_KI * bridge->integral;
+        if (correction > BRIDGE_MAX_CORRECTION)
+                correction = BRIDGE_MAX_CORRECTION;
+        else if (correction < -BRIDGE_MAX_CORRECTION)
+                correction = -BRIDGE_MAX_CORRECTION;
+
+        // Stop the integral winding up while the correction is saturated
+        if (fabs(correction) == BRIDGE_MAX_CORRECTION)
+                bridge->integral -= error * (frames_written / rate);
+
+        bridge->adjust = 1.0 + correction;
+        const double adjust = bridge->adjust;
+
+        enif_mutex_unlock(bridge->stats_lock);
+
+        return adjust;
+}
+
+/**
+ * Read a chunk from the input. Returns `false` if the bridge should stop.
+ */
+static bool _read_input(struct bridge *bridge, bool *ready)
+{
+        struct erl_stream_resource *in = bridge->input;
+        *ready = false;
+
+        enif_rwlock_rlock(in->lock);
+        if (in->stream == NULL) {
+                enif_rwlock_runlock(in->lock);
+                return false;
+        }
+
+        if (Pa_IsStreamActive(in->stream) == 1) {
+                const PaError err = Pa_ReadStream(in->stream, bridge->in_buffer,
+                                                  bridge->chunk_frames);
+                if (err == paInputOverflowed) {
+                        enif_mutex_lock(bridge->stats_lock);
+                        bridge->input_overflows++;
+                        enif_mutex_unlock(bridge->stats_lock);
+                }
+                *ready = !pa_is_error(err) || err == paInputOverflowed;
+        }
+        enif_rwlock_runlock(in->lock);
+
+        return true;
+}
+
+static void _count_underflow(struct bridge *bridge)
+{
+        enif_mutex_lock(bridge->stats_lock);
+        bridge->output_underflows++;
+        enif_mutex_unlock(bridge->stats_lock);
+}
+
+/**
+ * Write `frames` resampled frames to the output. Returns `false` if the
+ * bridge should stop.
+ */
+static bool _write_output(struct bridge *bridge, long frames, long *queued)
+{
+        struct erl_stream_resource *out = bridge->output;
+
+        enif_rwlock_rlock(out->lock);
+        if (out->stream == NULL) {
+                enif_rwlock_runlock(out->lock);
+                return false;
+        }
+
+        const long available = Pa_GetStreamWriteAvailable(out->stream);
+        if (available > bridge->output_capacity)
+                bridge->output_capacity = available;
+        *queued = available < 0 ? 0 : bridge->output_capacity - available;
+
+        // Fill up to the target depth with silence when starting, rather
+        // than slowly getting there through the drift correction
+        if (!bridge->primed && *queued < bridge->target_frames) {
+                const PaError err = Pa_WriteStream(out->stream, bridge->silence,
+                                                   (long) bridge->target_frames - *queued);
+                if (err == paOutputUnderflowed)
+                        _count_underflow(bridge);
+                // Try again with the next chunk unless the silence was written
+                if (!pa_is_error(err) || err == paOutputUnderflowed) {
+                        *queued = (long) bridge->target_frames;
+                        bridge->primed = true;
+                }
+        } else {
+                bridge->primed = true;
+        }
+
+        const PaError err = Pa_WriteStream(out->stream, bridge->out_buffer, frames);
+        if (err == paOutputUnderflowed) {
+                _count_underflow(bridge);
+                bridge->primed = false;
+        }
+        enif_rwlock_runlock(out->lock);
+
+        return true;
+}
+
+static void _convert_channels(const float *in, int in_channels, float *out, int out_channels,
+                              long frames)
+{
+        if (in_channels == out_channels) {
+                memcpy(out, in, sizeof(float) * frames * in_channels);
+                return;
+        }
+
+        // Extra output channels are silent, extra input channels dropped
+        long f;
+        int c;
+        for (f = 0; f < frames; f++) {
+                for (c = 0; c < out_channels; c++)
+                        out[f * out_channels + c] = c < in_channels ? in[f * in_channels + c] : 0.0f;
+        }
+}
+
+/**
+ * Make `bridge` the owner of `res`. Returns `NULL` on success, otherwise
+ * the reason the stream can't be bridged.
+ *
+ * The capture and playback threads check for a bridge only after marking
+ * themselves as running, so one of the two always sees the other.
+ */
+static const char *_claim(struct erl_stream_resource *res, struct bridge *bridge)
+{
+        const char *reason = NULL;
+
+        enif_rwlock_rwlock(res->lock);
+        if (res->stream == NULL)
+                reason = "stream_closed";
+        else if (res->bridge != NULL)
+                reason = "stream_bridged";
+
+        if (reason == NULL) {
+                res->bridge = bridge;
+                if (capture_is_running(res))
+                        reason = "stream_subscribed";
+                else if (playback_is_running(res))
+                        reason = "stream_playing";
+                if (reason != NULL)
+                        res->bridge = NULL;
+        }
+        enif_rwlock_rwunlock(res->lock);
+
+        return reason;
+}
+
+/**
+ * Give up ownership of `res`, if `bridge` still owns it.
+ */
+static void _release(struct erl_stream_resource *res, struct bridge *bridge)
+{
+        enif_rwlock_rwlock(res->lock);
+        if (res->bridge == bridge)
+                res->bridge = NULL;
+        enif_rwlock_rwunlock(res->lock);
+}
+
+bool bridge_is_attached(struct erl_stream_resource *res)
+{
+        enif_rwlock_rlock(res->lock);
+        const bool attached = res->bridge != NULL;
+        enif_rwlock_runlock(res->lock);
+        return attached;
+}
+
+static void *_bridge_thread(void *arg)
+{
+        struct bridge *bridge = arg;
+        struct erl_stream_resource *in = bridge->input;
+        struct erl_stream_resource *out = bridge->output;
+        const int out_channels = out->output_channels;
+        double adjust = 1.0;
+
+        realtime_enter_thread("bridge");
+
+        while (atomic_load(&bridge->running)) {
+                bool ready;
+                if (!_read_input(bridge, &ready))
+                        break;
+
+                if (!ready) {
+                        Pa_Sleep(STREAM_IDLE_MSEC);
+                        continue;
+                }
+
+                samples_to_float(in->input_format, bridge->in_buffer, bridge->in_float,
+                                 bridge->chunk_frames * in->input_channels);
+                _convert_channels(bridge->in_float, in->input_channels,
+                                  bridge->out_float, bridge->channels, bridge->chunk_frames);
+
+                // Resampled frames go after the channel converted input
+                float *resampled = bridge->out_float + bridge->chunk_frames * bridge->channels;
+                const long frames = resampler_process(&bridge->resampler, bridge->out_float,
+                                                      bridge->chunk_frames, resampled, adjust);
+
+                float *converted = bridge->in_float;
+                _convert_channels(resampled, bridge->channels, converted, out_channels, frames);
+                samples_from_float(out->output_format, converted, bridge->out_buffer,
+                                   frames * out_channels);
+
+                long queued;
+                if (!_write_output(bridge, frames, &queued))
+                        break;
+
+                adjust = _update_drift(bridge, queued, frames);
+
+                enif_mutex_lock(bridge->stats_lock);
+                bridge->frames_in += bridge->chunk_frames;
+                bridge->frames_out += frames;
+                enif_mutex_unlock(bridge->stats_lock);
+        }
+
+        // Whether stopped or left with a closed stream, the streams are
+        // free to be used directly again
+        _release(in, bridge);
+        _release(out, bridge);
+        atomic_store(&bridge->running, false);
+
+        return NULL;
+}
+
+/**
+ * Number of frames the output of `res` can hold, from its reported latency
+ * or, if larger, its current write space. Returns -1 if the stream is closed.
+ */
+static double _output_capacity(struct erl_stream_resource *res)
+{
+        double capacity = -1;
+
+        enif_rwlock_rlock(res->lock);
+        if (res->stream != NULL) {
+                const PaStreamInfo *info = Pa_GetStreamInfo(res->stream);
+                capacity = info != NULL ? info->outputLatency * res->sample_rate : 0;
+
+                const long available = Pa_GetStreamWriteAvailable(res->stream);
+                if (available > capacity)
+                        capacity = available;
+        }
+        enif_rwlock_runlock(res->lock);
+
+        return capacity;
+}
+
+struct bridge *bridge_start(struct erl_stream_resource *input,
+                            struct erl_stream_resource *output,
+                            double target_latency, long chunk_frames,
+                            const char **reason)
+{
+        if (input->input_frame_size == 0 || output->output_frame_size == 0) {
+                *reason = "bad_bridge";
+                return NULL;
+        }
+
+        // A deeper target could never be reached, so priming would block on
+        // a full output and the drift correction would stay pinned. A closed
+        // output is reported when claiming it.
+        const double capacity = _output_capacity(output);
+        if (capacity >= 0 && target_latency * output->sample_rate > capacity) {
+                *reason = "latency_too_large";
+                return NULL;
+        }
+
+        struct bridge *bridge = enif_alloc_resource(PORTAUDIO_BRIDGE_RESOURCE, sizeof(*bridge));
+        ensure(bridge != NULL);
+        memset(bridge, 0, sizeof(*bridge));
+
+        enif_keep_resource(input);
+        enif_keep_resource(output);
+        bridge->input = input;
+        bridge->output = output;
+
+        const int out_channels = output->output_channels;
+        bridge->channels = input->input_channels < out_channels
+                ? input->input_channels
+                : out_channels;
+        bridge->chunk_frames = chunk_frames;
+        bridge->target_frames = target_latency * output->sample_rate;
+        bridge->queued_frames = bridge->target_frames;
+        bridge->adjust = 1.0;
+
+        resampler_init(&bridge->resampler, bridge->channels,
+                       input->sample_rate, output->sample_rate);
+
+        // Bounds the resampler output at the largest allowed correction
+        bridge->out_capacity_frames =
+                resampler_max_output(&bridge->resampler, chunk_frames,
+                                     1.0 - BRIDGE_MAX_CORRECTION);
+
+        const long max_channels = input->input_channels > out_channels
+                ? input->input_channels
+                : out_channels;
+        const long float_frames = chunk_frames > bridge->out_capacity_frames
+                ? chunk_frames
+                : bridge->out_capacity_frames;
+
+        bridge->silence = realtime_alloc((long) bridge->target_frames * output->output_frame_size + 1);
+        ensure(bridge->silence != NULL);
+        memset(bridge->silence, 0, (long) bridge->target_frames * output->output_frame_size + 1);
+
+        bridge->in_buffer = realtime_alloc(chunk_frames * input->input_frame_size);
+        bridge->out_buffer = realtime_alloc(bridge->out_capacity_frames * output->output_frame_size);
+        bridge->in_float = realtime_alloc(sizeof(float) * float_frames * max_channels);
+        bridge->out_float = realtime_alloc(sizeof(float) * (chunk_frames + bridge->out_capacity_frames)
+                                       * bridge->channels);
+        ensure(bridge->in_buffer && bridge->out_buffer && bridge->in_float && bridge->out_float);
+
+        bridge->stats_lock = enif_mutex_create("portaudio_bridge_stats_lock");
+        ensure(bridge->stats_lock != NULL);
+
+        // A duplex stream may be bridged to itself
+        *reason = _claim(input, bridge);
+        if (*reason == NULL && output != input) {
+                *reason = _claim(output, bridge);
+                if (*reason != NULL)
+                        _release(input, bridge);
+        }
+        if (*reason != NULL) {
+                enif_release_resource(bridge);
+                return NULL;
+        }
+
+        atomic_init(&bridge->running, true);
+        ensure(enif_thread_create("portaudio_bridge", &bridge->tid,
+                                  &_bridge_thread, bridge, NULL) == 0);
+        bridge->joinable = true;
+
+        return bridge;
+}
+
+void bridge_stop(struct bridge *bridge)
+{
+        if (!bridge->joinable)
+                return;
+
+        atomic_store(&bridge->running, false);
+        enif_thread_join(bridge->tid, NULL);
+        bridge->joinable = false;
+}
+
+ERL_NIF_TERM bridge_stats_to_term(ErlNifEnv *env, struct bridge *bridge)
+{
+        enif_mutex_lock(bridge->stats_lock);
+
+        const double nominal = bridge->output->sample_rate / bridge->input->sample_rate;
+
+#define N_FIELDS 8
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "running", erli_make_bool(env, atomic_load(&bridge->running))),
+                make_kw_item(env, "ratio", enif_make_double(env, nominal / bridge->adjust)),
+                make_kw_item(env, "drift_ppm",
+                             enif_make_double(env, (bridge->adjust - 1.0) * 1e6)),
+                make_kw_item(env, "queued_frames", enif_make_double(env, bridge->queued_frames)),
+                make_kw_item(env, "target_frames", enif_make_double(env, bridge->target_frames)),
+                make_kw_item(env, "input_overflows", enif_make_ulong(env, bridge->input_overflows)),
+                make_kw_item(env, "output_underflows", enif_make_ulong(env, bridge->output_underflows)),
+                make_kw_item(env, "frames", enif_make_tuple2(env,
+                                                             enif_make_ulong(env, bridge->frames_in),
+                                                             enif_make_ulong(env, bridge->frames_out)))
+        };
+
+        enif_mutex_unlock(bridge->stats_lock);
+
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
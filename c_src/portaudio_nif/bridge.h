@@ -0,0 +1,101 @@
+#ifndef _PORTAUDIO_NIF_BRIDGE_
+#define _PORTAUDIO_NIF_BRIDGE_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "erl_nif.h"
+#include "resampler.h"
+#include "stream.h"
+
+/**
+ * Largest target latency of a bridge in seconds, and largest number of
+ * frames moved at a time. Both size buffers allocated up front.
+ */
+#define BRIDGE_MAX_LATENCY 10.0
+#define BRIDGE_MAX_CHUNK_FRAMES 65536
+
+/**
+ * Connects an input stream to an output stream running on a different
+ * clock. A thread reads from the input, resamples and writes to the
+ * output, continuously adjusting the resampling ratio so the output's
+ * buffer stays at a target depth instead of slowly draining or filling up.
+ */
+struct bridge {
+        struct erl_stream_resource *input;
+        struct erl_stream_resource *output;
+
+        ErlNifTid tid;
+        // Cleared by the thread when it exits, including when either stream
+        // is closed
+        atomic_bool running;
+        bool joinable;
+
+        long chunk_frames;
+        int channels;
+
+        // Frames the output should have queued
+        double target_frames;
+        // Largest write space seen, taken as the size of the output buffer
+        long output_capacity;
+        // Whether the output has been filled up to the target depth
+        bool primed;
+        unsigned char *silence;
+
+        struct resampler resampler;
+
+        // Drift controller state, guarded by `stats_lock`
+        ErlNifMutex *stats_lock;
+        double queued_frames;
+        double integral;
+        double adjust;
+        unsigned long input_overflows;
+        unsigned long output_underflows;
+        unsigned long frames_in;
+        unsigned long frames_out;
+
+        float *in_float;
+        float *out_float;
+        unsigned char *in_buffer;
+        unsigned char *out_buffer;
+        long out_capacity_frames;
+};
+
+/**
+ * Register the bridge resource type. Returns `false` on failure.
+ */
+bool bridge_resource_register(ErlNifEnv *env);
+
+/**
+ * Get a bridge from an erlang resource term.
+ */
+bool bridge_resource_get(ErlNifEnv *env, ERL_NIF_TERM term, struct bridge **bridge);
+
+/**
+ * Create a bridge from `input` to `output` and start its thread, making it
+ * the owner of both streams until the thread exits. Returns `NULL` and sets
+ * `reason` to an error atom if the streams can't be bridged.
+ */
+struct bridge *bridge_start(struct erl_stream_resource *input,
+                            struct erl_stream_resource *output,
+                            double target_latency, long chunk_frames,
+                            const char **reason);
+
+/**
+ * Stop the bridge's thread, waiting for it to exit. Does nothing if it
+ * isn't running.
+ */
+void bridge_stop(struct bridge *bridge);
+
+/**
+ * Returns `true` if a bridge owns the stream. Must not be called while
+ * holding the stream lock.
+ */
+bool bridge_is_attached(struct erl_stream_resource *res);
+
+/**
+ * Returns a map of statistics about the bridge.
+ */
+ERL_NIF_TERM bridge_stats_to_term(ErlNifEnv *env, struct bridge *bridge);
+
+#endif // _PORTAUDIO_NIF_BRIDGE_
@@ -0,0 +1,220 @@
+#include "capabilities.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "erl_interop.h"
+#include "pa_conversions.h"
+#include "util.h"
+
+static const PaSampleFormat probe_formats[CAPABILITIES_N_FORMATS] = {
+        paFloat32, paInt32, paInt24, paInt16, paInt8, paUInt8
+};
+
+static const double probe_rates[CAPABILITIES_N_RATES] = {
+        8000.0, 11025.0, 16000.0, 22050.0, 32000.0, 44100.0,
+        48000.0, 88200.0, 96000.0, 176400.0, 192000.0
+};
+
+// Guards the cache, but isn't held while probing
+static ErlNifMutex *cache_lock = NULL;
+// Signalled whenever a device has finished being probed
+static ErlNifCond *cache_probed = NULL;
+static struct device_capabilities **cache = NULL;
+static bool *probing = NULL;
+static PaDeviceIndex cache_len = 0;
+
+bool capabilities_init(void)
+{
+        cache_lock = enif_mutex_create("portaudio_capabilities_lock");
+        cache_probed = enif_cond_create("portaudio_capabilities_probed");
+        return cache_lock != NULL && cache_probed != NULL;
+}
+
+void capabilities_destroy(void)
+{
+        PaDeviceIndex i;
+        for (i = 0; i < cache_len; i++) {
+                enif_safe_free(cache[i]);
+        }
+        enif_safe_free(cache);
+        enif_safe_free(probing);
+
+        cache = NULL;
+        probing = NULL;
+        cache_len = 0;
+
+        if (cache_lock != NULL)
+                enif_mutex_destroy(cache_lock);
+        cache_lock = NULL;
+        if (cache_probed != NULL)
+                enif_cond_destroy(cache_probed);
+        cache_probed = NULL;
+}
+
+static bool _is_supported(PaStreamParameters *params, int channels, bool input, double rate)
+{
+        params->channelCount = channels;
+        const PaError err = input
+                ? Pa_IsFormatSupported(params, NULL, rate)
+                : Pa_IsFormatSupported(NULL, params, rate);
+        return err == paFormatIsSupported;
+}
+
+static void _probe_direction(PaDeviceIndex device, int max_channels, PaTime latency,
+                             bool input, struct direction_capabilities *caps)
+{
+        if (max_channels > CAPABILITIES_MAX_CHANNELS)
+                max_channels = CAPABILITIES_MAX_CHANNELS;
+        if (max_channels < 1)
+                return;
+
+        PaStreamParameters params = {
+                .device = device,
+                .suggestedLatency = latency,
+                .hostApiSpecificStreamInfo = NULL
+        };
+
+        int f, r, c;
+        for (f = 0; f < CAPABILITIES_N_FORMATS; f++) {
+                params.sampleFormat = probe_formats[f];
+
+                for (r = 0; r < CAPABILITIES_N_RATES; r++) {
+                        uint64_t mask = 0;
+
+                        // Most combinations a device doesn't support fail
+                        // at any channel count, so check the extremes before
+                        // scanning everything in between
+                        if (_is_supported(&params, 1, input, probe_rates[r]))
+                                mask |= 1;
+                        if (max_channels > 1 && _is_supported(&params, max_channels, input, probe_rates[r]))
+                                mask |= (uint64_t) 1 << (max_channels - 1);
+
+                        if (mask != 0) {
+                                for (c = 2; c < max_channels; c++) {
+                                        if (_is_supported(&params, c, input, probe_rates[r]))
+                                                mask |= (uint64_t) 1 << (c - 1);
+                                }
+                        }
+
+                        caps->channels[f][r] = mask;
+                }
+        }
+}
+
+static bool _probe_device(PaDeviceIndex device, struct device_capabilities *caps)
+{
+        const PaDeviceInfo *info = Pa_GetDeviceInfo(device);
+        if (info == NULL)
+                return false;
+
+        memset(caps, 0, sizeof(*caps));
+
+        _probe_direction(device, info->maxInputChannels,
+                         info->defaultLowInputLatency, true, &caps->input);
+        _probe_direction(device, info->maxOutputChannels,
+                         info->defaultLowOutputLatency, false, &caps->output);
+
+        return true;
+}
+
+static bool _is_empty(const struct device_capabilities *caps)
+{
+        int f, r;
+        for (f = 0; f < CAPABILITIES_N_FORMATS; f++) {
+                for (r = 0; r < CAPABILITIES_N_RATES; r++) {
+                        if (caps->input.channels[f][r] != 0 || caps->output.channels[f][r] != 0)
+                                return false;
+                }
+        }
+        return true;
+}
+
+bool capabilities_get(PaDeviceIndex device, struct device_capabilities *caps)
+{
+        const PaDeviceIndex device_count = Pa_GetDeviceCount();
+        if (device < 0 || device >= device_count)
+                return false;
+
+        enif_mutex_lock(cache_lock);
+
+        if (cache == NULL) {
+                cache = enif_alloc(sizeof(*cache) * device_count);
+                probing = enif_alloc(sizeof(*probing) * device_count);
+                ensure(cache != NULL && probing != NULL);
+                memset(cache, 0, sizeof(*cache) * device_count);
+                memset(probing, 0, sizeof(*probing) * device_count);
+                cache_len = device_count;
+        }
+
+        assert(device < cache_len);
+
+        // Wait for anyone already probing the device rather than probing
+        // it twice at once
+        while (probing[device])
+                enif_cond_wait(cache_probed, cache_lock);
+
+        if (cache[device] != NULL) {
+                *caps = *cache[device];
+                enif_mutex_unlock(cache_lock);
+                return true;
+        }
+
+        probing[device] = true;
+        enif_mutex_unlock(cache_lock);
+
+        const bool found = _probe_device(device, caps);
+
+        enif_mutex_lock(cache_lock);
+        if (found && !_is_empty(caps)) {
+                cache[device] = enif_alloc(sizeof(*caps));
+                ensure(cache[device] != NULL);
+                *cache[device] = *caps;
+        }
+        probing[device] = false;
+        enif_cond_broadcast(cache_probed);
+        enif_mutex_unlock(cache_lock);
+
+        return found;
+}
+
+static ERL_NIF_TERM _direction_to_term(ErlNifEnv *env, const struct direction_capabilities *caps)
+{
+        ERL_NIF_TERM list = enif_make_list(env, 0);
+
+        int f, r, c;
+        for (f = CAPABILITIES_N_FORMATS - 1; f >= 0; f--) {
+                for (r = CAPABILITIES_N_RATES - 1; r >= 0; r--) {
+                        const uint64_t mask = caps->channels[f][r];
+                        if (mask == 0)
+                                continue;
+
+                        ERL_NIF_TERM channels = enif_make_list(env, 0);
+                        for (c = CAPABILITIES_MAX_CHANNELS; c >= 1; c--) {
+                                if (mask & ((uint64_t) 1 << (c - 1)))
+                                        channels = enif_make_list_cell(env, enif_make_int(env, c), channels);
+                        }
+
+                        const ERL_NIF_TERM entry =
+                                enif_make_tuple3(env,
+                                                 pa_sample_format_to_term(env, probe_formats[f]),
+                                                 enif_make_double(env, probe_rates[r]),
+                                                 channels);
+                        list = enif_make_list_cell(env, entry, list);
+                }
+        }
+
+        return list;
+}
+
+ERL_NIF_TERM capabilities_to_term(ErlNifEnv *env, const struct device_capabilities *caps)
+{
+#define N_FIELDS 2
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "input", _direction_to_term(env, &caps->input)),
+                make_kw_item(env, "output", _direction_to_term(env, &caps->output))
+        };
+
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
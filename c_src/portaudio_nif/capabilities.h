@@ -0,0 +1,63 @@
+#ifndef _PORTAUDIO_NIF_CAPABILITIES_
+#define _PORTAUDIO_NIF_CAPABILITIES_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <portaudio.h>
+
+#include "erl_nif.h"
+
+/**
+ * Channel counts above this are not probed.
+ */
+#define CAPABILITIES_MAX_CHANNELS 64
+
+#define CAPABILITIES_N_FORMATS 6
+#define CAPABILITIES_N_RATES 11
+
+/**
+ * Supported channel counts for each sample format and sample rate in one
+ * direction, as bitmasks where bit `n` is set if `n + 1` channels are
+ * supported.
+ */
+struct direction_capabilities {
+        uint64_t channels[CAPABILITIES_N_FORMATS][CAPABILITIES_N_RATES];
+};
+
+struct device_capabilities {
+        struct direction_capabilities input;
+        struct direction_capabilities output;
+};
+
+/**
+ * Set up the capability cache. Returns `false` on failure.
+ */
+bool capabilities_init(void);
+
+/**
+ * Free the capability cache and everything in it.
+ */
+void capabilities_destroy(void);
+
+/**
+ * Copy the capabilities of the given device to `caps`, probing them through
+ * `Pa_IsFormatSupported` on the first call for each device. Probing may
+ * open the device, so should be done on a dirty scheduler. Other devices
+ * can be probed at the same time, while callers asking for a device being
+ * probed wait for the result.
+ *
+ * A device found to support nothing isn't cached, as it may only have been
+ * busy, and is probed again on the next call.
+ *
+ * Returns `false` if the device doesn't exist.
+ */
+bool capabilities_get(PaDeviceIndex device, struct device_capabilities *caps);
+
+/**
+ * Convert device capabilities to an erlang map of the form
+ * `%{input: [{format, rate, [channels]}], output: [...]}`, leaving out
+ * format and rate combinations with no supported channel counts.
+ */
+ERL_NIF_TERM capabilities_to_term(ErlNifEnv *env, const struct device_capabilities *caps);
+
+#endif // _PORTAUDIO_NIF_CAPABILITIES_
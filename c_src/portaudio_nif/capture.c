@@ -0,0 +1,517 @@
+#include "capture.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "bridge.h"
+#include "coalescer.h"
+#include "erl_interop.h"
+#include "pa_conversions.h"
+#include "realtime.h"
+#include "routing.h"
+#include "spectrum.h"
+#include "util.h"
+
+/**
+ * Frames read at a time when the stream has neither a delivery policy nor
+ * a fixed host buffer size.
+ */
+#define CAPTURE_DEFAULT_FRAMES 512
+
+struct capture *capture_create(struct erl_stream_resource *res)
+{
+        struct capture *capture = enif_alloc(sizeof(*capture));
+        ensure(capture != NULL);
+        memset(capture, 0, sizeof(*capture));
+
+        capture->res = res;
+        atomic_init(&capture->running, false);
+        capture->joinable = false;
+
+        capture->thread_lock = enif_mutex_create("portaudio_capture_thread_lock");
+        ensure(capture->thread_lock != NULL);
+        capture->lock = enif_mutex_create("portaudio_capture_lock");
+        ensure(capture->lock != NULL);
+
+        capture->msg_env = enif_alloc_env();
+        ensure(capture->msg_env != NULL);
+        capture->send_env = enif_alloc_env();
+        ensure(capture->send_env != NULL);
+
+        return capture;
+}
+
+void capture_destroy(struct capture *capture)
+{
+        assert(!capture->joinable);
+
+        enif_mutex_destroy(capture->thread_lock);
+        enif_mutex_destroy(capture->lock);
+        enif_free_env(capture->msg_env);
+        enif_free_env(capture->send_env);
+        enif_safe_free(capture->subscribers);
+        enif_safe_free(capture->route_terms);
+        enif_safe_free(capture->route_built);
+        enif_free(capture);
+}
+
+static long _chunk_frames(const struct erl_stream_resource *res)
+{
+        if (res->delivery != NULL)
+                return res->delivery->chunk_frames;
+        if (res->frames_per_buffer != 0)
+                return res->frames_per_buffer;
+        return CAPTURE_DEFAULT_FRAMES;
+}
+
+/**
+ * Returns the binary to send for the given route, building it the first
+ * time it is needed for the current buffer. Returns `false` if the route
+ * doesn't exist.
+ */
+static bool _route_term(struct capture *capture, const ErlNifBinary *frames_bin,
+                        long frames, ERL_NIF_TERM route, ERL_NIF_TERM *term)
+{
+        struct routing *routing = capture->res->routing;
+        if (routing == NULL)
+                return false;
+
+        const int r = routing_find(routing, route);
+        if (r < 0)
+                return false;
+
+        if (!capture->route_built[r]) {
+                unsigned char *data =
+                        enif_make_new_binary(capture->msg_env,
+                                             routing_output_size(routing, r, frames),
+                                             &capture->route_terms[r]);
+                ensure(data != NULL);
+                routing_apply(routing, r, frames_bin->data, frames, data);
+                capture->route_built[r] = true;
+        }
+
+        *term = capture->route_terms[r];
+        return true;
+}
+
+/**
+ * Feed the buffer to the stream's spectrum analysis, returning a binary of
+ * the analyses it completed. Returns `false` if none were, or nobody is
+ * subscribed to them.
+ */
+static bool _spectrum_term(struct capture *capture, const ErlNifBinary *frames_bin,
+                           long frames, ERL_NIF_TERM *term)
+{
+        struct spectrum *spectrum = capture->res->spectrum;
+        if (spectrum == NULL || capture->n_spectrum_subscribers == 0)
+                return false;
+
+        const size_t size = spectrum_output_size(spectrum);
+        ErlNifBinary bin;
+        ensure(enif_alloc_binary(spectrum_max_outputs(spectrum, frames) * size, &bin));
+
+        const long n = spectrum_process(spectrum, frames_bin->data, frames, (float *) bin.data);
+        if (n == 0) {
+                enif_release_binary(&bin);
+                return false;
+        }
+
+        ensure(enif_realloc_binary(&bin, n * size));
+        *term = enif_make_binary(capture->msg_env, &bin);
+        return true;
+}
+
+static void _fan_out(struct capture *capture, ErlNifBinary *bin, long frames)
+{
+        struct erl_stream_resource *res = capture->res;
+        ErlNifEnv *env = capture->msg_env;
+
+        const struct routing *routing = res->routing;
+        if (routing != NULL && routing->n_routes > capture->cap_routes) {
+                capture->route_terms = enif_realloc(capture->route_terms,
+                                                    sizeof(ERL_NIF_TERM) * routing->n_routes);
+                capture->route_built = enif_realloc(capture->route_built,
+                                                    sizeof(bool) * routing->n_routes);
+                ensure(capture->route_terms != NULL && capture->route_built != NULL);
+                capture->cap_routes = routing->n_routes;
+        }
+        if (capture->route_built != NULL)
+                memset(capture->route_built, 0, sizeof(bool) * capture->cap_routes);
+
+        const ERL_NIF_TERM tag = enif_make_atom(env, "portaudio_buffer");
+        // Ownership of the binary moves to the environment
+        ErlNifBinary frames_bin = *bin;
+        const ERL_NIF_TERM frames_term = enif_make_binary(env, bin);
+
+        enif_mutex_lock(capture->lock);
+
+        // Once stopped the thread may no longer hold a reference, so mustn't
+        // make new ones to a stream that could be on its way to destruction
+        if (!atomic_load(&capture->running)) {
+                enif_mutex_unlock(capture->lock);
+                enif_clear_env(env);
+                return;
+        }
+        const ERL_NIF_TERM stream_term = enif_make_resource(env, res);
+        capture->buffers++;
+
+        ERL_NIF_TERM spectrum_term;
+        const bool has_spectrum = _spectrum_term(capture, &frames_bin, frames, &spectrum_term);
+
+        int i;
+        for (i = 0; i < capture->n_subscribers; i++) {
+                struct subscriber *sub = &capture->subscribers[i];
+
+                // Most buffers complete no analysis when the hop is long
+                if (sub->spectrum && !has_spectrum)
+                        continue;
+
+                if (sub->max_queue != 0 && sub->in_flight >= sub->max_queue) {
+                        sub->dropped++;
+                        continue;
+                }
+
+                ERL_NIF_TERM msg;
+                if (sub->spectrum) {
+                        msg = enif_make_tuple3(env, enif_make_atom(env, "portaudio_spectrum"),
+                                               stream_term, spectrum_term);
+                } else {
+                        ERL_NIF_TERM data = frames_term;
+                        if (!erli_is_nil(env, sub->route)
+                            && !_route_term(capture, &frames_bin, frames, sub->route, &data)) {
+                                continue;
+                        }
+                        msg = enif_make_tuple4(env, tag, stream_term, sub->route, data);
+                }
+
+                // Copying only bumps the reference count of the binary
+                if (enif_send(NULL, &sub->pid, capture->send_env,
+                              enif_make_copy(capture->send_env, msg))) {
+                        sub->in_flight++;
+                }
+                enif_clear_env(capture->send_env);
+        }
+
+        // Drops the stream term before a stop can release the thread's
+        // reference
+        enif_clear_env(env);
+
+        enif_mutex_unlock(capture->lock);
+}
+
+static void *_capture_thread(void *arg)
+{
+        struct capture *capture = arg;
+        struct erl_stream_resource *res = capture->res;
+
+        realtime_enter_thread("capture");
+
+        while (atomic_load(&capture->running)) {
+                enif_rwlock_rlock(res->lock);
+
+                if (res->stream == NULL) {
+                        enif_rwlock_runlock(res->lock);
+                        break;
+                }
+
+                if (Pa_IsStreamActive(res->stream) != 1) {
+                        enif_rwlock_runlock(res->lock);
+                        Pa_Sleep(STREAM_IDLE_MSEC);
+                        continue;
+                }
+
+                const long frames = _chunk_frames(res);
+                ErlNifBinary bin;
+                ensure(enif_alloc_binary(frames * res->input_frame_size, &bin));
+
+                // Uncontended while the thread owns the reads, but a read
+                // that checked just before the thread started may still be
+                // running
+                enif_mutex_lock(res->read_lock);
+
+                // Overflowed input still fills the buffer, it just has a gap
+                const PaError err = Pa_ReadStream(res->stream, bin.data, frames);
+                if (err == paInputOverflowed) {
+                        enif_mutex_lock(capture->lock);
+                        capture->input_overflows++;
+                        enif_mutex_unlock(capture->lock);
+                }
+                if (pa_is_error(err) && err != paInputOverflowed) {
+                        enif_mutex_unlock(res->read_lock);
+                        enif_release_binary(&bin);
+                        enif_rwlock_runlock(res->lock);
+                        Pa_Sleep(STREAM_IDLE_MSEC);
+                        continue;
+                }
+
+                _fan_out(capture, &bin, frames);
+                enif_mutex_unlock(res->read_lock);
+                enif_rwlock_runlock(res->lock);
+        }
+
+        return NULL;
+}
+
+/**
+ * Mark the thread as stopped, returning `true` if it was running. Whoever
+ * stops the thread releases the reference it was started with. Called with
+ * the subscriber lock held.
+ */
+static bool _capture_signal_stop(struct capture *capture)
+{
+        return atomic_exchange(&capture->running, false);
+}
+
+static void _capture_start(struct capture *capture)
+{
+        enif_mutex_lock(capture->thread_lock);
+
+        if (!atomic_load(&capture->running) || !capture->joinable) {
+                // Left to exit by itself when its last subscriber went down
+                if (capture->joinable) {
+                        enif_thread_join(capture->tid, NULL);
+                        capture->joinable = false;
+                }
+
+                // Marked as running first, so a bridge claiming the stream
+                // at the same time either sees it or is seen here
+                atomic_store(&capture->running, true);
+                if (bridge_is_attached(capture->res)) {
+                        atomic_store(&capture->running, false);
+                } else {
+                        enif_keep_resource(capture->res);
+                        ensure(enif_thread_create("portaudio_capture", &capture->tid,
+                                                  &_capture_thread, capture, NULL) == 0);
+                        capture->joinable = true;
+                }
+        }
+
+        enif_mutex_unlock(capture->thread_lock);
+}
+
+void capture_stop(struct erl_stream_resource *res)
+{
+        struct capture *capture = res->capture;
+        if (capture == NULL)
+                return;
+
+        enif_mutex_lock(capture->thread_lock);
+
+        enif_mutex_lock(capture->lock);
+        const bool was_running = _capture_signal_stop(capture);
+        enif_mutex_unlock(capture->lock);
+
+        if (capture->joinable) {
+                enif_thread_join(capture->tid, NULL);
+                capture->joinable = false;
+        }
+
+        enif_mutex_unlock(capture->thread_lock);
+
+        // May be the last reference, so nothing can touch the capture after
+        if (was_running)
+                enif_release_resource(res);
+}
+
+bool capture_is_running(const struct erl_stream_resource *res)
+{
+        return res->capture != NULL && atomic_load(&res->capture->running);
+}
+
+static int _find_subscriber(const struct capture *capture, const ErlNifPid *pid)
+{
+        int i;
+        for (i = 0; i < capture->n_subscribers; i++) {
+                if (enif_compare_pids(&capture->subscribers[i].pid, pid) == 0)
+                        return i;
+        }
+        return -1;
+}
+
+bool capture_subscribe(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid,
+                       ERL_NIF_TERM route, bool spectrum, unsigned int max_queue)
+{
+        struct capture *capture = res->capture;
+        assert(capture != NULL);
+
+        enif_mutex_lock(capture->lock);
+
+        int i = _find_subscriber(capture, pid);
+        if (i < 0) {
+                if (capture->n_subscribers == capture->cap_subscribers) {
+                        capture->cap_subscribers = capture->cap_subscribers * 2 + 4;
+                        capture->subscribers =
+                                enif_realloc(capture->subscribers,
+                                             sizeof(struct subscriber) * capture->cap_subscribers);
+                        ensure(capture->subscribers != NULL);
+                }
+
+                struct subscriber *sub = &capture->subscribers[capture->n_subscribers];
+                // Fails if the process has already exited
+                if (enif_monitor_process(env, res, pid, &sub->monitor) != 0) {
+                        enif_mutex_unlock(capture->lock);
+                        return false;
+                }
+
+                sub->pid = *pid;
+                sub->spectrum = false;
+                sub->in_flight = 0;
+                sub->dropped = 0;
+                i = capture->n_subscribers++;
+        }
+
+        struct subscriber *sub = &capture->subscribers[i];
+        capture->n_spectrum_subscribers += (int) spectrum - (int) sub->spectrum;
+        sub->spectrum = spectrum;
+        sub->route = spectrum ? enif_make_atom(env, "spectrum") : route;
+        sub->max_queue = max_queue;
+
+        enif_mutex_unlock(capture->lock);
+
+        _capture_start(capture);
+        return true;
+}
+
+/**
+ * Join a thread that has been signalled to stop, unless a new subscriber
+ * has started it again since.
+ */
+static void _capture_join(struct capture *capture)
+{
+        enif_mutex_lock(capture->thread_lock);
+
+        if (capture->joinable && !atomic_load(&capture->running)) {
+                enif_thread_join(capture->tid, NULL);
+                capture->joinable = false;
+        }
+
+        enif_mutex_unlock(capture->thread_lock);
+}
+
+/**
+ * Remove the subscriber with the given pid, returning the number of
+ * subscribers left or -1 if it wasn't found. Removing the last subscriber
+ * signals the thread to stop, setting `stopped` if it was running.
+ */
+static int _remove_subscriber(ErlNifEnv *env, struct capture *capture,
+                              const ErlNifPid *pid, bool demonitor, bool *stopped)
+{
+        *stopped = false;
+
+        enif_mutex_lock(capture->lock);
+
+        const int i = _find_subscriber(capture, pid);
+        if (i < 0) {
+                enif_mutex_unlock(capture->lock);
+                return -1;
+        }
+
+        if (demonitor)
+                enif_demonitor_process(env, capture->res, &capture->subscribers[i].monitor);
+        if (capture->subscribers[i].spectrum)
+                capture->n_spectrum_subscribers--;
+
+        capture->subscribers[i] = capture->subscribers[--capture->n_subscribers];
+        const int remaining = capture->n_subscribers;
+        // Under the lock, so a subscriber arriving now restarts the thread
+        if (remaining == 0)
+                *stopped = _capture_signal_stop(capture);
+
+        enif_mutex_unlock(capture->lock);
+
+        return remaining;
+}
+
+bool capture_unsubscribe(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid)
+{
+        if (res->capture == NULL)
+                return false;
+
+        bool stopped;
+        const int remaining = _remove_subscriber(env, res->capture, pid, true, &stopped);
+        if (stopped) {
+                _capture_join(res->capture);
+                enif_release_resource(res);
+        }
+
+        return remaining >= 0;
+}
+
+void capture_down(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid)
+{
+        if (res->capture == NULL)
+                return;
+
+        // Joining would block the scheduler for up to a whole read, so the
+        // thread is left to exit and joined by whoever next starts or stops
+        // it, or by the destructor
+        bool stopped;
+        _remove_subscriber(env, res->capture, pid, false, &stopped);
+        if (stopped)
+                enif_release_resource(res);
+}
+
+bool capture_ack(struct erl_stream_resource *res, const ErlNifPid *pid, unsigned int n)
+{
+        struct capture *capture = res->capture;
+        if (capture == NULL)
+                return false;
+
+        enif_mutex_lock(capture->lock);
+
+        const int i = _find_subscriber(capture, pid);
+        if (i >= 0) {
+                struct subscriber *sub = &capture->subscribers[i];
+                sub->in_flight = n > sub->in_flight ? 0 : sub->in_flight - n;
+        }
+
+        enif_mutex_unlock(capture->lock);
+
+        return i >= 0;
+}
+
+ERL_NIF_TERM capture_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res)
+{
+        struct capture *capture = res->capture;
+        assert(capture != NULL);
+
+        enif_mutex_lock(capture->lock);
+
+#define N_FIELDS 2
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "buffers", enif_make_ulong(env, capture->buffers)),
+                make_kw_item(env, "input_overflows", enif_make_ulong(env, capture->input_overflows))
+        };
+
+        enif_mutex_unlock(capture->lock);
+
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
+
+ERL_NIF_TERM capture_subscribers_to_term(ErlNifEnv *env, struct erl_stream_resource *res)
+{
+        ERL_NIF_TERM list = enif_make_list(env, 0);
+
+        struct capture *capture = res->capture;
+        if (capture == NULL)
+                return list;
+
+        enif_mutex_lock(capture->lock);
+
+        int i;
+        for (i = capture->n_subscribers - 1; i >= 0; i--) {
+                const struct subscriber *sub = &capture->subscribers[i];
+                const ERL_NIF_TERM entry =
+                        enif_make_tuple4(env,
+                                         enif_make_pid(env, &sub->pid),
+                                         sub->route,
+                                         enif_make_uint(env, sub->in_flight),
+                                         enif_make_ulong(env, sub->dropped));
+                list = enif_make_list_cell(env, entry, list);
+        }
+
+        enif_mutex_unlock(capture->lock);
+
+        return list;
+}
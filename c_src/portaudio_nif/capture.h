@@ -0,0 +1,140 @@
+#ifndef _PORTAUDIO_NIF_CAPTURE_
+#define _PORTAUDIO_NIF_CAPTURE_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "erl_nif.h"
+#include "stream.h"
+
+/**
+ * Default number of buffers a subscriber may have unacknowledged before
+ * further buffers are dropped for it.
+ */
+#define CAPTURE_DEFAULT_MAX_QUEUE 16
+
+/**
+ * A process receiving buffers from a capture thread.
+ */
+struct subscriber {
+        ErlNifPid pid;
+        ErlNifMonitor monitor;
+
+        // Name of the route to receive, or `nil` for whole frames
+        ERL_NIF_TERM route;
+        // Receives the stream's spectrum instead of its frames
+        bool spectrum;
+
+        unsigned int max_queue;
+        unsigned int in_flight;
+        unsigned long dropped;
+};
+
+/**
+ * A thread reading from an input stream and sending every buffer to each
+ * subscriber. Each buffer is a single refc binary shared by all of the
+ * messages, so the cost of a buffer doesn't grow with the subscriber count.
+ *
+ * The thread runs while there are subscribers and holds a reference to the
+ * stream resource while doing so. The reference is released as soon as the
+ * thread is signalled to stop, which may be before it has been joined.
+ */
+struct capture {
+        struct erl_stream_resource *res;
+
+        // Serializes starting and stopping the thread
+        ErlNifMutex *thread_lock;
+        ErlNifTid tid;
+        atomic_bool running;
+        bool joinable;
+
+        // Guards the subscriber list
+        ErlNifMutex *lock;
+        struct subscriber *subscribers;
+        int n_subscribers;
+        int cap_subscribers;
+
+        // Environment the shared message terms are built in
+        ErlNifEnv *msg_env;
+        // Environment each subscriber's copy of a message is sent from
+        ErlNifEnv *send_env;
+
+        // Binaries for each route of the current buffer, built on demand
+        ERL_NIF_TERM *route_terms;
+        bool *route_built;
+        int cap_routes;
+
+        // Spectrum subscribers, so the analysis is skipped without any
+        int n_spectrum_subscribers;
+
+        // Buffers read and reads that overflowed, guarded by `lock`
+        unsigned long buffers;
+        unsigned long input_overflows;
+};
+
+/**
+ * Create the capture for an input stream. The thread isn't started until
+ * the first subscriber arrives.
+ */
+struct capture *capture_create(struct erl_stream_resource *res);
+
+/**
+ * Subscribe `pid` to buffers read from the stream, starting the capture
+ * thread if needed. With `spectrum` set the subscriber is sent the
+ * stream's spectrum analyses instead, and `route` is ignored. Subscribing
+ * again updates the route, kind and queue depth. The subscriber is
+ * monitored and removed when it exits.
+ *
+ * Returns `false` if the capture thread couldn't be started.
+ */
+bool capture_subscribe(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid,
+                       ERL_NIF_TERM route, bool spectrum, unsigned int max_queue);
+
+/**
+ * Remove a subscriber, stopping the capture thread if it was the last one.
+ * Returns `false` if `pid` wasn't subscribed.
+ */
+bool capture_unsubscribe(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid);
+
+/**
+ * Remove a subscriber that has exited. Called from the resource's `down`
+ * callback, so the capture thread is only signalled to stop, and joined the
+ * next time it is started or stopped.
+ */
+void capture_down(ErlNifEnv *env, struct erl_stream_resource *res, const ErlNifPid *pid);
+
+/**
+ * Acknowledge `n` buffers received by `pid`, allowing more to be sent to
+ * it. Returns `false` if `pid` isn't subscribed.
+ */
+bool capture_ack(struct erl_stream_resource *res, const ErlNifPid *pid, unsigned int n);
+
+/**
+ * Returns `true` if the capture thread is running.
+ */
+bool capture_is_running(const struct erl_stream_resource *res);
+
+/**
+ * Stop the capture thread if it is running, waiting for it to exit, or join
+ * one that has already been signalled to stop. Subscribers are kept.
+ */
+void capture_stop(struct erl_stream_resource *res);
+
+/**
+ * Free a capture whose thread has been stopped.
+ */
+void capture_destroy(struct capture *capture);
+
+/**
+ * Returns a map of the number of buffers the capture thread has read and
+ * how many of its reads overflowed.
+ */
+ERL_NIF_TERM capture_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res);
+
+/**
+ * Returns a list of `{pid, route, in_flight, dropped}` tuples, one for each
+ * subscriber. The route of spectrum subscribers is `spectrum`.
+ */
+ERL_NIF_TERM capture_subscribers_to_term(ErlNifEnv *env, struct erl_stream_resource *res);
+
+#endif // _PORTAUDIO_NIF_CAPTURE_
@@ -0,0 +1,86 @@
+#include "coalescer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "util.h"
+
+#define USEC_PER_SEC 1000000.0
+
+void coalescer_init(struct coalescer *c, size_t frame_size, double sample_rate,
+                    double chunk_duration, double max_latency)
+{
+        assert(frame_size > 0);
+        assert(sample_rate > 0);
+
+        c->frame_size = frame_size;
+        c->sample_rate = sample_rate;
+        c->chunk_frames = lround(chunk_duration * sample_rate);
+        if (c->chunk_frames < 1)
+                c->chunk_frames = 1;
+        c->buffered_frames = 0;
+        c->max_latency_usec = (ErlNifTime) (max_latency * USEC_PER_SEC);
+        c->oldest_frame_usec = 0;
+
+        ensure(enif_alloc_binary(c->chunk_frames * frame_size, &c->chunk));
+}
+
+void coalescer_destroy(struct coalescer *c)
+{
+        enif_release_binary(&c->chunk);
+}
+
+long coalescer_space(const struct coalescer *c)
+{
+        return c->chunk_frames - c->buffered_frames;
+}
+
+unsigned char *coalescer_tail(struct coalescer *c)
+{
+        return c->chunk.data + c->buffered_frames * c->frame_size;
+}
+
+void coalescer_commit(struct coalescer *c, long frames, ErlNifTime now)
+{
+        assert(frames <= coalescer_space(c));
+
+        // The first frames of a chunk were captured before they were read,
+        // so backdate them by their own duration.
+        if (c->buffered_frames == 0 && frames > 0)
+                c->oldest_frame_usec = now - (ErlNifTime) (frames * USEC_PER_SEC / c->sample_rate);
+
+        c->buffered_frames += frames;
+}
+
+long coalescer_push(struct coalescer *c, const unsigned char *data, long frames,
+                    ErlNifTime now)
+{
+        const long space = coalescer_space(c);
+        if (frames > space)
+                frames = space;
+
+        memcpy(coalescer_tail(c), data, frames * c->frame_size);
+        coalescer_commit(c, frames, now);
+        return frames;
+}
+
+bool coalescer_ready(const struct coalescer *c, ErlNifTime now)
+{
+        if (c->buffered_frames == 0)
+                return false;
+
+        return c->buffered_frames == c->chunk_frames
+                || now - c->oldest_frame_usec >= c->max_latency_usec;
+}
+
+void coalescer_take(struct coalescer *c, ErlNifBinary *bin)
+{
+        const size_t size = c->buffered_frames * c->frame_size;
+        if (size < c->chunk.size)
+                ensure(enif_realloc_binary(&c->chunk, size));
+
+        *bin = c->chunk;
+        c->buffered_frames = 0;
+        ensure(enif_alloc_binary(c->chunk_frames * c->frame_size, &c->chunk));
+}
@@ -0,0 +1,78 @@
+#ifndef _PORTAUDIO_NIF_COALESCER_
+#define _PORTAUDIO_NIF_COALESCER_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "erl_nif.h"
+
+/**
+ * Merges or splits the buffers delivered by the host in to chunks of a
+ * fixed number of frames, handing over a partial chunk early once its
+ * oldest frame has waited for `max_latency` seconds.
+ *
+ * Frames are written straight in to the binary that is eventually handed
+ * over, so delivering a chunk doesn't copy it.
+ */
+struct coalescer {
+        ErlNifBinary chunk;
+
+        size_t frame_size;
+        double sample_rate;
+
+        long chunk_frames;
+        long buffered_frames;
+
+        ErlNifTime max_latency_usec;
+        ErlNifTime oldest_frame_usec;
+};
+
+/**
+ * Initialize a coalescer delivering `chunk_duration` seconds of audio at
+ * a time.
+ */
+void coalescer_init(struct coalescer *c, size_t frame_size, double sample_rate,
+                    double chunk_duration, double max_latency);
+
+/**
+ * Free any memory held by the coalescer.
+ */
+void coalescer_destroy(struct coalescer *c);
+
+/**
+ * Returns the number of frames that can be added before the current chunk
+ * is full.
+ */
+long coalescer_space(const struct coalescer *c);
+
+/**
+ * Returns a pointer to where the next frames should be written.
+ */
+unsigned char *coalescer_tail(struct coalescer *c);
+
+/**
+ * Mark `frames` frames written to `coalescer_tail` as buffered. `now` is
+ * the current monotonic time in microseconds.
+ */
+void coalescer_commit(struct coalescer *c, long frames, ErlNifTime now);
+
+/**
+ * Copy `frames` frames from `data` in to the coalescer. Returns the number
+ * of frames copied, which is limited by `coalescer_space`.
+ */
+long coalescer_push(struct coalescer *c, const unsigned char *data, long frames,
+                    ErlNifTime now);
+
+/**
+ * Returns `true` if a full chunk is buffered or if the oldest buffered
+ * frame has exceeded the maximum latency.
+ */
+bool coalescer_ready(const struct coalescer *c, ErlNifTime now);
+
+/**
+ * Hand over the buffered frames as a binary owned by the caller, starting
+ * a new chunk.
+ */
+void coalescer_take(struct coalescer *c, ErlNifBinary *bin);
+
+#endif // _PORTAUDIO_NIF_COALESCER_
@@ -10,9 +10,11 @@
 ERL_NIF_TERM erli_str_to_binary(ErlNifEnv *env, const char *str)
 {
         ERL_NIF_TERM binary;
-        char *str_raw = (char *) enif_make_new_binary(env, strlen(str), &binary);
+        const size_t len = strlen(str);
+        char *str_raw = (char *) enif_make_new_binary(env, len, &binary);
         ensure(str_raw!= NULL);
-        strcpy(str_raw, str);
+        // The binary has no room for the terminating NUL
+        memcpy(str_raw, str, len);
         return binary;
 }
 
@@ -0,0 +1,207 @@
+#include "generator.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Returns the next uniformly distributed sample in [-1.0, 1.0), using
+ * xorshift64*.
+ */
+static float _random(struct generator *g)
+{
+        g->rng ^= g->rng >> 12;
+        g->rng ^= g->rng << 25;
+        g->rng ^= g->rng >> 27;
+        const uint64_t r = g->rng * 0x2545F4914F6CDD1DULL;
+        return (float) ((r >> 40) * (2.0 / (1ULL << 24)) - 1.0);
+}
+
+/**
+ * Filter white noise to pink, using Paul Kellet's refined method.
+ */
+static float _pink(struct pink_state *p, float white)
+{
+        float *b = p->b;
+        b[0] = 0.99886f * b[0] + white * 0.0555179f;
+        b[1] = 0.99332f * b[1] + white * 0.0750759f;
+        b[2] = 0.96900f * b[2] + white * 0.1538520f;
+        b[3] = 0.86650f * b[3] + white * 0.3104856f;
+        b[4] = 0.55000f * b[4] + white * 0.5329522f;
+        b[5] = -0.7616f * b[5] - white * 0.0168980f;
+        const float pink = b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + white * 0.5362f;
+        b[6] = white * 0.115926f;
+
+        // Brings the filter's gain of around 9 back to full scale
+        return pink * 0.11f;
+}
+
+static bool _get_number(ErlNifEnv *env, ERL_NIF_TERM term, double *value)
+{
+        long integer;
+        if (enif_get_double(env, term, value))
+                return true;
+        if (enif_get_long(env, term, &integer)) {
+                *value = (double) integer;
+                return true;
+        }
+        return false;
+}
+
+static bool _valid_frequency(double hz, double sample_rate)
+{
+        return hz > 0.0 && hz < sample_rate / 2.0;
+}
+
+static bool _parse(ErlNifEnv *env, ERL_NIF_TERM term, struct generator *g)
+{
+        if (enif_compare(term, enif_make_atom(env, "silence")) == 0) {
+                g->type = GENERATOR_SILENCE;
+                return true;
+        }
+
+        int arity;
+        const ERL_NIF_TERM *tuple;
+        double amplitude, duration;
+        if (!enif_get_tuple(env, term, &arity, &tuple)
+            || arity < 2
+            || !_get_number(env, tuple[arity - 1], &amplitude)
+            || amplitude < 0.0
+            || amplitude > 1.0) {
+                return false;
+        }
+        g->amplitude = (float) amplitude;
+
+        const ERL_NIF_TERM type = tuple[0];
+        if (arity == 3 && enif_compare(type, enif_make_atom(env, "sine")) == 0) {
+                g->type = GENERATOR_SINE;
+                return _get_number(env, tuple[1], &g->frequency)
+                        && _valid_frequency(g->frequency, g->sample_rate);
+        }
+
+        if (arity == 2 && enif_compare(type, enif_make_atom(env, "white_noise")) == 0) {
+                g->type = GENERATOR_WHITE_NOISE;
+                return true;
+        }
+
+        if (arity == 2 && enif_compare(type, enif_make_atom(env, "pink_noise")) == 0) {
+                g->type = GENERATOR_PINK_NOISE;
+                g->pink = enif_alloc(sizeof(struct pink_state) * g->channels);
+                ensure(g->pink != NULL);
+                memset(g->pink, 0, sizeof(struct pink_state) * g->channels);
+                return true;
+        }
+
+        if (arity == 5 && enif_compare(type, enif_make_atom(env, "sweep")) == 0) {
+                g->type = GENERATOR_SWEEP;
+                if (!_get_number(env, tuple[1], &g->frequency)
+                    || !_get_number(env, tuple[2], &g->end_frequency)
+                    || !_get_number(env, tuple[3], &duration)) {
+                        return false;
+                }
+
+                // Bounded before converting, so the frame count can't
+                // overflow, and must come to at least a frame
+                if (!_valid_frequency(g->frequency, g->sample_rate)
+                    || !_valid_frequency(g->end_frequency, g->sample_rate)
+                    || !(duration * g->sample_rate >= 1.0
+                         && duration < LONG_MAX / g->sample_rate)) {
+                        return false;
+                }
+                g->sweep_frames = (long) (duration * g->sample_rate);
+
+                g->sweep_ratio = pow(g->end_frequency / g->frequency, 1.0 / g->sweep_frames);
+                g->sweep_frequency = g->frequency;
+                return true;
+        }
+
+        return false;
+}
+
+struct generator *generator_from_term(ErlNifEnv *env, ERL_NIF_TERM term, int channels,
+                                      double sample_rate)
+{
+        struct generator *g = enif_alloc(sizeof(*g));
+        ensure(g != NULL);
+        memset(g, 0, sizeof(*g));
+
+        g->channels = channels;
+        g->sample_rate = sample_rate;
+        g->rng = 0x9E3779B97F4A7C15ULL;
+
+        if (!_parse(env, term, g)) {
+                generator_destroy(g);
+                return NULL;
+        }
+
+        return g;
+}
+
+void generator_destroy(struct generator *g)
+{
+        if (g->pink != NULL)
+                enif_free(g->pink);
+        enif_free(g);
+}
+
+void generator_mix(struct generator *g, float *out, long frames)
+{
+        const int channels = g->channels;
+        const float amplitude = g->amplitude;
+        long f;
+        int c;
+
+        switch (g->type) {
+        case GENERATOR_SINE: {
+                const double step = g->frequency / g->sample_rate;
+                for (f = 0; f < frames; f++) {
+                        const float s = amplitude * (float) sin(2.0 * M_PI * g->phase);
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] += s;
+                        g->phase += step;
+                        if (g->phase >= 1.0)
+                                g->phase -= 1.0;
+                }
+                break;
+        }
+        case GENERATOR_SWEEP:
+                for (f = 0; f < frames; f++) {
+                        const float s = amplitude * (float) sin(2.0 * M_PI * g->phase);
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] += s;
+
+                        // The phase carries on when the sweep restarts, so it
+                        // doesn't click
+                        g->phase += g->sweep_frequency / g->sample_rate;
+                        if (g->phase >= 1.0)
+                                g->phase -= 1.0;
+
+                        g->sweep_frequency *= g->sweep_ratio;
+                        if (++g->position == g->sweep_frames) {
+                                g->position = 0;
+                                g->sweep_frequency = g->frequency;
+                        }
+                }
+                break;
+        case GENERATOR_WHITE_NOISE:
+                for (f = 0; f < frames * channels; f++)
+                        out[f] += amplitude * _random(g);
+                break;
+        case GENERATOR_PINK_NOISE:
+                for (f = 0; f < frames; f++) {
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] += amplitude * _pink(&g->pink[c], _random(g));
+                }
+                break;
+        case GENERATOR_SILENCE:
+        default:
+                break;
+        }
+}
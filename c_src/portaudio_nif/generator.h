@@ -0,0 +1,73 @@
+#ifndef _PORTAUDIO_NIF_GENERATOR_
+#define _PORTAUDIO_NIF_GENERATOR_
+
+#include <stdint.h>
+
+#include "erl_nif.h"
+
+enum generator_type {
+        GENERATOR_SILENCE,
+        GENERATOR_SINE,
+        GENERATOR_WHITE_NOISE,
+        GENERATOR_PINK_NOISE,
+        // Exponential sine sweep, restarting once it reaches the end
+        GENERATOR_SWEEP
+};
+
+/**
+ * Filter state for each channel of pink noise.
+ */
+struct pink_state {
+        float b[7];
+};
+
+/**
+ * A test signal synthesized on the playback thread. Tones are the same on
+ * every channel, while noise is independent per channel.
+ */
+struct generator {
+        enum generator_type type;
+        int channels;
+        double sample_rate;
+        float amplitude;
+
+        // Tone frequency, or the start and end of a sweep
+        double frequency;
+        double end_frequency;
+        // Length of a sweep in frames, and the change in frequency per frame
+        long sweep_frames;
+        double sweep_ratio;
+
+        // Phase in cycles, and the frequency and position within the
+        // current sweep
+        double phase;
+        double sweep_frequency;
+        long position;
+
+        uint64_t rng;
+        struct pink_state *pink;
+};
+
+/**
+ * Parse a generator from one of `silence`, `{sine, frequency, amplitude}`,
+ * `{white_noise, amplitude}`, `{pink_noise, amplitude}` or
+ * `{sweep, from, to, duration, amplitude}`.
+ *
+ * Returns `NULL` if the term is invalid, or a frequency is outside of
+ * (0, nyquist).
+ */
+struct generator *generator_from_term(ErlNifEnv *env, ERL_NIF_TERM term, int channels,
+                                      double sample_rate);
+
+/**
+ * Free a generator created by `generator_from_term`.
+ */
+void generator_destroy(struct generator *g);
+
+/**
+ * Add the next `frames` frames of the signal to the interleaved frames in
+ * `out`.
+ */
+void generator_mix(struct generator *g, float *out, long frames);
+
+#endif // _PORTAUDIO_NIF_GENERATOR_
@@ -0,0 +1,431 @@
+#include "jitter_buffer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "erl_interop.h"
+#include "util.h"
+
+/**
+ * Number of times the last packet is repeated while fading it out.
+ */
+#define JITTER_REPEAT_PACKETS 2
+
+/**
+ * Multiple of the measured jitter kept buffered on top of one packet.
+ */
+#define JITTER_DEPTH_FACTOR 4.0
+
+/**
+ * Consecutive late packets after which the sender is assumed to have
+ * restarted its sequence numbers.
+ */
+#define JITTER_RESYNC_LATE 8
+
+/**
+ * How far behind a late packet can be before the sender is assumed to have
+ * restarted its sequence numbers. Reordering can't take a packet further
+ * back than the buffer holds.
+ */
+#define JITTER_RESYNC_DISTANCE JITTER_MAX_PACKETS
+
+/**
+ * Signed distance from sequence number `b` to `a`, allowing for wrap around.
+ */
+static int32_t _seq_diff(uint32_t a, uint32_t b)
+{
+        return (int32_t) (a - b);
+}
+
+void jitter_buffer_init(struct jitter_buffer *j, int channels, double sample_rate,
+                        double min_depth, double max_depth,
+                        enum jitter_concealment concealment)
+{
+        memset(j, 0, sizeof(*j));
+
+        j->channels = channels;
+        j->sample_rate = sample_rate;
+        j->concealment = concealment;
+        j->min_depth_frames = min_depth * sample_rate;
+        j->max_depth_frames = max_depth * sample_rate;
+        j->target_frames = j->min_depth_frames;
+        j->resume_gain = 1.0f;
+}
+
+void jitter_buffer_destroy(struct jitter_buffer *j)
+{
+        int i;
+        for (i = 0; i < j->n_packets; i++)
+                enif_free(j->packets[i].data);
+        j->n_packets = 0;
+
+        enif_safe_free(j->current.data);
+        enif_safe_free(j->last.data);
+}
+
+static void _drop_oldest(struct jitter_buffer *j)
+{
+        j->buffered_frames -= j->packets[0].frames;
+        enif_free(j->packets[0].data);
+        memmove(&j->packets[0], &j->packets[1], sizeof(struct jitter_packet) * --j->n_packets);
+}
+
+/**
+ * Update the jitter estimate and the target depth from a packet's arrival.
+ */
+static void _update_jitter(struct jitter_buffer *j, uint32_t timestamp, long frames,
+                           ErlNifTime now)
+{
+        const double arrival = now * j->sample_rate / 1e6;
+
+        if (j->have_arrival) {
+                const double d = (arrival - j->last_arrival)
+                        - _seq_diff(timestamp, j->last_timestamp);
+                j->jitter += (fabs(d) - j->jitter) / 16.0;
+        }
+        j->have_arrival = true;
+        j->last_arrival = arrival;
+        j->last_timestamp = timestamp;
+
+        double target = frames + JITTER_DEPTH_FACTOR * j->jitter;
+        if (target < j->min_depth_frames)
+                target = j->min_depth_frames;
+        if (target > j->max_depth_frames)
+                target = j->max_depth_frames;
+        j->target_frames = target;
+}
+
+/**
+ * Give up on the packets waiting to be played and continue from `seq`.
+ */
+static void _resync(struct jitter_buffer *j, uint32_t seq)
+{
+        while (j->n_packets > 0) {
+                _drop_oldest(j);
+                j->stats.dropped++;
+        }
+
+        j->next_seq = seq;
+        j->late_run = 0;
+        j->conceal_remaining = 0;
+        // Timestamps restart along with the sequence numbers
+        j->have_arrival = false;
+        j->stats.resyncs++;
+}
+
+bool jitter_buffer_push(struct jitter_buffer *j, uint32_t seq, uint32_t timestamp,
+                        float *data, long frames, ErlNifTime now)
+{
+        if (j->started) {
+                const int32_t diff = _seq_diff(seq, j->next_seq);
+                if (diff < 0 && diff > -JITTER_RESYNC_DISTANCE
+                    && ++j->late_run < JITTER_RESYNC_LATE) {
+                        j->stats.late++;
+                        enif_free(data);
+                        return false;
+                }
+
+                if (diff < 0)
+                        _resync(j, seq);
+                else
+                        j->late_run = 0;
+        }
+
+        // Packets are sorted, so search from the newest
+        int i = j->n_packets;
+        while (i > 0 && _seq_diff(j->packets[i - 1].seq, seq) > 0)
+                i--;
+        if (i > 0 && j->packets[i - 1].seq == seq) {
+                enif_free(data);
+                return false;
+        }
+
+        if (j->n_packets == JITTER_MAX_PACKETS) {
+                j->stats.dropped++;
+                if (i == 0) {
+                        enif_free(data);
+                        return false;
+                }
+                _drop_oldest(j);
+                i--;
+        }
+
+        const struct jitter_packet packet = {
+                .seq = seq,
+                .timestamp = timestamp,
+                .frames = frames,
+                .data = data
+        };
+
+        memmove(&j->packets[i + 1], &j->packets[i],
+                sizeof(struct jitter_packet) * (j->n_packets - i));
+        j->packets[i] = packet;
+        j->n_packets++;
+        j->buffered_frames += frames;
+
+        j->stats.received++;
+        _update_jitter(j, timestamp, frames, now);
+
+        // Play out from the earliest packet seen before starting
+        if (!j->started)
+                j->next_seq = j->packets[0].seq;
+
+        return true;
+}
+
+/**
+ * Fill `out` with `frames` frames standing in for missing audio.
+ */
+static void _conceal(struct jitter_buffer *j, float *out, long frames)
+{
+        const int channels = j->channels;
+
+        if (!j->concealing) {
+                j->concealing = true;
+                j->conceal_offset = 0;
+                j->conceal_gain = 1.0f;
+        }
+
+        const struct jitter_packet *last = &j->last;
+        long f;
+        int c;
+
+        if (last->data == NULL || j->concealment == JITTER_CONCEAL_SILENCE) {
+                memset(out, 0, sizeof(float) * frames * channels);
+                j->conceal_gain = 0.0f;
+        } else if (j->concealment == JITTER_CONCEAL_REPEAT) {
+                const float step = 1.0f / (last->frames * JITTER_REPEAT_PACKETS);
+                for (f = 0; f < frames; f++) {
+                        const float *frame = last->data + j->conceal_offset * channels;
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] = frame[c] * j->conceal_gain;
+
+                        j->conceal_offset = (j->conceal_offset + 1) % last->frames;
+                        j->conceal_gain = j->conceal_gain > step ? j->conceal_gain - step : 0.0f;
+                }
+        } else {
+                const float step = 1.0f / JITTER_FADE_FRAMES;
+                const float *frame = last->data + (last->frames - 1) * channels;
+                for (f = 0; f < frames; f++) {
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] = frame[c] * j->conceal_gain;
+                        j->conceal_gain = j->conceal_gain > step ? j->conceal_gain - step : 0.0f;
+                }
+        }
+
+        j->stats.concealed_frames += frames;
+}
+
+/**
+ * Fade in from wherever concealment left off once audio resumes.
+ */
+static void _resume(struct jitter_buffer *j, float gain)
+{
+        j->concealing = false;
+        j->resume_gain = gain;
+        j->resume_frames = JITTER_FADE_FRAMES;
+}
+
+/**
+ * Copy up to `frames` frames of the current packet to `out`, returning the
+ * number copied.
+ */
+static long _play(struct jitter_buffer *j, float *out, long frames)
+{
+        const int channels = j->channels;
+        const long available = j->current.frames - j->current_offset;
+        const long n = frames < available ? frames : available;
+        const float *in = j->current.data + j->current_offset * channels;
+
+        memcpy(out, in, sizeof(float) * n * channels);
+
+        long f;
+        int c;
+        for (f = 0; f < n && j->resume_frames > 0; f++, j->resume_frames--) {
+                const float t = (float) (JITTER_FADE_FRAMES - j->resume_frames) / JITTER_FADE_FRAMES;
+                const float gain = j->resume_gain + (1.0f - j->resume_gain) * t;
+                for (c = 0; c < channels; c++)
+                        out[f * channels + c] *= gain;
+        }
+
+        // Fade out the end of a packet whose successor is to be dropped
+        if (j->drop_next) {
+                const long fade = j->current.frames < JITTER_FADE_FRAMES
+                        ? j->current.frames
+                        : JITTER_FADE_FRAMES;
+                const long start = j->current.frames - fade;
+                for (f = start > j->current_offset ? start - j->current_offset : 0; f < n; f++) {
+                        const long remaining = j->current.frames - (j->current_offset + f) - 1;
+                        const float gain = (float) remaining / fade;
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] *= gain;
+                }
+        }
+
+        j->current_offset += n;
+        if (j->current_offset == j->current.frames) {
+                // Keep the finished packet around for concealment
+                enif_safe_free(j->last.data);
+                j->last = j->current;
+                j->current.data = NULL;
+
+                // Whatever plays next fades in from the silence faded out to
+                if (j->drop_next) {
+                        j->concealing = true;
+                        j->conceal_offset = 0;
+                        j->conceal_gain = 0.0f;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * Returns `true` if the next packet in sequence has arrived and far more is
+ * buffered than the target depth, so it should be dropped.
+ */
+static bool _too_deep(const struct jitter_buffer *j)
+{
+        return j->n_packets > 0
+                && j->packets[0].seq == j->next_seq
+                && j->buffered_frames > j->target_frames + 2 * j->packets[0].frames;
+}
+
+/**
+ * Start playing the next packet in sequence. Packets are only dropped
+ * after one that was faded out in anticipation, so dropping never cuts the
+ * audio off. Returns `false` if the next packet hasn't arrived.
+ */
+static bool _next_packet(struct jitter_buffer *j)
+{
+        const bool dropping = j->drop_next;
+        j->drop_next = false;
+
+        while (dropping && _too_deep(j)) {
+                _drop_oldest(j);
+                j->next_seq++;
+                j->stats.dropped++;
+        }
+
+        if (j->n_packets == 0 || j->packets[0].seq != j->next_seq)
+                return false;
+
+        j->current = j->packets[0];
+        j->current_offset = 0;
+        j->next_seq++;
+        j->buffered_frames -= j->current.frames;
+        memmove(&j->packets[0], &j->packets[1], sizeof(struct jitter_packet) * --j->n_packets);
+
+        j->drop_next = _too_deep(j);
+        return true;
+}
+
+void jitter_buffer_pull(struct jitter_buffer *j, float *out, long frames)
+{
+        const int channels = j->channels;
+
+        if (!j->started) {
+                if (j->n_packets == 0 || j->buffered_frames < j->target_frames) {
+                        memset(out, 0, sizeof(float) * frames * channels);
+                        return;
+                }
+                j->started = true;
+        }
+
+        if (j->rebuffering) {
+                if (j->buffered_frames < j->target_frames) {
+                        _conceal(j, out, frames);
+                        return;
+                }
+                j->rebuffering = false;
+        }
+
+        long done = 0;
+        while (done < frames) {
+                float *dest = out + done * channels;
+                const long wanted = frames - done;
+
+                if (j->current.data != NULL) {
+                        done += _play(j, dest, wanted);
+                        continue;
+                }
+
+                if (j->conceal_remaining > 0) {
+                        const long n = wanted < j->conceal_remaining ? wanted : j->conceal_remaining;
+                        _conceal(j, dest, n);
+                        j->conceal_remaining -= n;
+                        done += n;
+                        continue;
+                }
+
+                if (_next_packet(j)) {
+                        if (j->concealing)
+                                _resume(j, j->conceal_gain);
+                        continue;
+                }
+
+                // A later packet is waiting, so give the missing ones up as
+                // lost once enough is buffered behind them, standing in for
+                // them for as long as they would have played
+                if (j->n_packets > 0 && j->buffered_frames >= j->target_frames) {
+                        const int32_t missing = _seq_diff(j->packets[0].seq, j->next_seq);
+                        const long packet_frames = j->last.data != NULL
+                                ? j->last.frames
+                                : j->packets[0].frames;
+                        double conceal = (double) missing * packet_frames;
+                        if (conceal > j->target_frames)
+                                conceal = j->target_frames;
+
+                        j->stats.lost += missing;
+                        j->next_seq = j->packets[0].seq;
+                        j->conceal_remaining = (long) conceal;
+                        continue;
+                }
+
+                // Ran dry, so stretch out what we have until the buffer is
+                // back at the target depth
+                _conceal(j, dest, wanted);
+                done += wanted;
+                j->rebuffering = true;
+        }
+}
+
+bool jitter_concealment_from_atom(ErlNifEnv *env, ERL_NIF_TERM atom,
+                                  enum jitter_concealment *concealment)
+{
+        if (enif_compare(atom, enif_make_atom(env, "repeat")) == 0)
+                *concealment = JITTER_CONCEAL_REPEAT;
+        else if (enif_compare(atom, enif_make_atom(env, "fade")) == 0)
+                *concealment = JITTER_CONCEAL_FADE;
+        else if (enif_compare(atom, enif_make_atom(env, "silence")) == 0)
+                *concealment = JITTER_CONCEAL_SILENCE;
+        else
+                return false;
+
+        return true;
+}
+
+ERL_NIF_TERM jitter_buffer_stats_to_term(ErlNifEnv *env, const struct jitter_buffer *j)
+{
+        const long current_frames = j->current.data != NULL
+                ? j->current.frames - j->current_offset
+                : 0;
+        const double rate = j->sample_rate;
+
+#define N_FIELDS 10
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "depth", enif_make_double(env, (j->buffered_frames + current_frames) / rate)),
+                make_kw_item(env, "target_depth", enif_make_double(env, j->target_frames / rate)),
+                make_kw_item(env, "jitter", enif_make_double(env, j->jitter / rate)),
+                make_kw_item(env, "packets", enif_make_int(env, j->n_packets)),
+                make_kw_item(env, "received", enif_make_ulong(env, j->stats.received)),
+                make_kw_item(env, "late", enif_make_ulong(env, j->stats.late)),
+                make_kw_item(env, "lost", enif_make_ulong(env, j->stats.lost)),
+                make_kw_item(env, "dropped", enif_make_ulong(env, j->stats.dropped)),
+                make_kw_item(env, "resyncs", enif_make_ulong(env, j->stats.resyncs)),
+                make_kw_item(env, "concealed_frames", enif_make_ulong(env, j->stats.concealed_frames))
+        };
+
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
@@ -0,0 +1,145 @@
+#ifndef _PORTAUDIO_NIF_JITTER_BUFFER_
+#define _PORTAUDIO_NIF_JITTER_BUFFER_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "erl_nif.h"
+
+/**
+ * Largest number of packets held at once. The oldest packet is dropped when
+ * a new one arrives while full.
+ */
+#define JITTER_MAX_PACKETS 256
+
+/**
+ * Frames used to fade out before a dropped packet, and back in after it or
+ * after concealment.
+ */
+#define JITTER_FADE_FRAMES 64
+
+/**
+ * How gaps left by missing packets are filled.
+ */
+enum jitter_concealment {
+        // Repeat the last packet, fading it out
+        JITTER_CONCEAL_REPEAT,
+        // Fade the last frame out to silence
+        JITTER_CONCEAL_FADE,
+        JITTER_CONCEAL_SILENCE
+};
+
+struct jitter_packet {
+        uint32_t seq;
+        uint32_t timestamp;
+        long frames;
+        float *data;
+};
+
+struct jitter_stats {
+        unsigned long received;
+        unsigned long late;
+        unsigned long lost;
+        unsigned long dropped;
+        unsigned long resyncs;
+        unsigned long concealed_frames;
+};
+
+/**
+ * Reorders sequence numbered packets and plays them out at a depth adapted
+ * to the measured arrival jitter, concealing gaps left by missing packets.
+ *
+ * Sequence numbers and timestamps wrap around like RTP's. Timestamps are in
+ * frames and only used to measure jitter.
+ */
+struct jitter_buffer {
+        int channels;
+        double sample_rate;
+        enum jitter_concealment concealment;
+
+        double min_depth_frames;
+        double max_depth_frames;
+        double target_frames;
+
+        // Packets waiting to be played, sorted by sequence number
+        struct jitter_packet packets[JITTER_MAX_PACKETS];
+        int n_packets;
+        long buffered_frames;
+
+        // Whether playout has started, and whether it has run dry since and
+        // is waiting to get back to the target depth
+        bool started;
+        bool rebuffering;
+        uint32_t next_seq;
+        // Late packets in a row, to detect the sender restarting
+        int late_run;
+
+        // Packet being played and how far through it we are
+        struct jitter_packet current;
+        long current_offset;
+        // Whether the current packet is being faded out so the one after
+        // it can be dropped
+        bool drop_next;
+
+        // Last packet played, kept for concealment
+        struct jitter_packet last;
+        bool concealing;
+        long conceal_offset;
+        float conceal_gain;
+        // Frames still to conceal for packets given up as lost
+        long conceal_remaining;
+        // Gain to fade in from when audio resumes
+        float resume_gain;
+        long resume_frames;
+
+        // Interarrival jitter estimate in frames, as in RFC 3550
+        double jitter;
+        bool have_arrival;
+        double last_arrival;
+        uint32_t last_timestamp;
+
+        struct jitter_stats stats;
+};
+
+/**
+ * Initialize a jitter buffer keeping between `min_depth` and `max_depth`
+ * seconds of audio buffered.
+ */
+void jitter_buffer_init(struct jitter_buffer *j, int channels, double sample_rate,
+                        double min_depth, double max_depth,
+                        enum jitter_concealment concealment);
+
+/**
+ * Free all packets held by the jitter buffer.
+ */
+void jitter_buffer_destroy(struct jitter_buffer *j);
+
+/**
+ * Add a packet of `frames` interleaved float frames, taking ownership of
+ * `data`, which must have been allocated with `enif_alloc`. `now` is the
+ * arrival time in monotonic microseconds.
+ *
+ * Returns `false`, freeing `data`, if the packet arrived too late to be
+ * played or is a duplicate. A run of late packets, or one far behind, is
+ * taken as the sender restarting, and playout continues from it instead.
+ */
+bool jitter_buffer_push(struct jitter_buffer *j, uint32_t seq, uint32_t timestamp,
+                        float *data, long frames, ErlNifTime now);
+
+/**
+ * Fill `out` with `frames` frames, concealing anything that is missing.
+ */
+void jitter_buffer_pull(struct jitter_buffer *j, float *out, long frames);
+
+/**
+ * Parse a concealment mode from an erlang atom.
+ */
+bool jitter_concealment_from_atom(ErlNifEnv *env, ERL_NIF_TERM atom,
+                                  enum jitter_concealment *concealment);
+
+/**
+ * Returns a map of statistics about the jitter buffer.
+ */
+ERL_NIF_TERM jitter_buffer_stats_to_term(ErlNifEnv *env, const struct jitter_buffer *j);
+
+#endif // _PORTAUDIO_NIF_JITTER_BUFFER_
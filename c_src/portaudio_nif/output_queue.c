@@ -0,0 +1,201 @@
+#include "output_queue.h"
+
+#include <string.h>
+
+#include "erl_interop.h"
+#include "realtime.h"
+#include "util.h"
+
+void output_queue_init(struct output_queue *q, int channels, long capacity,
+                       enum underrun_policy policy)
+{
+        memset(q, 0, sizeof(*q));
+
+        q->channels = channels;
+        q->policy = policy;
+        q->capacity = capacity;
+        q->ring = realtime_alloc(sizeof(float) * capacity * channels);
+        q->recent = realtime_alloc(sizeof(float) * OUTPUT_QUEUE_REPEAT_FRAMES * channels);
+        ensure(q->ring != NULL && q->recent != NULL);
+        q->resume_gain = 1.0f;
+}
+
+void output_queue_destroy(struct output_queue *q)
+{
+        realtime_free(q->ring);
+        realtime_free(q->recent);
+}
+
+long output_queue_space(const struct output_queue *q)
+{
+        return q->capacity - q->frames;
+}
+
+long output_queue_push(struct output_queue *q, const float *data, long frames)
+{
+        const int channels = q->channels;
+        const long space = output_queue_space(q);
+        const long n = frames < space ? frames : space;
+
+        // Copy in up to two pieces, the second wrapping to the start
+        const long tail = (q->head + q->frames) % q->capacity;
+        const long first = n < q->capacity - tail ? n : q->capacity - tail;
+        memcpy(q->ring + tail * channels, data, sizeof(float) * first * channels);
+        memcpy(q->ring, data + first * channels, sizeof(float) * (n - first) * channels);
+
+        q->frames += n;
+        if (n > 0)
+                q->started = true;
+
+        return n;
+}
+
+/**
+ * Remember the last frames played, for replaying them on underrun.
+ */
+static void _remember(struct output_queue *q, const float *data, long frames)
+{
+        const int channels = q->channels;
+
+        if (frames >= OUTPUT_QUEUE_REPEAT_FRAMES) {
+                memcpy(q->recent, data + (frames - OUTPUT_QUEUE_REPEAT_FRAMES) * channels,
+                       sizeof(float) * OUTPUT_QUEUE_REPEAT_FRAMES * channels);
+                q->recent_frames = OUTPUT_QUEUE_REPEAT_FRAMES;
+                return;
+        }
+
+        long keep = OUTPUT_QUEUE_REPEAT_FRAMES - frames;
+        if (keep > q->recent_frames)
+                keep = q->recent_frames;
+
+        memmove(q->recent, q->recent + (q->recent_frames - keep) * channels,
+                sizeof(float) * keep * channels);
+        memcpy(q->recent + keep * channels, data, sizeof(float) * frames * channels);
+        q->recent_frames = keep + frames;
+}
+
+/**
+ * Copy up to `frames` frames out of the queue, fading in if audio is
+ * resuming. Returns the number of frames copied.
+ */
+static long _take(struct output_queue *q, float *out, long frames)
+{
+        const int channels = q->channels;
+        const long n = frames < q->frames ? frames : q->frames;
+
+        const long first = n < q->capacity - q->head ? n : q->capacity - q->head;
+        memcpy(out, q->ring + q->head * channels, sizeof(float) * first * channels);
+        memcpy(out + first * channels, q->ring, sizeof(float) * (n - first) * channels);
+
+        q->head = (q->head + n) % q->capacity;
+        q->frames -= n;
+
+        long f;
+        int c;
+        for (f = 0; f < n && q->resume_frames > 0; f++, q->resume_frames--) {
+                const float t = (float) (OUTPUT_QUEUE_FADE_FRAMES - q->resume_frames)
+                        / OUTPUT_QUEUE_FADE_FRAMES;
+                const float gain = q->resume_gain + (1.0f - q->resume_gain) * t;
+                for (c = 0; c < channels; c++)
+                        out[f * channels + c] *= gain;
+        }
+
+        _remember(q, out, n);
+        return n;
+}
+
+/**
+ * Fill `out` with `frames` frames standing in for audio that wasn't
+ * written in time.
+ */
+static void _conceal(struct output_queue *q, float *out, long frames)
+{
+        const int channels = q->channels;
+
+        if (!q->underrun) {
+                q->underrun = true;
+                q->underruns++;
+                q->conceal_offset = 0;
+                q->conceal_gain = 1.0f;
+        }
+
+        long f;
+        int c;
+
+        if (q->recent_frames == 0 || q->policy == UNDERRUN_SILENCE) {
+                memset(out, 0, sizeof(float) * frames * channels);
+                q->conceal_gain = 0.0f;
+        } else if (q->policy == UNDERRUN_REPEAT) {
+                const float step = 1.0f / (q->recent_frames * OUTPUT_QUEUE_REPEAT_TIMES);
+                for (f = 0; f < frames; f++) {
+                        const float *frame = q->recent + q->conceal_offset * channels;
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] = frame[c] * q->conceal_gain;
+
+                        q->conceal_offset = (q->conceal_offset + 1) % q->recent_frames;
+                        q->conceal_gain = q->conceal_gain > step ? q->conceal_gain - step : 0.0f;
+                }
+        } else {
+                const float step = 1.0f / OUTPUT_QUEUE_FADE_FRAMES;
+                const float *frame = q->recent + (q->recent_frames - 1) * channels;
+                for (f = 0; f < frames; f++) {
+                        for (c = 0; c < channels; c++)
+                                out[f * channels + c] = frame[c] * q->conceal_gain;
+                        q->conceal_gain = q->conceal_gain > step ? q->conceal_gain - step : 0.0f;
+                }
+        }
+
+        q->concealed_frames += frames;
+}
+
+void output_queue_pull(struct output_queue *q, float *out, long frames)
+{
+        const int channels = q->channels;
+
+        if (!q->started) {
+                memset(out, 0, sizeof(float) * frames * channels);
+                return;
+        }
+
+        // Fade back in from wherever concealment left off, except after
+        // plain silence, which the writer may be relying on being exact
+        if (q->underrun && q->frames > 0) {
+                q->underrun = false;
+                if (q->policy != UNDERRUN_SILENCE) {
+                        q->resume_gain = q->conceal_gain;
+                        q->resume_frames = OUTPUT_QUEUE_FADE_FRAMES;
+                }
+        }
+
+        const long n = _take(q, out, frames);
+        if (n < frames)
+                _conceal(q, out + n * channels, frames - n);
+}
+
+bool underrun_policy_from_atom(ErlNifEnv *env, ERL_NIF_TERM atom, enum underrun_policy *policy)
+{
+        if (enif_compare(atom, enif_make_atom(env, "silence")) == 0)
+                *policy = UNDERRUN_SILENCE;
+        else if (enif_compare(atom, enif_make_atom(env, "repeat")) == 0)
+                *policy = UNDERRUN_REPEAT;
+        else if (enif_compare(atom, enif_make_atom(env, "fade")) == 0)
+                *policy = UNDERRUN_FADE;
+        else
+                return false;
+
+        return true;
+}
+
+ERL_NIF_TERM output_queue_stats_to_term(ErlNifEnv *env, const struct output_queue *q,
+                                        double sample_rate)
+{
+#define N_FIELDS 4
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "queued", enif_make_double(env, q->frames / sample_rate)),
+                make_kw_item(env, "capacity", enif_make_double(env, q->capacity / sample_rate)),
+                make_kw_item(env, "underruns", enif_make_ulong(env, q->underruns)),
+                make_kw_item(env, "concealed_frames", enif_make_ulong(env, q->concealed_frames))
+        };
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
@@ -0,0 +1,103 @@
+#ifndef _PORTAUDIO_NIF_OUTPUT_QUEUE_
+#define _PORTAUDIO_NIF_OUTPUT_QUEUE_
+
+#include <stdbool.h>
+
+#include "erl_nif.h"
+
+/**
+ * Frames used to fade out with `UNDERRUN_FADE`, and to fade back in once
+ * audio resumes.
+ */
+#define OUTPUT_QUEUE_FADE_FRAMES 64
+
+/**
+ * Frames of recent audio kept for `UNDERRUN_REPEAT`, which is replayed
+ * this many times over while fading out.
+ */
+#define OUTPUT_QUEUE_REPEAT_FRAMES 1024
+#define OUTPUT_QUEUE_REPEAT_TIMES 4
+
+/**
+ * How the output is filled when the queue runs dry.
+ */
+enum underrun_policy {
+        UNDERRUN_SILENCE,
+        // Replay the most recent audio, fading it out
+        UNDERRUN_REPEAT,
+        // Fade the last frame out to silence
+        UNDERRUN_FADE
+};
+
+/**
+ * A bounded queue of interleaved float frames written to an output stream,
+ * which covers for the writer falling behind according to its underrun
+ * policy.
+ */
+struct output_queue {
+        int channels;
+        enum underrun_policy policy;
+
+        float *ring;
+        long capacity;
+        long head;
+        long frames;
+
+        // Whether anything has been written yet, as running dry before then
+        // isn't an underrun
+        bool started;
+
+        // The most recent frames played, oldest first
+        float *recent;
+        long recent_frames;
+
+        bool underrun;
+        long conceal_offset;
+        float conceal_gain;
+        float resume_gain;
+        long resume_frames;
+
+        unsigned long underruns;
+        unsigned long concealed_frames;
+};
+
+/**
+ * Initialize a queue holding up to `capacity` frames.
+ */
+void output_queue_init(struct output_queue *q, int channels, long capacity,
+                       enum underrun_policy policy);
+
+/**
+ * Free the memory held by the queue.
+ */
+void output_queue_destroy(struct output_queue *q);
+
+/**
+ * Returns the number of frames that can be pushed without blocking.
+ */
+long output_queue_space(const struct output_queue *q);
+
+/**
+ * Add up to `frames` frames to the queue, returning the number added.
+ */
+long output_queue_push(struct output_queue *q, const float *data, long frames);
+
+/**
+ * Take `frames` frames from the queue in to `out`, filling any shortfall
+ * according to the underrun policy.
+ */
+void output_queue_pull(struct output_queue *q, float *out, long frames);
+
+/**
+ * Parse an underrun policy from one of the atoms `silence`, `repeat` or
+ * `fade`.
+ */
+bool underrun_policy_from_atom(ErlNifEnv *env, ERL_NIF_TERM atom, enum underrun_policy *policy);
+
+/**
+ * Returns a map of queue statistics.
+ */
+ERL_NIF_TERM output_queue_stats_to_term(ErlNifEnv *env, const struct output_queue *q,
+                                        double sample_rate);
+
+#endif // _PORTAUDIO_NIF_OUTPUT_QUEUE_
@@ -181,8 +181,10 @@ bool pa_stream_params_from_tuple(ErlNifEnv *env, ERL_NIF_TERM term, PaStreamPara
         params->device = device;
         params->channelCount = channel_count;
 
-        if (!pa_sample_format_from_atom(env, tuple[2], &params->sampleFormat))
+        if (!pa_sample_format_from_atom(env, tuple[2], &params->sampleFormat)) {
+                enif_free(params);
                 return false;
+        }
 
         params->suggestedLatency = suggested_latency;
         params->hostApiSpecificStreamInfo = NULL;
@@ -207,6 +209,20 @@ bool pa_sample_format_from_atom(ErlNifEnv *env, ERL_NIF_TERM sample_atom, PaSamp
         return false;
 }
 
+ERL_NIF_TERM pa_sample_format_to_term(ErlNifEnv *env, PaSampleFormat sample_format)
+{
+        struct sample_format_to_str *cur = &pa_sample_formats[0];
+        ensure(cur != NULL);
+
+        while (cur->str != NULL) {
+                if (cur->fmt == sample_format)
+                        return enif_make_atom(env, cur->str);
+                cur++;
+        }
+
+        return erli_make_nil(env);
+}
+
 static PaStreamFlags _atom_to_stream_flags(ErlNifEnv *env, ERL_NIF_TERM term)
 {
         struct stream_flags_to_str *cur = &pa_stream_flags[0];
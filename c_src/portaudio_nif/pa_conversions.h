@@ -39,6 +39,12 @@ bool pa_stream_params_from_tuple(ErlNifEnv *env, ERL_NIF_TERM term, PaStreamPara
  */
 bool pa_sample_format_from_atom(ErlNifEnv *env, ERL_NIF_TERM sample_atom, PaSampleFormat *sample_format);
 
+/**
+ * Convert a PortAudio sample format to an erlang atom, or `nil` if the
+ * format is unknown.
+ */
+ERL_NIF_TERM pa_sample_format_to_term(ErlNifEnv *env, PaSampleFormat sample_format);
+
 /**
  * Convert an erlang list to a stream flags for PortAudio. Returns `true`
  * on success, `false` otherwise.
@@ -0,0 +1,533 @@
+#include "playback.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "bridge.h"
+#include "erl_interop.h"
+#include "pa_conversions.h"
+#include "realtime.h"
+#include "samples.h"
+#include "util.h"
+
+/**
+ * Frames written at a time when the stream doesn't have a fixed host
+ * buffer size.
+ */
+#define PLAYBACK_DEFAULT_FRAMES 256
+
+/**
+ * Largest number of frames converted at a time when writing to the queue.
+ */
+#define PLAYBACK_CONVERT_FRAMES 4096
+
+struct playback *playback_create(struct erl_stream_resource *res)
+{
+        struct playback *playback = enif_alloc(sizeof(*playback));
+        ensure(playback != NULL);
+        memset(playback, 0, sizeof(*playback));
+
+        playback->res = res;
+        atomic_init(&playback->running, false);
+        playback->joinable = false;
+
+        playback->thread_lock = enif_mutex_create("portaudio_playback_thread_lock");
+        ensure(playback->thread_lock != NULL);
+        playback->lock = enif_mutex_create("portaudio_playback_lock");
+        ensure(playback->lock != NULL);
+        playback->queue_space = enif_cond_create("portaudio_playback_queue_space");
+        ensure(playback->queue_space != NULL);
+
+        playback->chunk_frames = res->frames_per_buffer != 0
+                ? (long) res->frames_per_buffer
+                : PLAYBACK_DEFAULT_FRAMES;
+        const size_t samples = playback->chunk_frames * res->output_channels;
+        playback->mix = realtime_alloc(sizeof(float) * samples);
+        playback->source = realtime_alloc(sizeof(float) * samples);
+        playback->out = realtime_alloc(playback->chunk_frames * res->output_frame_size);
+        ensure(playback->mix != NULL && playback->source != NULL && playback->out != NULL);
+
+        return playback;
+}
+
+void playback_destroy(struct playback *playback)
+{
+        assert(!playback->joinable);
+
+        if (playback->jitter != NULL) {
+                jitter_buffer_destroy(playback->jitter);
+                enif_free(playback->jitter);
+        }
+
+        if (playback->queue != NULL) {
+                output_queue_destroy(playback->queue);
+                enif_free(playback->queue);
+        }
+
+        if (playback->generator != NULL)
+                generator_destroy(playback->generator);
+
+        if (playback->schedule != NULL) {
+                schedule_destroy(playback->schedule);
+                enif_free(playback->schedule);
+        }
+
+        enif_mutex_destroy(playback->thread_lock);
+        enif_mutex_destroy(playback->lock);
+        enif_cond_destroy(playback->queue_space);
+        realtime_free(playback->mix);
+        realtime_free(playback->source);
+        realtime_free(playback->out);
+        enif_free(playback);
+}
+
+/**
+ * Fill the mix buffer with the next chunk from every source.
+ */
+static void _mix(struct playback *playback)
+{
+        const long frames = playback->chunk_frames;
+        const long samples = frames * playback->res->output_channels;
+        float *mix = playback->mix;
+        float *source = playback->source;
+        long i;
+
+        memset(mix, 0, sizeof(float) * samples);
+
+        enif_mutex_lock(playback->lock);
+
+        if (playback->jitter != NULL) {
+                jitter_buffer_pull(playback->jitter, source, frames);
+                for (i = 0; i < samples; i++)
+                        mix[i] += source[i];
+        }
+
+        if (playback->queue != NULL) {
+                output_queue_pull(playback->queue, source, frames);
+                for (i = 0; i < samples; i++)
+                        mix[i] += source[i];
+                enif_cond_broadcast(playback->queue_space);
+        }
+
+        if (playback->generator != NULL)
+                generator_mix(playback->generator, mix, frames);
+
+        if (playback->schedule != NULL) {
+                // The chunk is heard once everything already written has
+                // been played
+                const PaStreamInfo *info = Pa_GetStreamInfo(playback->res->stream);
+                if (info != NULL) {
+                        schedule_anchor(playback->schedule,
+                                        Pa_GetStreamTime(playback->res->stream)
+                                        + info->outputLatency);
+                }
+                schedule_mix(playback->schedule, mix, frames);
+        }
+
+        enif_mutex_unlock(playback->lock);
+}
+
+static void *_playback_thread(void *arg)
+{
+        struct playback *playback = arg;
+        struct erl_stream_resource *res = playback->res;
+
+        realtime_enter_thread("playback");
+
+        while (atomic_load(&playback->running)) {
+                enif_rwlock_rlock(res->lock);
+
+                if (res->stream == NULL) {
+                        enif_rwlock_runlock(res->lock);
+                        break;
+                }
+
+                if (Pa_IsStreamActive(res->stream) != 1) {
+                        enif_rwlock_runlock(res->lock);
+
+                        // Nothing is pulled from the queue, so writes waiting
+                        // on it must check for themselves whether the stream
+                        // has stopped
+                        enif_mutex_lock(playback->lock);
+                        enif_cond_broadcast(playback->queue_space);
+                        enif_mutex_unlock(playback->lock);
+
+                        Pa_Sleep(STREAM_IDLE_MSEC);
+                        continue;
+                }
+
+                _mix(playback);
+                samples_from_float(res->output_format, playback->mix, playback->out,
+                                   playback->chunk_frames * res->output_channels);
+
+                // Blocks until there is room, which paces the thread
+                const PaError err = Pa_WriteStream(res->stream, playback->out,
+                                                   playback->chunk_frames);
+                enif_rwlock_runlock(res->lock);
+
+                if (err == paOutputUnderflowed) {
+                        enif_mutex_lock(playback->lock);
+                        playback->output_underflows++;
+                        // Time has passed without frames being played
+                        if (playback->schedule != NULL)
+                                schedule_reset_anchor(playback->schedule);
+                        enif_mutex_unlock(playback->lock);
+                } else if (pa_is_error(err)) {
+                        Pa_Sleep(STREAM_IDLE_MSEC);
+                }
+        }
+
+        return NULL;
+}
+
+static void _playback_start(struct playback *playback)
+{
+        enif_mutex_lock(playback->thread_lock);
+
+        if (!atomic_load(&playback->running) || !playback->joinable) {
+                // The thread may have exited by itself after the stream closed
+                if (playback->joinable) {
+                        enif_thread_join(playback->tid, NULL);
+                        playback->joinable = false;
+                }
+
+                // As for capture, a bridge claiming the stream at the same
+                // time either sees the thread running or is seen here
+                atomic_store(&playback->running, true);
+                if (bridge_is_attached(playback->res)) {
+                        atomic_store(&playback->running, false);
+                } else {
+                        ensure(enif_thread_create("portaudio_playback", &playback->tid,
+                                                  &_playback_thread, playback, NULL) == 0);
+                        playback->joinable = true;
+                }
+        }
+
+        enif_mutex_unlock(playback->thread_lock);
+}
+
+void playback_stop(struct erl_stream_resource *res)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return;
+
+        enif_mutex_lock(playback->thread_lock);
+
+        if (playback->joinable) {
+                atomic_store(&playback->running, false);
+
+                // Nothing will make room for writes waiting on the queue
+                enif_mutex_lock(playback->lock);
+                enif_cond_broadcast(playback->queue_space);
+                enif_mutex_unlock(playback->lock);
+
+                enif_thread_join(playback->tid, NULL);
+                playback->joinable = false;
+        }
+
+        enif_mutex_unlock(playback->thread_lock);
+}
+
+bool playback_is_running(const struct erl_stream_resource *res)
+{
+        return res->playback != NULL && atomic_load(&res->playback->running);
+}
+
+/**
+ * Start the playback thread if there are any sources, or stop it if not.
+ */
+static void _update_thread(struct erl_stream_resource *res)
+{
+        struct playback *playback = res->playback;
+
+        enif_mutex_lock(playback->lock);
+        const bool has_sources = playback->jitter != NULL
+                || playback->queue != NULL
+                || playback->generator != NULL
+                || playback->schedule != NULL;
+        enif_mutex_unlock(playback->lock);
+
+        if (has_sources)
+                _playback_start(playback);
+        else
+                playback_stop(res);
+}
+
+void playback_set_jitter_buffer(struct erl_stream_resource *res, struct jitter_buffer *jitter)
+{
+        struct playback *playback = res->playback;
+        assert(playback != NULL);
+
+        enif_mutex_lock(playback->lock);
+        struct jitter_buffer *old = playback->jitter;
+        playback->jitter = jitter;
+        enif_mutex_unlock(playback->lock);
+
+        if (old != NULL) {
+                jitter_buffer_destroy(old);
+                enif_free(old);
+        }
+
+        _update_thread(res);
+}
+
+void playback_set_queue(struct erl_stream_resource *res, struct output_queue *queue)
+{
+        struct playback *playback = res->playback;
+        assert(playback != NULL);
+
+        enif_mutex_lock(playback->lock);
+        struct output_queue *old = playback->queue;
+        playback->queue = queue;
+        enif_cond_broadcast(playback->queue_space);
+        enif_mutex_unlock(playback->lock);
+
+        // Waiting writers only compare against the old queue, never use it
+        if (old != NULL) {
+                output_queue_destroy(old);
+                enif_free(old);
+        }
+
+        _update_thread(res);
+}
+
+void playback_set_generator(struct erl_stream_resource *res, struct generator *generator)
+{
+        struct playback *playback = res->playback;
+        assert(playback != NULL);
+
+        enif_mutex_lock(playback->lock);
+        struct generator *old = playback->generator;
+        playback->generator = generator;
+        enif_mutex_unlock(playback->lock);
+
+        if (old != NULL)
+                generator_destroy(old);
+
+        _update_thread(res);
+}
+
+void playback_set_schedule(struct erl_stream_resource *res, struct schedule *schedule)
+{
+        struct playback *playback = res->playback;
+        assert(playback != NULL);
+
+        enif_mutex_lock(playback->lock);
+        struct schedule *old = playback->schedule;
+        playback->schedule = schedule;
+        enif_mutex_unlock(playback->lock);
+
+        if (old != NULL) {
+                schedule_destroy(old);
+                enif_free(old);
+        }
+
+        _update_thread(res);
+}
+
+/**
+ * Convert a clip or packet in the stream's sample format to floats. Callers
+ * convert before taking the playback lock, and the write queue converts
+ * with it released, to keep the playback thread waiting as little as
+ * possible.
+ */
+static float *_to_float(const struct erl_stream_resource *res, const ErlNifBinary *bin,
+                        long *frames)
+{
+        *frames = bin->size / res->output_frame_size;
+        float *data = enif_alloc(sizeof(float) * *frames * res->output_channels + 1);
+        ensure(data != NULL);
+        samples_to_float(res->output_format, bin->data, data, *frames * res->output_channels);
+        return data;
+}
+
+int playback_schedule(struct erl_stream_resource *res, const ErlNifBinary *clip, long start,
+                      const double *time, long crossfade, long *started)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return -1;
+
+        long frames;
+        float *data = _to_float(res, clip, &frames);
+
+        enif_mutex_lock(playback->lock);
+
+        int ret = -1;
+        if (playback->schedule != NULL) {
+                if (crossfade > playback->schedule->max_frames)
+                        ret = -3;
+                else if (time != NULL && !schedule_frame_at(playback->schedule, *time, &start))
+                        ret = -2;
+                else
+                        ret = schedule_add(playback->schedule, data, frames, start, crossfade,
+                                           started);
+        }
+
+        enif_mutex_unlock(playback->lock);
+
+        if (ret != SCHEDULE_OK)
+                enif_free(data);
+
+        return ret;
+}
+
+ERL_NIF_TERM playback_schedule_info_to_term(ErlNifEnv *env, struct erl_stream_resource *res)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return erli_make_nil(env);
+
+        enif_mutex_lock(playback->lock);
+
+        ERL_NIF_TERM ret = erli_make_nil(env);
+        if (playback->schedule != NULL) {
+                ret = schedule_info_to_term(env, playback->schedule);
+                enif_make_map_put(env, ret, enif_make_atom(env, "output_underflows"),
+                                  enif_make_ulong(env, playback->output_underflows), &ret);
+        }
+
+        enif_mutex_unlock(playback->lock);
+
+        return ret;
+}
+
+int playback_queue_write(struct erl_stream_resource *res, const unsigned char *data,
+                         long frames, bool block, long *written_out)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return -1;
+
+        const int channels = res->output_channels;
+        const long convert_frames = frames < PLAYBACK_CONVERT_FRAMES
+                ? frames
+                : PLAYBACK_CONVERT_FRAMES;
+        float *converted = NULL;
+        long written = 0;
+        int ret = QUEUE_WRITE_OK;
+
+        enif_mutex_lock(playback->lock);
+
+        struct output_queue *queue = playback->queue;
+        if (queue == NULL) {
+                enif_mutex_unlock(playback->lock);
+                return -1;
+        }
+
+        while (written < frames) {
+                long n = output_queue_space(queue);
+                if (n == 0) {
+                        if (!block)
+                                break;
+                        if (!atomic_load(&playback->running)) {
+                                ret = QUEUE_WRITE_CLOSING;
+                                break;
+                        }
+                        if (Pa_IsStreamActive(res->stream) != 1) {
+                                ret = QUEUE_WRITE_STOPPED;
+                                break;
+                        }
+
+                        enif_cond_wait(playback->queue_space, playback->lock);
+                        if (playback->queue != queue) {
+                                ret = QUEUE_WRITE_REMOVED;
+                                break;
+                        }
+                        continue;
+                }
+
+                if (n > frames - written)
+                        n = frames - written;
+                if (n > convert_frames)
+                        n = convert_frames;
+
+                // Released while converting, as for `_to_float`
+                enif_mutex_unlock(playback->lock);
+                if (converted == NULL) {
+                        converted = enif_alloc(sizeof(float) * convert_frames * channels);
+                        ensure(converted != NULL);
+                }
+                samples_to_float(res->output_format, data + written * res->output_frame_size,
+                                 converted, n * channels);
+                enif_mutex_lock(playback->lock);
+
+                if (playback->queue != queue) {
+                        ret = QUEUE_WRITE_REMOVED;
+                        break;
+                }
+                written += output_queue_push(queue, converted, n);
+        }
+
+        enif_mutex_unlock(playback->lock);
+
+        enif_safe_free(converted);
+        *written_out = written;
+        return ret;
+}
+
+ERL_NIF_TERM playback_queue_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return erli_make_nil(env);
+
+        enif_mutex_lock(playback->lock);
+
+        ERL_NIF_TERM ret = erli_make_nil(env);
+        if (playback->queue != NULL) {
+                ret = output_queue_stats_to_term(env, playback->queue, res->sample_rate);
+                enif_make_map_put(env, ret, enif_make_atom(env, "output_underflows"),
+                                  enif_make_ulong(env, playback->output_underflows), &ret);
+        }
+
+        enif_mutex_unlock(playback->lock);
+
+        return ret;
+}
+
+int playback_jitter_push(struct erl_stream_resource *res, uint32_t seq, uint32_t timestamp,
+                         const ErlNifBinary *packet)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return -1;
+
+        long frames;
+        float *data = _to_float(res, packet, &frames);
+
+        const ErlNifTime now = enif_monotonic_time(ERL_NIF_USEC);
+
+        enif_mutex_lock(playback->lock);
+
+        int ret = -1;
+        if (playback->jitter != NULL)
+                ret = jitter_buffer_push(playback->jitter, seq, timestamp, data, frames, now);
+        else
+                enif_free(data);
+
+        enif_mutex_unlock(playback->lock);
+
+        return ret;
+}
+
+ERL_NIF_TERM playback_jitter_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res)
+{
+        struct playback *playback = res->playback;
+        if (playback == NULL)
+                return erli_make_nil(env);
+
+        enif_mutex_lock(playback->lock);
+
+        ERL_NIF_TERM ret = erli_make_nil(env);
+        if (playback->jitter != NULL) {
+                ret = jitter_buffer_stats_to_term(env, playback->jitter);
+                enif_make_map_put(env, ret, enif_make_atom(env, "output_underflows"),
+                                  enif_make_ulong(env, playback->output_underflows), &ret);
+        }
+
+        enif_mutex_unlock(playback->lock);
+
+        return ret;
+}
@@ -0,0 +1,175 @@
+#ifndef _PORTAUDIO_NIF_PLAYBACK_
+#define _PORTAUDIO_NIF_PLAYBACK_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "erl_nif.h"
+#include "generator.h"
+#include "jitter_buffer.h"
+#include "output_queue.h"
+#include "schedule.h"
+#include "stream.h"
+
+/**
+ * Most audio in seconds a write queue may hold, bounding the buffer it
+ * allocates up front.
+ */
+#define PLAYBACK_MAX_QUEUE 300.0
+
+/**
+ * Outcome of writing to a write queue, once there was one to write to.
+ */
+enum queue_write_result {
+        // Every frame was queued, or as many as fit without blocking
+        QUEUE_WRITE_OK,
+        // The queue was removed while waiting for space
+        QUEUE_WRITE_REMOVED,
+        // The queue is full and the stream is stopped, so it won't drain
+        QUEUE_WRITE_STOPPED,
+        // The playback thread stopped as the stream is closing
+        QUEUE_WRITE_CLOSING
+};
+
+/**
+ * Feeds an output stream from native sources on its own thread, so audio
+ * keeps flowing without a process writing every buffer in time. Every
+ * source attached is mixed together.
+ *
+ * Unlike the capture thread, the playback thread holds no reference to the
+ * stream resource, so a stream dropped with sources still attached is
+ * garbage collected as usual and its destructor stops the thread.
+ */
+struct playback {
+        struct erl_stream_resource *res;
+
+        // Serializes starting and stopping the thread
+        ErlNifMutex *thread_lock;
+        ErlNifTid tid;
+        atomic_bool running;
+        bool joinable;
+
+        // Guards the sources and statistics below
+        ErlNifMutex *lock;
+        // Signalled whenever the write queue has been pulled from or removed
+        ErlNifCond *queue_space;
+
+        // Sources of audio, each `NULL` if not attached
+        struct jitter_buffer *jitter;
+        struct output_queue *queue;
+        struct generator *generator;
+        struct schedule *schedule;
+
+        unsigned long output_underflows;
+
+        long chunk_frames;
+        float *mix;
+        float *source;
+        unsigned char *out;
+};
+
+/**
+ * Create the playback state for an output stream. The thread isn't
+ * started until a source is attached.
+ */
+struct playback *playback_create(struct erl_stream_resource *res);
+
+/**
+ * Free the playback state. The thread must not be running.
+ */
+void playback_destroy(struct playback *playback);
+
+/**
+ * Stop the playback thread, waiting for it to exit. Must not be called
+ * while holding the stream lock, and must be called before the stream
+ * resource is freed.
+ */
+void playback_stop(struct erl_stream_resource *res);
+
+/**
+ * Returns whether the playback thread owns the stream's writes.
+ */
+bool playback_is_running(const struct erl_stream_resource *res);
+
+/**
+ * Replace the stream's jitter buffer, taking ownership of `jitter`, and
+ * start or stop the playback thread to match. Passing `NULL` removes it.
+ * Must not be called while holding the stream lock.
+ */
+void playback_set_jitter_buffer(struct erl_stream_resource *res, struct jitter_buffer *jitter);
+
+/**
+ * Replace the stream's write queue, taking ownership of `queue`, and start
+ * or stop the playback thread to match. While attached, writes go to the
+ * queue instead of the stream. Passing `NULL` removes it, failing any
+ * writes waiting for space. Must not be called while holding the stream
+ * lock.
+ */
+void playback_set_queue(struct erl_stream_resource *res, struct output_queue *queue);
+
+/**
+ * Replace the stream's generator, taking ownership of `generator`, and
+ * start or stop the playback thread to match. Passing `NULL` removes it.
+ * Must not be called while holding the stream lock.
+ */
+void playback_set_generator(struct erl_stream_resource *res, struct generator *generator);
+
+/**
+ * Replace the stream's schedule, taking ownership of `schedule`, and start
+ * or stop the playback thread to match. Passing `NULL` removes it, dropping
+ * everything scheduled. Must not be called while holding the stream lock.
+ */
+void playback_set_schedule(struct erl_stream_resource *res, struct schedule *schedule);
+
+/**
+ * Add a clip in the stream's sample format to its schedule, starting at
+ * frame `start`, or at the stream time `*time` if given. Both `start` and
+ * `crossfade` are as for `schedule_add`.
+ *
+ * Returns `-1` if the stream has no schedule, `-2` if `time` can't be
+ * converted until the schedule has started playing, `-3` if `crossfade` is
+ * longer than the schedule can hold, otherwise a `schedule_result`.
+ */
+int playback_schedule(struct erl_stream_resource *res, const ErlNifBinary *clip, long start,
+                      const double *time, long crossfade, long *started);
+
+/**
+ * Returns a map describing the schedule, or `nil` if the stream has no
+ * schedule.
+ */
+ERL_NIF_TERM playback_schedule_info_to_term(ErlNifEnv *env, struct erl_stream_resource *res);
+
+/**
+ * Add up to `frames` frames in the stream's sample format to its write
+ * queue, setting `written` to the number queued. With `block` set, waits
+ * for space until every frame is queued, the queue is removed or the
+ * stream stops. Must be called holding the stream lock for reading.
+ *
+ * Returns `-1` if the stream has no write queue, otherwise a
+ * `queue_write_result`.
+ */
+int playback_queue_write(struct erl_stream_resource *res, const unsigned char *data,
+                         long frames, bool block, long *written);
+
+/**
+ * Returns a map of write queue statistics, or `nil` if the stream has no
+ * write queue.
+ */
+ERL_NIF_TERM playback_queue_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res);
+
+/**
+ * Add a packet in the stream's sample format to its jitter buffer.
+ *
+ * Returns `-1` if the stream has no jitter buffer, otherwise whether the
+ * packet was accepted.
+ */
+int playback_jitter_push(struct erl_stream_resource *res, uint32_t seq, uint32_t timestamp,
+                         const ErlNifBinary *packet);
+
+/**
+ * Returns a map of jitter buffer statistics, or `nil` if the stream has no
+ * jitter buffer.
+ */
+ERL_NIF_TERM playback_jitter_stats_to_term(ErlNifEnv *env, struct erl_stream_resource *res);
+
+#endif // _PORTAUDIO_NIF_PLAYBACK_
@@ -0,0 +1,281 @@
+// For CPU affinity, which has no portable interface
+#define _GNU_SOURCE
+
+#include "realtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "erl_interop.h"
+#include "util.h"
+
+/**
+ * Highest CPU index that can be pinned to.
+ */
+#define REALTIME_MAX_CPUS 1024
+
+/**
+ * Bytes in front of each buffer from `realtime_alloc`, keeping the buffer
+ * itself aligned for any type.
+ */
+#define REALTIME_HEADER_SIZE 16
+
+/**
+ * State of each setting in `realtime_status`, or a negated `errno` on
+ * failure.
+ */
+#define REALTIME_DISABLED 0
+#define REALTIME_PENDING 1
+#define REALTIME_OK 2
+
+struct realtime_config {
+        int policy;
+        int priority;
+
+        bool pin;
+        unsigned char cpus[REALTIME_MAX_CPUS / 8];
+
+        bool lock_memory;
+};
+
+struct realtime_status {
+        atomic_int priority;
+        atomic_int affinity;
+        atomic_int lock_memory;
+};
+
+union realtime_header {
+        struct {
+                size_t size;
+                bool mapped;
+        } info;
+        unsigned char pad[REALTIME_HEADER_SIZE];
+};
+
+// Only written by `on_load`, before any thread could read it
+static struct realtime_config config;
+static struct realtime_status status;
+
+static bool _get_cpus(ErlNifEnv *env, ERL_NIF_TERM list)
+{
+        ERL_NIF_TERM head;
+        int cpu;
+
+        if (!enif_is_list(env, list))
+                return false;
+
+        while (enif_get_list_cell(env, list, &head, &list)) {
+                if (!enif_get_int(env, head, &cpu) || cpu < 0 || cpu >= REALTIME_MAX_CPUS)
+                        return false;
+                config.cpus[cpu / 8] |= 1 << (cpu % 8);
+                config.pin = true;
+        }
+
+        return config.pin;
+}
+
+static bool _get_option(ErlNifEnv *env, ERL_NIF_TERM map, const char *key, ERL_NIF_TERM *value)
+{
+        return enif_get_map_value(env, map, enif_make_atom(env, key), value)
+                && !erli_is_nil(env, *value);
+}
+
+bool realtime_init(ErlNifEnv *env, ERL_NIF_TERM load_info)
+{
+        ERL_NIF_TERM value;
+
+        memset(&config, 0, sizeof(config));
+        config.policy = SCHED_FIFO;
+        atomic_init(&status.priority, REALTIME_DISABLED);
+        atomic_init(&status.affinity, REALTIME_DISABLED);
+        atomic_init(&status.lock_memory, REALTIME_DISABLED);
+
+        if (!enif_is_map(env, load_info))
+                return true;
+
+        if (_get_option(env, load_info, "policy", &value)) {
+                if (enif_compare(value, enif_make_atom(env, "rr")) == 0)
+                        config.policy = SCHED_RR;
+                else if (enif_compare(value, enif_make_atom(env, "fifo")) != 0)
+                        return false;
+        }
+
+        if (_get_option(env, load_info, "priority", &value)) {
+                if (!enif_get_int(env, value, &config.priority)
+                    || config.priority < 1
+                    || config.priority > 99) {
+                        return false;
+                }
+                atomic_store(&status.priority, REALTIME_PENDING);
+        }
+
+        if (_get_option(env, load_info, "cpus", &value)) {
+                if (!_get_cpus(env, value))
+                        return false;
+                atomic_store(&status.affinity, REALTIME_PENDING);
+        }
+
+        if (_get_option(env, load_info, "lock_memory", &value)) {
+                config.lock_memory = enif_compare(value, enif_make_atom(env, "true")) == 0;
+                if (config.lock_memory)
+                        atomic_store(&status.lock_memory, REALTIME_PENDING);
+                else if (enif_compare(value, enif_make_atom(env, "false")) != 0)
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * Record the result of applying a setting. The first failure sticks, and is
+ * logged, so it isn't hidden by a later success or repeated by every thread.
+ */
+static void _record(atomic_int *state, int err, const char *what, const char *name)
+{
+        if (err == 0) {
+                int expected = REALTIME_PENDING;
+                atomic_compare_exchange_strong(state, &expected, REALTIME_OK);
+                return;
+        }
+
+        if (atomic_exchange(state, -err) >= 0) {
+                log_error("portaudio: failed to set %s for %s thread: %s\n",
+                          what, name, strerror(err));
+        }
+}
+
+static int _set_affinity(void)
+{
+#ifdef __linux__
+        cpu_set_t set;
+        int cpu;
+
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < REALTIME_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+                if (config.cpus[cpu / 8] & (1 << (cpu % 8)))
+                        CPU_SET(cpu, &set);
+        }
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        return ENOTSUP;
+#endif
+}
+
+void realtime_enter_thread(const char *name)
+{
+        if (config.priority > 0) {
+                struct sched_param param;
+                memset(&param, 0, sizeof(param));
+                param.sched_priority = config.priority;
+
+                _record(&status.priority,
+                        pthread_setschedparam(pthread_self(), config.policy, &param),
+                        "real-time priority", name);
+        }
+
+        if (config.pin)
+                _record(&status.affinity, _set_affinity(), "CPU affinity", name);
+}
+
+void *realtime_alloc(size_t size)
+{
+        union realtime_header *header;
+        const size_t total = size + REALTIME_HEADER_SIZE;
+
+        if (!config.lock_memory) {
+                header = enif_alloc(total);
+                if (header == NULL)
+                        return NULL;
+                header->info.size = total;
+                header->info.mapped = false;
+                return (unsigned char *) header + REALTIME_HEADER_SIZE;
+        }
+
+        // Mapped separately so locking whole pages doesn't reach in to
+        // memory belonging to anything else
+        const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        const size_t mapped = (total + page - 1) / page * page;
+        header = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (header == MAP_FAILED)
+                return NULL;
+
+        if (mlock(header, mapped) == 0) {
+                _record(&status.lock_memory, 0, "locked memory", "native audio");
+        } else {
+                _record(&status.lock_memory, errno, "locked memory", "native audio");
+                // Still fault every page in now, rather than on the audio
+                // thread
+                memset(header, 0, mapped);
+        }
+
+        header->info.size = mapped;
+        header->info.mapped = true;
+        return (unsigned char *) header + REALTIME_HEADER_SIZE;
+}
+
+void realtime_free(void *ptr)
+{
+        if (ptr == NULL)
+                return;
+
+        union realtime_header *header =
+                (union realtime_header *) ((unsigned char *) ptr - REALTIME_HEADER_SIZE);
+
+        if (header->info.mapped)
+                munmap(header, header->info.size);
+        else
+                enif_free(header);
+}
+
+static ERL_NIF_TERM _errno_to_atom(ErlNifEnv *env, int err)
+{
+        switch (err) {
+        case EPERM:
+                return enif_make_atom(env, "eperm");
+        case EINVAL:
+                return enif_make_atom(env, "einval");
+        case ENOMEM:
+                return enif_make_atom(env, "enomem");
+        case EAGAIN:
+                return enif_make_atom(env, "eagain");
+        case ENOTSUP:
+                return enif_make_atom(env, "enotsup");
+        default:
+                return enif_make_atom(env, "unknown");
+        }
+}
+
+static ERL_NIF_TERM _state_to_term(ErlNifEnv *env, atomic_int *state)
+{
+        const int value = atomic_load(state);
+
+        switch (value) {
+        case REALTIME_DISABLED:
+                return enif_make_atom(env, "disabled");
+        case REALTIME_PENDING:
+                return enif_make_atom(env, "pending");
+        case REALTIME_OK:
+                return enif_make_atom(env, "ok");
+        default:
+                return enif_make_tuple2(env, enif_make_atom(env, "error"),
+                                        _errno_to_atom(env, -value));
+        }
+}
+
+ERL_NIF_TERM realtime_status_to_term(ErlNifEnv *env)
+{
+#define N_FIELDS 3
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "priority", _state_to_term(env, &status.priority)),
+                make_kw_item(env, "affinity", _state_to_term(env, &status.affinity)),
+                make_kw_item(env, "lock_memory", _state_to_term(env, &status.lock_memory))
+        };
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
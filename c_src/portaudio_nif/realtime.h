@@ -0,0 +1,48 @@
+#ifndef _PORTAUDIO_NIF_REALTIME_
+#define _PORTAUDIO_NIF_REALTIME_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "erl_nif.h"
+
+/**
+ * Read the real-time settings for native audio threads from the `load_info`
+ * given to `on_load`. Anything other than a map leaves every setting off.
+ *
+ * The map may contain:
+ *
+ *   - `priority`: a scheduling priority from 1 to 99, or `nil`
+ *   - `policy`: either `fifo` or `rr`, defaulting to `fifo`
+ *   - `cpus`: a list of CPUs to pin threads to, or `nil`
+ *   - `lock_memory`: whether to lock thread buffers in to memory
+ *
+ * Returns `false` if the settings are invalid.
+ */
+bool realtime_init(ErlNifEnv *env, ERL_NIF_TERM load_info);
+
+/**
+ * Apply the configured priority and CPU affinity to the calling thread.
+ * Called first thing by every native audio thread. Failures are logged once
+ * and kept for `realtime_status_to_term`, but the thread carries on as is.
+ */
+void realtime_enter_thread(const char *name);
+
+/**
+ * Allocate a buffer used by a native audio thread, locked in to memory if
+ * configured so it is never paged out. Must be freed with `realtime_free`.
+ */
+void *realtime_alloc(size_t size);
+
+/**
+ * Free a buffer allocated by `realtime_alloc`.
+ */
+void realtime_free(void *ptr);
+
+/**
+ * Returns a map with the state of each setting, one of `disabled`, `pending`
+ * until first used, `ok` or `{error, reason}`.
+ */
+ERL_NIF_TERM realtime_status_to_term(ErlNifEnv *env);
+
+#endif // _PORTAUDIO_NIF_REALTIME_
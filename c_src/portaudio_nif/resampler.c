@@ -0,0 +1,89 @@
+#include "resampler.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "erl_nif.h"
+#include "util.h"
+
+void resampler_init(struct resampler *r, int channels, double input_rate, double output_rate)
+{
+        assert(channels > 0);
+        assert(input_rate > 0 && output_rate > 0);
+
+        r->channels = channels;
+        r->step = input_rate / output_rate;
+        // Starts on the last history frame, which is silence
+        r->position = RESAMPLER_HISTORY - 2;
+        r->buffer_frames = RESAMPLER_HISTORY;
+        r->buffer = enif_alloc(sizeof(float) * channels * r->buffer_frames);
+        ensure(r->buffer != NULL);
+        memset(r->buffer, 0, sizeof(float) * channels * r->buffer_frames);
+}
+
+void resampler_destroy(struct resampler *r)
+{
+        enif_free(r->buffer);
+        r->buffer = NULL;
+}
+
+long resampler_max_output(const struct resampler *r, long input_frames, double adjust)
+{
+        return (long) ceil((input_frames + RESAMPLER_HISTORY) / (r->step * adjust)) + 1;
+}
+
+/**
+ * Catmull-Rom interpolation between `x1` and `x2` at `t` in [0, 1).
+ */
+static inline float _interpolate(float x0, float x1, float x2, float x3, float t)
+{
+        const float a = -0.5f * x0 + 1.5f * x1 - 1.5f * x2 + 0.5f * x3;
+        const float b = x0 - 2.5f * x1 + 2.0f * x2 - 0.5f * x3;
+        const float c = -0.5f * x0 + 0.5f * x2;
+        return ((a * t + b) * t + c) * t + x1;
+}
+
+long resampler_process(struct resampler *r, const float *input, long input_frames,
+                       float *output, double adjust)
+{
+        const int channels = r->channels;
+        const size_t total = RESAMPLER_HISTORY + input_frames;
+
+        if (r->buffer_frames < total) {
+                r->buffer = enif_realloc(r->buffer, sizeof(float) * channels * total);
+                ensure(r->buffer != NULL);
+                r->buffer_frames = total;
+        }
+
+        memcpy(r->buffer + RESAMPLER_HISTORY * channels, input,
+               sizeof(float) * channels * input_frames);
+
+        const double step = r->step * adjust;
+        double position = r->position;
+        long produced = 0;
+
+        // Each output frame needs one frame before and two after its position
+        while ((long) position + 2 < (long) total) {
+                const long i = (long) position;
+                const float t = (float) (position - i);
+                const float *f = r->buffer + (i - 1) * channels;
+
+                int c;
+                for (c = 0; c < channels; c++) {
+                        output[produced * channels + c] =
+                                _interpolate(f[c], f[channels + c],
+                                             f[2 * channels + c], f[3 * channels + c], t);
+                }
+
+                produced++;
+                position += step;
+        }
+
+        // Keep the tail as history for the next call
+        memmove(r->buffer, r->buffer + (total - RESAMPLER_HISTORY) * channels,
+                sizeof(float) * channels * RESAMPLER_HISTORY);
+        r->position = position - (total - RESAMPLER_HISTORY);
+
+        return produced;
+}
@@ -0,0 +1,54 @@
+#ifndef _PORTAUDIO_NIF_RESAMPLER_
+#define _PORTAUDIO_NIF_RESAMPLER_
+
+#include <stddef.h>
+
+/**
+ * Frames of previous input kept around for interpolation.
+ */
+#define RESAMPLER_HISTORY 3
+
+/**
+ * Streaming cubic resampler for interleaved float frames, whose ratio can
+ * be adjusted slightly on every call to track clock drift.
+ */
+struct resampler {
+        int channels;
+
+        // Input frames consumed per output frame at the nominal rates
+        double step;
+
+        // Position of the next output frame in `buffer`
+        double position;
+
+        // History followed by the current input
+        float *buffer;
+        size_t buffer_frames;
+};
+
+/**
+ * Initialize a resampler converting from `input_rate` to `output_rate`.
+ */
+void resampler_init(struct resampler *r, int channels, double input_rate, double output_rate);
+
+/**
+ * Free any memory held by the resampler.
+ */
+void resampler_destroy(struct resampler *r);
+
+/**
+ * Returns an upper bound on the number of frames produced from
+ * `input_frames` frames when the step is scaled by `adjust`.
+ */
+long resampler_max_output(const struct resampler *r, long input_frames, double adjust);
+
+/**
+ * Resample `input_frames` frames from `input` in to `output`, scaling the
+ * nominal step by `adjust`. Values of `adjust` above 1 consume input faster,
+ * producing fewer frames. Returns the number of frames written, which is at
+ * most `resampler_max_output`.
+ */
+long resampler_process(struct resampler *r, const float *input, long input_frames,
+                       float *output, double adjust);
+
+#endif // _PORTAUDIO_NIF_RESAMPLER_
@@ -0,0 +1,243 @@
+#include "routing.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "erl_interop.h"
+#include "samples.h"
+#include "util.h"
+
+static bool _tap_from_term(ErlNifEnv *env, ERL_NIF_TERM term, int input_channels,
+                           struct route_tap *tap)
+{
+        int arity;
+        const ERL_NIF_TERM *tuple;
+        double weight;
+
+        if (!enif_get_tuple(env, term, &arity, &tuple)
+            || arity != 2
+            || !enif_get_int(env, tuple[0], &tap->source)
+            || !enif_get_double(env, tuple[1], &weight)) {
+                return false;
+        }
+
+        tap->weight = (float) weight;
+        return tap->source >= 0 && tap->source < input_channels;
+}
+
+static bool _channel_from_term(ErlNifEnv *env, ERL_NIF_TERM term, int input_channels,
+                               struct route_channel *channel)
+{
+        int source;
+        if (enif_get_int(env, term, &source)) {
+                channel->n_taps = 1;
+                channel->taps = enif_alloc(sizeof(struct route_tap));
+                ensure(channel->taps != NULL);
+                channel->taps[0].source = source;
+                channel->taps[0].weight = 1.0f;
+                return source >= 0 && source < input_channels;
+        }
+
+        unsigned int length;
+        if (!enif_get_list_length(env, term, &length) || length == 0)
+                return false;
+
+        channel->n_taps = length;
+        channel->taps = enif_alloc(sizeof(struct route_tap) * length);
+        ensure(channel->taps != NULL);
+
+        ERL_NIF_TERM cell;
+        int i = 0;
+        while (enif_get_list_cell(env, term, &cell, &term)) {
+                if (!_tap_from_term(env, cell, input_channels, &channel->taps[i++]))
+                        return false;
+        }
+
+        return true;
+}
+
+static bool _route_from_term(ErlNifEnv *env, ERL_NIF_TERM term, int input_channels,
+                             struct route *route)
+{
+        int arity;
+        const ERL_NIF_TERM *tuple;
+        unsigned int length;
+
+        if (!enif_get_tuple(env, term, &arity, &tuple)
+            || arity != 2
+            || !enif_is_atom(env, tuple[0])
+            || !enif_get_list_length(env, tuple[1], &length)
+            || length == 0) {
+                return false;
+        }
+
+        route->name = tuple[0];
+        route->n_channels = length;
+        route->channels = enif_alloc(sizeof(struct route_channel) * length);
+        ensure(route->channels != NULL);
+        memset(route->channels, 0, sizeof(struct route_channel) * length);
+
+        ERL_NIF_TERM list = tuple[1], cell;
+        int i = 0;
+        while (enif_get_list_cell(env, list, &cell, &list)) {
+                if (!_channel_from_term(env, cell, input_channels, &route->channels[i++]))
+                        return false;
+        }
+
+        route->direct = true;
+        for (i = 0; i < route->n_channels; i++) {
+                const struct route_channel *ch = &route->channels[i];
+                if (ch->n_taps != 1 || ch->taps[0].weight != 1.0f)
+                        route->direct = false;
+        }
+
+        return true;
+}
+
+struct routing *routing_from_term(ErlNifEnv *env, ERL_NIF_TERM term,
+                                  PaSampleFormat sample_format, int input_channels)
+{
+        unsigned int length;
+        if (!enif_get_list_length(env, term, &length) || length == 0)
+                return NULL;
+
+        struct routing *routing = enif_alloc(sizeof(*routing));
+        ensure(routing != NULL);
+        routing->sample_format = sample_format;
+        routing->sample_size = Pa_GetSampleSize(sample_format);
+        routing->input_channels = input_channels;
+        routing->n_routes = length;
+        routing->routes = enif_alloc(sizeof(struct route) * length);
+        ensure(routing->routes != NULL);
+        memset(routing->routes, 0, sizeof(struct route) * length);
+        routing->scratch = NULL;
+        routing->scratch_len = 0;
+
+        ERL_NIF_TERM cell;
+        int i = 0;
+        while (enif_get_list_cell(env, term, &cell, &term)) {
+                if (!_route_from_term(env, cell, input_channels, &routing->routes[i++])) {
+                        routing_destroy(routing);
+                        return NULL;
+                }
+        }
+
+        return routing;
+}
+
+void routing_destroy(struct routing *routing)
+{
+        int r, c;
+        for (r = 0; r < routing->n_routes; r++) {
+                struct route *route = &routing->routes[r];
+                if (route->channels == NULL)
+                        continue;
+
+                for (c = 0; c < route->n_channels; c++) {
+                        enif_safe_free(route->channels[c].taps);
+                }
+                enif_free(route->channels);
+        }
+
+        enif_free(routing->routes);
+        enif_safe_free(routing->scratch);
+        enif_free(routing);
+}
+
+int routing_find(const struct routing *routing, ERL_NIF_TERM name)
+{
+        int r;
+        for (r = 0; r < routing->n_routes; r++) {
+                if (enif_compare(routing->routes[r].name, name) == 0)
+                        return r;
+        }
+        return -1;
+}
+
+size_t routing_output_size(const struct routing *routing, int route, long frames)
+{
+        assert(route >= 0 && route < routing->n_routes);
+        return frames * routing->routes[route].n_channels * routing->sample_size;
+}
+
+static void _apply_direct(const struct routing *routing, const struct route *route,
+                          const unsigned char *input, long frames, unsigned char *output)
+{
+        const size_t sample_size = routing->sample_size;
+        const size_t in_frame_size = routing->input_channels * sample_size;
+
+        long f;
+        int c;
+        for (f = 0; f < frames; f++) {
+                const unsigned char *in = input + f * in_frame_size;
+                for (c = 0; c < route->n_channels; c++) {
+                        memcpy(output, in + route->channels[c].taps[0].source * sample_size, sample_size);
+                        output += sample_size;
+                }
+        }
+}
+
+static void _apply_mixed(struct routing *routing, const struct route *route,
+                         const unsigned char *input, long frames, unsigned char *output)
+{
+        const size_t in_samples = frames * routing->input_channels;
+        const size_t out_samples = frames * route->n_channels;
+        const size_t needed = in_samples + out_samples;
+
+        if (routing->scratch_len < needed) {
+                routing->scratch = enif_realloc(routing->scratch, needed * sizeof(float));
+                ensure(routing->scratch != NULL);
+                routing->scratch_len = needed;
+        }
+
+        float *in = routing->scratch;
+        float *out = routing->scratch + in_samples;
+        samples_to_float(routing->sample_format, input, in, in_samples);
+
+        long f;
+        int c, t;
+        for (f = 0; f < frames; f++) {
+                const float *in_frame = in + f * routing->input_channels;
+                for (c = 0; c < route->n_channels; c++) {
+                        const struct route_channel *ch = &route->channels[c];
+                        float sum = 0.0f;
+                        for (t = 0; t < ch->n_taps; t++)
+                                sum += in_frame[ch->taps[t].source] * ch->taps[t].weight;
+                        *out++ = sum;
+                }
+        }
+
+        samples_from_float(routing->sample_format, routing->scratch + in_samples,
+                           output, out_samples);
+}
+
+void routing_apply(struct routing *routing, int route, const unsigned char *input,
+                   long frames, unsigned char *output)
+{
+        assert(route >= 0 && route < routing->n_routes);
+        const struct route *r = &routing->routes[route];
+
+        if (r->direct)
+                _apply_direct(routing, r, input, frames, output);
+        else
+                _apply_mixed(routing, r, input, frames, output);
+}
+
+ERL_NIF_TERM routing_apply_to_map(ErlNifEnv *env, struct routing *routing,
+                                  const unsigned char *input, long frames)
+{
+        ERL_NIF_TERM map = enif_make_new_map(env);
+
+        int r;
+        for (r = 0; r < routing->n_routes; r++) {
+                ERL_NIF_TERM bin;
+                unsigned char *data =
+                        enif_make_new_binary(env, routing_output_size(routing, r, frames), &bin);
+                ensure(data != NULL);
+
+                routing_apply(routing, r, input, frames, data);
+                enif_make_map_put(env, map, routing->routes[r].name, bin, &map);
+        }
+
+        return map;
+}
@@ -0,0 +1,98 @@
+#ifndef _PORTAUDIO_NIF_ROUTING_
+#define _PORTAUDIO_NIF_ROUTING_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <portaudio.h>
+
+#include "erl_nif.h"
+
+/**
+ * A source channel and the weight it is mixed in with.
+ */
+struct route_tap {
+        int source;
+        float weight;
+};
+
+/**
+ * A single output channel of a route, mixed from one or more taps.
+ */
+struct route_channel {
+        int n_taps;
+        struct route_tap *taps;
+};
+
+/**
+ * A named output made up of one or more channels.
+ */
+struct route {
+        // Atoms are valid in every environment, so can be kept around
+        ERL_NIF_TERM name;
+
+        int n_channels;
+        struct route_channel *channels;
+
+        // `true` if every channel copies a single source unchanged
+        bool direct;
+};
+
+/**
+ * Routes a subset of the channels of an interleaved input buffer to a set
+ * of named outputs, optionally mixing several channels together.
+ */
+struct routing {
+        PaSampleFormat sample_format;
+        size_t sample_size;
+        int input_channels;
+
+        int n_routes;
+        struct route *routes;
+
+        // Scratch space used when mixing
+        float *scratch;
+        size_t scratch_len;
+};
+
+/**
+ * Parse a routing matrix from an erlang list of the form
+ * `[{name, [channel]}]`, where each channel is either a source channel index
+ * or a list of `{source, weight}` tuples to mix together.
+ *
+ * Returns `NULL` if the term is invalid or refers to a channel that
+ * doesn't exist.
+ */
+struct routing *routing_from_term(ErlNifEnv *env, ERL_NIF_TERM term,
+                                  PaSampleFormat sample_format, int input_channels);
+
+/**
+ * Free a routing matrix created by `routing_from_term`.
+ */
+void routing_destroy(struct routing *routing);
+
+/**
+ * Returns the index of the route with the given name, or -1 if there is
+ * none.
+ */
+int routing_find(const struct routing *routing, ERL_NIF_TERM name);
+
+/**
+ * Returns the size in bytes of `frames` frames of the given route.
+ */
+size_t routing_output_size(const struct routing *routing, int route, long frames);
+
+/**
+ * Route `frames` frames of `input` to the given route, writing them to
+ * `output`, which must be at least `routing_output_size` bytes.
+ */
+void routing_apply(struct routing *routing, int route, const unsigned char *input,
+                   long frames, unsigned char *output);
+
+/**
+ * Route `frames` frames of `input` to every route, returning a map of
+ * route names to binaries.
+ */
+ERL_NIF_TERM routing_apply_to_map(ErlNifEnv *env, struct routing *routing,
+                                  const unsigned char *input, long frames);
+
+#endif // _PORTAUDIO_NIF_ROUTING_
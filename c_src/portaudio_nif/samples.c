@@ -0,0 +1,105 @@
+#include "samples.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+
+static inline float _clip(float v)
+{
+        if (v > 1.0f)
+                return 1.0f;
+        if (v < -1.0f)
+                return -1.0f;
+        return v;
+}
+
+void samples_to_float(PaSampleFormat format, const unsigned char *src, float *dst, size_t n)
+{
+        size_t i;
+
+        switch (format) {
+        case paFloat32:
+                memcpy(dst, src, n * sizeof(float));
+                break;
+        case paInt32:
+                for (i = 0; i < n; i++) {
+                        int32_t v;
+                        memcpy(&v, src + i * 4, 4);
+                        dst[i] = (float) (v / 2147483648.0);
+                }
+                break;
+        case paInt24:
+                // Packed, little endian
+                for (i = 0; i < n; i++) {
+                        const unsigned char *p = src + i * 3;
+                        int32_t v = (int32_t) ((uint32_t) p[0] << 8
+                                               | (uint32_t) p[1] << 16
+                                               | (uint32_t) p[2] << 24);
+                        dst[i] = (float) (v / 2147483648.0);
+                }
+                break;
+        case paInt16:
+                for (i = 0; i < n; i++) {
+                        int16_t v;
+                        memcpy(&v, src + i * 2, 2);
+                        dst[i] = v / 32768.0f;
+                }
+                break;
+        case paInt8:
+                for (i = 0; i < n; i++)
+                        dst[i] = ((int8_t) src[i]) / 128.0f;
+                break;
+        case paUInt8:
+                for (i = 0; i < n; i++)
+                        dst[i] = ((int) src[i] - 128) / 128.0f;
+                break;
+        default:
+                ensure(!"unknown sample format");
+        }
+}
+
+void samples_from_float(PaSampleFormat format, const float *src, unsigned char *dst, size_t n)
+{
+        size_t i;
+
+        switch (format) {
+        case paFloat32:
+                for (i = 0; i < n; i++) {
+                        const float v = _clip(src[i]);
+                        memcpy(dst + i * 4, &v, 4);
+                }
+                break;
+        case paInt32:
+                for (i = 0; i < n; i++) {
+                        const int32_t v = (int32_t) (_clip(src[i]) * 2147483647.0);
+                        memcpy(dst + i * 4, &v, 4);
+                }
+                break;
+        case paInt24:
+                for (i = 0; i < n; i++) {
+                        const int32_t v = (int32_t) (_clip(src[i]) * 8388607.0f);
+                        unsigned char *p = dst + i * 3;
+                        p[0] = v & 0xff;
+                        p[1] = (v >> 8) & 0xff;
+                        p[2] = (v >> 16) & 0xff;
+                }
+                break;
+        case paInt16:
+                for (i = 0; i < n; i++) {
+                        const int16_t v = (int16_t) (_clip(src[i]) * 32767.0f);
+                        memcpy(dst + i * 2, &v, 2);
+                }
+                break;
+        case paInt8:
+                for (i = 0; i < n; i++)
+                        dst[i] = (unsigned char) (int8_t) (_clip(src[i]) * 127.0f);
+                break;
+        case paUInt8:
+                for (i = 0; i < n; i++)
+                        dst[i] = (unsigned char) (_clip(src[i]) * 127.0f + 128.0f);
+                break;
+        default:
+                ensure(!"unknown sample format");
+        }
+}
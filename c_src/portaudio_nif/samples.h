@@ -0,0 +1,19 @@
+#ifndef _PORTAUDIO_NIF_SAMPLES_
+#define _PORTAUDIO_NIF_SAMPLES_
+
+#include <stddef.h>
+#include <portaudio.h>
+
+/**
+ * Convert `n` interleaved samples of the given format to floats in the
+ * range [-1.0, 1.0].
+ */
+void samples_to_float(PaSampleFormat format, const unsigned char *src, float *dst, size_t n);
+
+/**
+ * Convert `n` floats to interleaved samples of the given format, clipping
+ * anything outside of [-1.0, 1.0].
+ */
+void samples_from_float(PaSampleFormat format, const float *src, unsigned char *dst, size_t n);
+
+#endif // _PORTAUDIO_NIF_SAMPLES_
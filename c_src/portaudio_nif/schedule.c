@@ -0,0 +1,210 @@
+#include "schedule.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "erl_interop.h"
+#include "util.h"
+
+void schedule_init(struct schedule *s, int channels, double sample_rate, long max_frames)
+{
+        memset(s, 0, sizeof(*s));
+
+        s->channels = channels;
+        s->sample_rate = sample_rate;
+        s->max_frames = max_frames;
+}
+
+static void _free_item(struct schedule *s, struct scheduled_item *item)
+{
+        s->n_items--;
+        s->allocated_frames -= item->allocated;
+        enif_free(item->data);
+        enif_free(item);
+}
+
+void schedule_destroy(struct schedule *s)
+{
+        struct scheduled_item *item = s->items;
+        while (item != NULL) {
+                struct scheduled_item *next = item->next;
+                _free_item(s, item);
+                item = next;
+        }
+        s->items = NULL;
+}
+
+/**
+ * Returns the frame after the last item finishes, or the current position
+ * if nothing is left to play.
+ */
+static long _end(const struct schedule *s)
+{
+        long end = s->position;
+        const struct scheduled_item *item;
+        for (item = s->items; item != NULL; item = item->next) {
+                if (item->start + item->frames > end)
+                        end = item->start + item->frames;
+        }
+        return end;
+}
+
+/**
+ * Fade out and stop every item playing at `start`, over `crossfade` frames.
+ */
+static void _cut(struct schedule *s, long start, long crossfade)
+{
+        struct scheduled_item *item;
+        for (item = s->items; item != NULL && item->start < start; item = item->next) {
+                // Leave items that have finished or are already fading out
+                const long offset = start - item->start;
+                if (offset >= item->fade_out_start)
+                        continue;
+
+                item->fade_out_start = offset;
+                item->fade_out = crossfade;
+                if (offset + crossfade < item->frames)
+                        item->frames = offset + crossfade;
+        }
+}
+
+enum schedule_result schedule_add(struct schedule *s, float *data, long frames, long start,
+                                  long crossfade, long *started)
+{
+        if (s->allocated_frames + frames > s->max_frames)
+                return SCHEDULE_FULL;
+
+        if (start == SCHEDULE_NEXT) {
+                start = _end(s) - crossfade;
+                if (start < s->position)
+                        start = s->position;
+        } else if (start < s->position) {
+                return SCHEDULE_TOO_LATE;
+        }
+
+        struct scheduled_item *item = enif_alloc(sizeof(*item));
+        ensure(item != NULL);
+        memset(item, 0, sizeof(*item));
+
+        item->data = data;
+        item->allocated = frames;
+        item->frames = frames;
+        item->start = start;
+        item->fade_in = crossfade < frames ? crossfade : frames;
+        item->fade_out_start = frames;
+
+        if (crossfade > 0)
+                _cut(s, start, crossfade);
+
+        // Items starting at the same frame play in the order added
+        struct scheduled_item **link = &s->items;
+        while (*link != NULL && (*link)->start <= start)
+                link = &(*link)->next;
+        item->next = *link;
+        *link = item;
+
+        s->n_items++;
+        s->allocated_frames += frames;
+        *started = start;
+        return SCHEDULE_OK;
+}
+
+static float _gain(const struct scheduled_item *item, long k)
+{
+        float gain = 1.0f;
+        if (k < item->fade_in)
+                gain *= (k + 0.5f) / item->fade_in;
+        if (k >= item->fade_out_start)
+                gain *= 1.0f - (k - item->fade_out_start + 0.5f) / item->fade_out;
+        return gain;
+}
+
+void schedule_mix(struct schedule *s, float *out, long frames)
+{
+        const int channels = s->channels;
+        const long end = s->position + frames;
+        struct scheduled_item **link = &s->items;
+
+        while (*link != NULL && (*link)->start < end) {
+                struct scheduled_item *item = *link;
+                const long item_end = item->start + item->frames;
+                const long from = item->start > s->position ? item->start : s->position;
+                const long to = item_end < end ? item_end : end;
+
+                long f;
+                int c;
+                for (f = from; f < to; f++) {
+                        const long k = f - item->start;
+                        const float *in = item->data + k * channels;
+                        float *o = out + (f - s->position) * channels;
+
+                        if (k < item->fade_in || k >= item->fade_out_start) {
+                                const float gain = _gain(item, k);
+                                for (c = 0; c < channels; c++)
+                                        o[c] += in[c] * gain;
+                        } else {
+                                for (c = 0; c < channels; c++)
+                                        o[c] += in[c];
+                        }
+                }
+
+                if (item_end <= end) {
+                        *link = item->next;
+                        _free_item(s, item);
+                        s->played++;
+                } else {
+                        link = &item->next;
+                }
+        }
+
+        s->position = end;
+}
+
+void schedule_anchor(struct schedule *s, double time)
+{
+        if (!s->anchored) {
+                s->anchored = true;
+                s->anchor_time = time;
+        } else {
+                // Follow the stream clock without jumping around with the
+                // jitter of each measurement
+                const double predicted = s->anchor_time
+                        + (s->position - s->anchor_frame) / s->sample_rate;
+                s->anchor_time = predicted + (time - predicted) / SCHEDULE_ANCHOR_SMOOTHING;
+        }
+        s->anchor_frame = s->position;
+}
+
+void schedule_reset_anchor(struct schedule *s)
+{
+        s->anchored = false;
+}
+
+bool schedule_frame_at(const struct schedule *s, double time, long *frame)
+{
+        if (!s->anchored)
+                return false;
+
+        *frame = s->anchor_frame + lround((time - s->anchor_time) * s->sample_rate);
+        return true;
+}
+
+ERL_NIF_TERM schedule_info_to_term(ErlNifEnv *env, const struct schedule *s)
+{
+        const ERL_NIF_TERM time = s->anchored
+                ? enif_make_double(env, s->anchor_time
+                                   + (s->position - s->anchor_frame) / s->sample_rate)
+                : erli_make_nil(env);
+
+#define N_FIELDS 6
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "frame", enif_make_long(env, s->position)),
+                make_kw_item(env, "time", time),
+                make_kw_item(env, "items", enif_make_long(env, s->n_items)),
+                make_kw_item(env, "end_frame", enif_make_long(env, _end(s))),
+                make_kw_item(env, "queued", enif_make_double(env, s->allocated_frames / s->sample_rate)),
+                make_kw_item(env, "played", enif_make_ulong(env, s->played))
+        };
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
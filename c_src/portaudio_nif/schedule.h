@@ -0,0 +1,122 @@
+#ifndef _PORTAUDIO_NIF_SCHEDULE_
+#define _PORTAUDIO_NIF_SCHEDULE_
+
+#include <stdbool.h>
+
+#include "erl_nif.h"
+
+/**
+ * Start an item once everything already scheduled has finished.
+ */
+#define SCHEDULE_NEXT -1
+
+/**
+ * How much of the error between the measured and predicted stream time of
+ * each chunk is corrected for, as a fraction of `1 / n`.
+ */
+#define SCHEDULE_ANCHOR_SMOOTHING 64
+
+/**
+ * A clip of audio due to play from a given frame.
+ */
+struct scheduled_item {
+        float *data;
+        // Frames allocated in `data`, and how many are played, which is
+        // fewer if cut short by a crossfade
+        long allocated;
+        long frames;
+        long start;
+
+        long fade_in;
+        // Offset in to the item the fade out starts at, and its length
+        long fade_out_start;
+        long fade_out;
+
+        struct scheduled_item *next;
+};
+
+enum schedule_result {
+        SCHEDULE_OK,
+        // The start frame has already been played
+        SCHEDULE_TOO_LATE,
+        // The item would take the schedule over its maximum
+        SCHEDULE_FULL
+};
+
+/**
+ * Clips of audio placed at exact frames of an output stream, counted from
+ * the first frame the schedule played. Items may overlap, in which case
+ * they are mixed, or crossfade from the item playing before them.
+ */
+struct schedule {
+        int channels;
+        double sample_rate;
+
+        // Index of the next frame to play
+        long position;
+
+        // Estimated stream time `anchor_frame` is heard at, for converting
+        // stream times to frames. Measured when each chunk is played.
+        bool anchored;
+        long anchor_frame;
+        double anchor_time;
+
+        // Ordered by start frame
+        struct scheduled_item *items;
+        long n_items;
+        long allocated_frames;
+        long max_frames;
+
+        unsigned long played;
+};
+
+/**
+ * Initialize an empty schedule holding up to `max_frames` frames of clips.
+ */
+void schedule_init(struct schedule *s, int channels, double sample_rate, long max_frames);
+
+/**
+ * Free every item still in the schedule.
+ */
+void schedule_destroy(struct schedule *s);
+
+/**
+ * Add `frames` interleaved frames starting at frame `start`, or after the
+ * last item with `SCHEDULE_NEXT`. With a `crossfade`, the item fades in
+ * over that many frames while any item already playing fades out and
+ * stops. A `SCHEDULE_NEXT` item overlaps the previous one by the crossfade.
+ *
+ * Takes ownership of `data` when returning `SCHEDULE_OK`, and sets `started`
+ * to the frame the item starts at.
+ */
+enum schedule_result schedule_add(struct schedule *s, float *data, long frames, long start,
+                                  long crossfade, long *started);
+
+/**
+ * Add the next `frames` frames of every item due to `out`, and advance the
+ * schedule.
+ */
+void schedule_mix(struct schedule *s, float *out, long frames);
+
+/**
+ * Update the estimated stream time the next frame will be heard at.
+ */
+void schedule_anchor(struct schedule *s, double time);
+
+/**
+ * Forget the stream time estimate, after the stream has lost its place.
+ */
+void schedule_reset_anchor(struct schedule *s);
+
+/**
+ * Convert a stream time to the frame heard at that time. Returns `false`
+ * if no frames have been played to estimate it from yet.
+ */
+bool schedule_frame_at(const struct schedule *s, double time, long *frame);
+
+/**
+ * Returns a map of the schedule's position and contents.
+ */
+ERL_NIF_TERM schedule_info_to_term(ErlNifEnv *env, const struct schedule *s);
+
+#endif // _PORTAUDIO_NIF_SCHEDULE_
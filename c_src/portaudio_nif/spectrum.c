@@ -0,0 +1,477 @@
+#include "spectrum.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "erl_interop.h"
+#include "samples.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Lowest third octave band, 10^(-16/10) kHz or about 25Hz.
+ */
+#define THIRD_OCTAVE_FIRST -16
+
+static const char *_window_names[] = {
+        [SPECTRUM_WINDOW_RECTANGULAR] = "rectangular",
+        [SPECTRUM_WINDOW_HANN] = "hann",
+        [SPECTRUM_WINDOW_HAMMING] = "hamming",
+        [SPECTRUM_WINDOW_BLACKMAN] = "blackman"
+};
+
+static bool _window_from_atom(ErlNifEnv *env, ERL_NIF_TERM atom, enum spectrum_window *window)
+{
+        size_t i;
+        for (i = 0; i < sizeof(_window_names) / sizeof(*_window_names); i++) {
+                if (enif_compare(atom, enif_make_atom(env, _window_names[i])) == 0) {
+                        *window = i;
+                        return true;
+                }
+        }
+        return false;
+}
+
+static double _window_at(enum spectrum_window window, int i, int size)
+{
+        const double x = 2.0 * M_PI * i / size;
+
+        switch (window) {
+        case SPECTRUM_WINDOW_HANN:
+                return 0.5 - 0.5 * cos(x);
+        case SPECTRUM_WINDOW_HAMMING:
+                return 0.54 - 0.46 * cos(x);
+        case SPECTRUM_WINDOW_BLACKMAN:
+                return 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+        case SPECTRUM_WINDOW_RECTANGULAR:
+        default:
+                return 1.0;
+        }
+}
+
+static void _init_tables(struct spectrum *s)
+{
+        const int n = s->size;
+
+        s->window = enif_alloc(sizeof(float) * n);
+        s->cos_table = enif_alloc(sizeof(float) * n / 2);
+        s->sin_table = enif_alloc(sizeof(float) * n / 2);
+        s->bit_reverse = enif_alloc(sizeof(int) * n);
+        ensure(s->window != NULL && s->cos_table != NULL && s->sin_table != NULL
+               && s->bit_reverse != NULL);
+
+        // Periodic windows, normalized so a sine's peak bin reads its amplitude
+        double sum = 0.0, sum_squares = 0.0;
+        int i;
+        for (i = 0; i < n; i++) {
+                const double w = _window_at(s->window_type, i, n);
+                sum += w;
+                sum_squares += w * w;
+        }
+        for (i = 0; i < n; i++)
+                s->window[i] = (float) (_window_at(s->window_type, i, n) * 2.0 / sum);
+        s->band_scale = (float) (sum * sum / (n * sum_squares));
+
+        for (i = 0; i < n / 2; i++) {
+                s->cos_table[i] = (float) cos(2.0 * M_PI * i / n);
+                s->sin_table[i] = (float) sin(2.0 * M_PI * i / n);
+        }
+
+        int bits = 0;
+        while ((1 << bits) < n)
+                bits++;
+        for (i = 0; i < n; i++) {
+                int r = 0, b;
+                for (b = 0; b < bits; b++)
+                        r |= ((i >> b) & 1) << (bits - 1 - b);
+                s->bit_reverse[i] = r;
+        }
+}
+
+static double _hz_to_mel(double hz)
+{
+        return 2595.0 * log10(1.0 + hz / 700.0);
+}
+
+static double _mel_to_hz(double mel)
+{
+        return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+/**
+ * Add a band covering the bins from `first` to `last` inclusive, taking
+ * each weight from `weight_fn`. Returns `false` if every weight is zero.
+ */
+static bool _add_band(struct spectrum *s, int first, int last, double center,
+                      double (*weight_fn)(double hz, const double *edges),
+                      const double *edges)
+{
+        const double bin_hz = s->sample_rate / s->size;
+        struct spectrum_band *band = &s->bands[s->n_bands];
+
+        if (first < 0)
+                first = 0;
+        if (last > s->size / 2)
+                last = s->size / 2;
+        if (last < first)
+                return false;
+
+        band->first_bin = first;
+        band->n_bins = last - first + 1;
+        band->center = center;
+        band->weights = enif_alloc(sizeof(float) * band->n_bins);
+        ensure(band->weights != NULL);
+
+        double total = 0.0;
+        int k;
+        for (k = 0; k < band->n_bins; k++) {
+                const double w = weight_fn((first + k) * bin_hz, edges);
+                band->weights[k] = (float) w;
+                total += w;
+        }
+
+        if (total <= 0.0) {
+                enif_free(band->weights);
+                return false;
+        }
+
+        s->n_bands++;
+        return true;
+}
+
+static double _triangle_weight(double hz, const double *edges)
+{
+        if (hz <= edges[0] || hz >= edges[2])
+                return 0.0;
+        if (hz <= edges[1])
+                return (hz - edges[0]) / (edges[1] - edges[0]);
+        return (edges[2] - hz) / (edges[2] - edges[1]);
+}
+
+static double _rectangle_weight(double hz, const double *edges)
+{
+        return hz >= edges[0] && hz < edges[1] ? 1.0 : 0.0;
+}
+
+static bool _init_mel_bands(struct spectrum *s, int count)
+{
+        const double bin_hz = s->sample_rate / s->size;
+        const double top = _hz_to_mel(s->sample_rate / 2.0);
+
+        s->bands = enif_alloc(sizeof(struct spectrum_band) * count);
+        ensure(s->bands != NULL);
+
+        int b;
+        for (b = 0; b < count; b++) {
+                const double edges[3] = {
+                        _mel_to_hz(top * b / (count + 1)),
+                        _mel_to_hz(top * (b + 1) / (count + 1)),
+                        _mel_to_hz(top * (b + 2) / (count + 1))
+                };
+
+                // Bands narrower than a bin are rejected rather than left empty
+                if (!_add_band(s, (int) floor(edges[0] / bin_hz), (int) ceil(edges[2] / bin_hz),
+                               edges[1], &_triangle_weight, edges)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool _init_third_octave_bands(struct spectrum *s)
+{
+        const double bin_hz = s->sample_rate / s->size;
+        const double nyquist = s->sample_rate / 2.0;
+
+        // More than enough for any rate up to 1MHz
+        const int max_bands = 64;
+        s->bands = enif_alloc(sizeof(struct spectrum_band) * max_bands);
+        ensure(s->bands != NULL);
+
+        int n;
+        for (n = THIRD_OCTAVE_FIRST; s->n_bands < max_bands; n++) {
+                const double center = 1000.0 * pow(10.0, n / 10.0);
+                const double edges[2] = {
+                        center * pow(10.0, -1.0 / 20.0),
+                        center * pow(10.0, 1.0 / 20.0)
+                };
+                if (edges[1] > nyquist)
+                        break;
+
+                // Low bands may fall between bins, and are left out
+                _add_band(s, (int) ceil(edges[0] / bin_hz), (int) ceil(edges[1] / bin_hz) - 1,
+                          center, &_rectangle_weight, edges);
+        }
+
+        return s->n_bands > 0;
+}
+
+static bool _bands_from_term(ErlNifEnv *env, ERL_NIF_TERM term, struct spectrum *s)
+{
+        if (erli_is_nil(env, term)) {
+                s->band_type = SPECTRUM_BANDS_NONE;
+                s->n_outputs = s->size / 2 + 1;
+                return true;
+        }
+
+        if (enif_compare(term, enif_make_atom(env, "third_octave")) == 0) {
+                s->band_type = SPECTRUM_BANDS_THIRD_OCTAVE;
+                if (!_init_third_octave_bands(s))
+                        return false;
+                s->n_outputs = s->n_bands;
+                return true;
+        }
+
+        int arity, count;
+        const ERL_NIF_TERM *tuple;
+        if (!enif_get_tuple(env, term, &arity, &tuple)
+            || arity != 2
+            || enif_compare(tuple[0], enif_make_atom(env, "mel")) != 0
+            || !enif_get_int(env, tuple[1], &count)
+            || count < 1
+            || count > s->size / 2) {
+                return false;
+        }
+
+        s->band_type = SPECTRUM_BANDS_MEL;
+        if (!_init_mel_bands(s, count))
+                return false;
+        s->n_outputs = s->n_bands;
+        return true;
+}
+
+struct spectrum *spectrum_from_term(ErlNifEnv *env, ERL_NIF_TERM term,
+                                    PaSampleFormat sample_format, int channels,
+                                    double sample_rate)
+{
+        int arity, size, hop;
+        const ERL_NIF_TERM *tuple;
+        enum spectrum_window window;
+
+        if (!enif_get_tuple(env, term, &arity, &tuple)
+            || arity != 4
+            || !enif_get_int(env, tuple[0], &size)
+            || !enif_get_int(env, tuple[1], &hop)
+            || !_window_from_atom(env, tuple[2], &window)) {
+                return NULL;
+        }
+
+        if (size < SPECTRUM_MIN_SIZE || size > SPECTRUM_MAX_SIZE
+            || (size & (size - 1)) != 0 || hop < 1) {
+                return NULL;
+        }
+
+        struct spectrum *s = enif_alloc(sizeof(*s));
+        ensure(s != NULL);
+        memset(s, 0, sizeof(*s));
+
+        s->sample_format = sample_format;
+        s->channels = channels;
+        s->sample_rate = sample_rate;
+        s->size = size;
+        s->hop = hop;
+        s->window_type = window;
+        s->until_hop = size;
+
+        if (!_bands_from_term(env, tuple[3], s)) {
+                spectrum_destroy(s);
+                return NULL;
+        }
+
+        _init_tables(s);
+
+        s->history = enif_alloc(sizeof(float) * size * channels);
+        s->real = enif_alloc(sizeof(float) * size);
+        s->imag = enif_alloc(sizeof(float) * size);
+        s->magnitudes = enif_alloc(sizeof(float) * (size / 2 + 1));
+        ensure(s->history != NULL && s->real != NULL && s->imag != NULL
+               && s->magnitudes != NULL);
+        memset(s->history, 0, sizeof(float) * size * channels);
+
+        return s;
+}
+
+void spectrum_destroy(struct spectrum *s)
+{
+        int b;
+        for (b = 0; b < s->n_bands; b++)
+                enif_free(s->bands[b].weights);
+
+        enif_safe_free(s->bands);
+        enif_safe_free(s->window);
+        enif_safe_free(s->cos_table);
+        enif_safe_free(s->sin_table);
+        enif_safe_free(s->bit_reverse);
+        enif_safe_free(s->history);
+        enif_safe_free(s->input);
+        enif_safe_free(s->real);
+        enif_safe_free(s->imag);
+        enif_safe_free(s->magnitudes);
+        enif_free(s);
+}
+
+size_t spectrum_output_size(const struct spectrum *s)
+{
+        return sizeof(float) * s->n_outputs * s->channels;
+}
+
+long spectrum_max_outputs(const struct spectrum *s, long frames)
+{
+        return frames / s->hop + 1;
+}
+
+/**
+ * In place radix 2 FFT of `s->real` and `s->imag`, whose input has already
+ * been placed in bit reversed order.
+ */
+static void _fft(struct spectrum *s)
+{
+        const int n = s->size;
+        float *re = s->real;
+        float *im = s->imag;
+
+        int len;
+        for (len = 2; len <= n; len <<= 1) {
+                const int half = len / 2;
+                const int step = n / len;
+
+                int i, j;
+                for (i = 0; i < n; i += len) {
+                        for (j = 0; j < half; j++) {
+                                const float wr = s->cos_table[j * step];
+                                const float wi = -s->sin_table[j * step];
+                                const int a = i + j, b = i + j + half;
+
+                                const float tr = re[b] * wr - im[b] * wi;
+                                const float ti = re[b] * wi + im[b] * wr;
+                                re[b] = re[a] - tr;
+                                im[b] = im[a] - ti;
+                                re[a] += tr;
+                                im[a] += ti;
+                        }
+                }
+        }
+}
+
+static void _analyze(struct spectrum *s, float *output)
+{
+        const int n = s->size;
+        const int channels = s->channels;
+
+        int c;
+        for (c = 0; c < channels; c++) {
+                // The oldest frame is at `position`
+                int i;
+                for (i = 0; i < n; i++) {
+                        const int at = (s->position + i) & (n - 1);
+                        s->real[s->bit_reverse[i]] = s->history[at * channels + c] * s->window[i];
+                }
+                memset(s->imag, 0, sizeof(float) * n);
+
+                _fft(s);
+
+                float *out = output + c * s->n_outputs;
+                float *mags = s->band_type == SPECTRUM_BANDS_NONE ? out : s->magnitudes;
+
+                int k;
+                for (k = 0; k <= n / 2; k++)
+                        mags[k] = sqrtf(s->real[k] * s->real[k] + s->imag[k] * s->imag[k]);
+
+                // Bands carry the root of the weighted power of their bins
+                int b;
+                for (b = 0; b < s->n_bands; b++) {
+                        const struct spectrum_band *band = &s->bands[b];
+                        float power = 0.0f;
+                        for (k = 0; k < band->n_bins; k++) {
+                                const float m = mags[band->first_bin + k];
+                                power += band->weights[k] * m * m;
+                        }
+                        out[b] = sqrtf(power * s->band_scale);
+                }
+        }
+}
+
+long spectrum_process(struct spectrum *s, const unsigned char *input, long frames,
+                      float *output)
+{
+        const int channels = s->channels;
+        const size_t samples = frames * channels;
+
+        if (samples > s->input_len) {
+                s->input = enif_realloc(s->input, sizeof(float) * samples);
+                ensure(s->input != NULL);
+                s->input_len = samples;
+        }
+        samples_to_float(s->sample_format, input, s->input, samples);
+
+        long produced = 0;
+        long done = 0;
+        while (done < frames) {
+                long chunk = frames - done;
+                if (chunk > s->until_hop)
+                        chunk = s->until_hop;
+                if (chunk > s->size - s->position)
+                        chunk = s->size - s->position;
+
+                memcpy(s->history + s->position * channels, s->input + done * channels,
+                       sizeof(float) * chunk * channels);
+
+                s->position = (s->position + chunk) & (s->size - 1);
+                s->filled = s->filled + chunk > s->size ? s->size : s->filled + chunk;
+                s->until_hop -= chunk;
+                done += chunk;
+
+                if (s->until_hop == 0) {
+                        s->until_hop = s->hop;
+                        if (s->filled == s->size) {
+                                _analyze(s, output + produced * s->n_outputs * channels);
+                                produced++;
+                        }
+                }
+        }
+
+        return produced;
+}
+
+static ERL_NIF_TERM _bands_to_term(ErlNifEnv *env, const struct spectrum *s)
+{
+        switch (s->band_type) {
+        case SPECTRUM_BANDS_MEL:
+                return enif_make_tuple2(env, enif_make_atom(env, "mel"),
+                                        enif_make_int(env, s->n_bands));
+        case SPECTRUM_BANDS_THIRD_OCTAVE:
+                return enif_make_atom(env, "third_octave");
+        case SPECTRUM_BANDS_NONE:
+        default:
+                return erli_make_nil(env);
+        }
+}
+
+ERL_NIF_TERM spectrum_info_to_term(ErlNifEnv *env, const struct spectrum *s)
+{
+        ERL_NIF_TERM frequencies = enif_make_list(env, 0);
+
+        int i;
+        for (i = s->n_outputs - 1; i >= 0; i--) {
+                const double hz = s->band_type == SPECTRUM_BANDS_NONE
+                        ? i * s->sample_rate / s->size
+                        : s->bands[i].center;
+                frequencies = enif_make_list_cell(env, enif_make_double(env, hz), frequencies);
+        }
+
+#define N_FIELDS 6
+        const ERL_NIF_TERM fields[N_FIELDS] = {
+                make_kw_item(env, "size", enif_make_int(env, s->size)),
+                make_kw_item(env, "hop", enif_make_int(env, s->hop)),
+                make_kw_item(env, "window", enif_make_atom(env, _window_names[s->window_type])),
+                make_kw_item(env, "bands", _bands_to_term(env, s)),
+                make_kw_item(env, "channels", enif_make_int(env, s->channels)),
+                make_kw_item(env, "frequencies", frequencies)
+        };
+        return erli_make_map_from_array(env, fields, N_FIELDS);
+#undef N_FIELDS
+}
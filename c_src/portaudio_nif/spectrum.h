@@ -0,0 +1,133 @@
+#ifndef _PORTAUDIO_NIF_SPECTRUM_
+#define _PORTAUDIO_NIF_SPECTRUM_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <portaudio.h>
+
+#include "erl_nif.h"
+
+/**
+ * Smallest and largest supported FFT sizes. Sizes must be a power of two.
+ */
+#define SPECTRUM_MIN_SIZE 32
+#define SPECTRUM_MAX_SIZE 16384
+
+enum spectrum_window {
+        SPECTRUM_WINDOW_RECTANGULAR,
+        SPECTRUM_WINDOW_HANN,
+        SPECTRUM_WINDOW_HAMMING,
+        SPECTRUM_WINDOW_BLACKMAN
+};
+
+enum spectrum_bands {
+        // Every bin from DC to nyquist
+        SPECTRUM_BANDS_NONE,
+        // Triangular filters evenly spaced on the mel scale
+        SPECTRUM_BANDS_MEL,
+        // Third octave bands centered on the preferred frequencies from 25Hz
+        SPECTRUM_BANDS_THIRD_OCTAVE
+};
+
+/**
+ * A band made up of consecutive FFT bins, each with its own weight.
+ */
+struct spectrum_band {
+        int first_bin;
+        int n_bins;
+        float *weights;
+        double center;
+};
+
+/**
+ * Windowed FFT analysis of an interleaved input stream. Every `hop` frames
+ * the last `size` frames of each channel are windowed and transformed,
+ * producing the magnitude of each bin, or of each band when bands are
+ * configured.
+ */
+struct spectrum {
+        PaSampleFormat sample_format;
+        int channels;
+        double sample_rate;
+
+        int size;
+        int hop;
+        enum spectrum_window window_type;
+        enum spectrum_bands band_type;
+
+        // Values produced per channel for each analysis
+        int n_outputs;
+
+        // Window coefficients, scaled so a full scale sine peaks at 1.0
+        float *window;
+        // Inverse of the window's equivalent noise bandwidth in bins, so
+        // bands spanning a tone's leakage still read its amplitude
+        float band_scale;
+
+        // Twiddle factors and bit reversed indices for the FFT
+        float *cos_table;
+        float *sin_table;
+        int *bit_reverse;
+
+        int n_bands;
+        struct spectrum_band *bands;
+
+        // The last `size` frames, wrapping at `position`
+        float *history;
+        int position;
+        int filled;
+        // Frames until the next analysis
+        int until_hop;
+
+        // Scratch space for input conversion and the transform
+        float *input;
+        size_t input_len;
+        float *real;
+        float *imag;
+        float *magnitudes;
+};
+
+/**
+ * Parse an analysis configuration of the form `{size, hop, window, bands}`,
+ * where `window` is one of `rectangular`, `hann`, `hamming` or `blackman`,
+ * and `bands` is either `nil`, `{mel, count}` or `third_octave`.
+ *
+ * Returns `NULL` if the term is invalid.
+ */
+struct spectrum *spectrum_from_term(ErlNifEnv *env, ERL_NIF_TERM term,
+                                    PaSampleFormat sample_format, int channels,
+                                    double sample_rate);
+
+/**
+ * Free an analysis created by `spectrum_from_term`.
+ */
+void spectrum_destroy(struct spectrum *s);
+
+/**
+ * Returns the size in bytes of a single analysis of every channel.
+ */
+size_t spectrum_output_size(const struct spectrum *s);
+
+/**
+ * Returns the most analyses `spectrum_process` can produce from `frames`
+ * frames.
+ */
+long spectrum_max_outputs(const struct spectrum *s, long frames);
+
+/**
+ * Feed `frames` frames of `input` to the analysis, writing every analysis
+ * completed to `output` as native endian floats, channel by channel.
+ * `output` must hold at least `spectrum_max_outputs` analyses.
+ *
+ * Returns the number of analyses written.
+ */
+long spectrum_process(struct spectrum *s, const unsigned char *input, long frames,
+                      float *output);
+
+/**
+ * Returns a map describing the analysis, including the center frequency of
+ * every bin or band.
+ */
+ERL_NIF_TERM spectrum_info_to_term(ErlNifEnv *env, const struct spectrum *s);
+
+#endif // _PORTAUDIO_NIF_SPECTRUM_
@@ -0,0 +1,77 @@
+#ifndef _PORTAUDIO_NIF_STREAM_
+#define _PORTAUDIO_NIF_STREAM_
+
+#include <portaudio.h>
+#include <stdatomic.h>
+
+#include "erl_nif.h"
+
+/**
+ * Time the native threads driving a stream wait before checking again
+ * whether an inactive stream has been started.
+ */
+#define STREAM_IDLE_MSEC 10
+
+struct coalescer;
+struct routing;
+struct spectrum;
+struct capture;
+struct playback;
+struct bridge;
+
+/**
+ * The resource behind every erlang stream reference.
+ */
+struct erl_stream_resource {
+        PaStream *stream;
+
+        // Held for reading by every call using `stream` and for writing when
+        // closing it, so a stream is never closed underneath a blocked read
+        // or write.
+        ErlNifRWLock *lock;
+
+        // Serializes reads, which share the delivery coalescer and routing
+        // scratch buffers, whether by `stream_read` or the capture thread.
+        // Taken after `lock`.
+        ErlNifMutex *read_lock;
+
+        PaSampleFormat input_format;
+        short input_channels;
+        short input_sample_size;
+        short input_frame_size;
+
+        PaSampleFormat output_format;
+        short output_channels;
+        short output_sample_size;
+        short output_frame_size;
+
+        double sample_rate;
+        unsigned long frames_per_buffer;
+
+        // Frames accepted by `stream_write`, whether written to the stream
+        // or its write queue
+        atomic_ulong frames_written;
+
+        // Delivery policy for reads, or `NULL` to return whatever is available
+        struct coalescer *delivery;
+
+        // Channel routing for reads, or `NULL` to return every channel
+        struct routing *routing;
+
+        // Spectrum analysis of captured buffers, or `NULL` if disabled
+        struct spectrum *spectrum;
+
+        // Capture thread sending buffers to subscribers, or `NULL` if the
+        // stream never had any
+        struct capture *capture;
+
+        // Playback thread feeding the stream from native sources, or `NULL`
+        // for input only streams
+        struct playback *playback;
+
+        // Bridge reading from or writing to the stream, which owns all of
+        // its reads and writes, or `NULL`. Only changed under the write lock.
+        struct bridge *bridge;
+};
+
+#endif // _PORTAUDIO_NIF_STREAM_
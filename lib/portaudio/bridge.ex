@@ -0,0 +1,78 @@
+defmodule PortAudio.Bridge do
+  @moduledoc """
+  Connects an input stream to an output stream on a different device.
+
+  Two devices never run at exactly the same rate, so copying audio between
+  them with `PortAudio.Stream.read/1` and `PortAudio.Stream.write/2`
+  eventually overflows the input or underflows the output. A bridge moves
+  the audio natively and estimates the drift between the two clocks from
+  how much audio is queued on the output, adjusting a fine resampler to
+  keep it at a target depth.
+
+  ## Example
+
+      iex> {:ok, mic} = PortAudio.Device.stream(input_dev, input: %{channel_count: 2, sample_format: :int16})
+      iex> {:ok, speaker} = PortAudio.Device.stream(output_dev, output: %{channel_count: 2, sample_format: :int16})
+      iex> {:ok, bridge} = PortAudio.Bridge.start(mic, speaker, target_latency: 0.05)
+      iex> PortAudio.Bridge.stats(bridge)
+      %{drift_ppm: 42.1, ...}
+
+  Both streams must be started for audio to flow. While bridged, reads,
+  writes, subscriptions and playback sources on either stream return
+  `{:error, :stream_bridged}`.
+  """
+  alias PortAudio.Bridge
+
+  defstruct [:resource]
+
+  @type t :: %Bridge{}
+
+  @default_target_latency 0.05
+
+  @spec start(PortAudio.Stream.t(), PortAudio.Stream.t(), keyword) ::
+          {:ok, t} | {:error, atom}
+
+  @doc """
+  Start bridging `input` to `output`.
+
+  ## Options
+
+      * `target_latency` - The amount of audio in seconds to keep queued on
+      the output. Defaults to `#{@default_target_latency}`. Must fit in the
+      output's buffer.
+      * `chunk_frames` - The number of frames moved at a time. Defaults to the
+      buffer size of the input stream.
+  """
+  def start(%PortAudio.Stream{resource: input}, %PortAudio.Stream{resource: output}, opts \\ []) do
+    target_latency = Keyword.get(opts, :target_latency, @default_target_latency)
+    chunk_frames = Keyword.get(opts, :chunk_frames)
+
+    with {:ok, b} <- PortAudio.Native.bridge_start(input, output, target_latency, chunk_frames) do
+      {:ok, %Bridge{resource: b}}
+    end
+  end
+
+  @spec stop(t) :: :ok
+
+  @doc """
+  Stop the bridge. The streams are left running.
+  """
+  def stop(%Bridge{resource: b}) do
+    PortAudio.Native.bridge_stop(b)
+  end
+
+  @spec stats(t) :: map
+
+  @doc """
+  Returns statistics about the bridge. See `PortAudio.Native.bridge_stats/1`.
+  """
+  def stats(%Bridge{resource: b}) do
+    PortAudio.Native.bridge_stats(b)
+  end
+
+  defimpl Inspect do
+    def inspect(_bridge, _opts) do
+      "#PortAudio.Bridge<>"
+    end
+  end
+end
@@ -53,6 +53,26 @@ defmodule PortAudio.Device do
     host_api
   end
 
+  @spec capabilities(t) :: {:ok, PortAudio.Native.capabilities()} | {:error, atom}
+
+  @doc """
+  Return the sample formats, sample rates and channel counts supported by
+  the device, grouped by direction.
+
+  The first call for a device probes it and can be slow, taking up to a few
+  thousand format checks per direction on devices with many channels, each
+  of which may open the device. The result is cached, so later calls are
+  cheap.
+
+  ## Example
+
+      iex> PortAudio.Device.capabilities(device)
+      {:ok, %{input: [{:int16, 44100.0, [1, 2]}, ...], output: [...]}}
+  """
+  def capabilities(%Device{index: index}) do
+    PortAudio.Native.device_capabilities(index)
+  end
+
   @type stream_params :: %{
           channel_count: non_neg_integer,
           sample_format: PortAudio.Native.sample_format(),
@@ -63,7 +83,9 @@ defmodule PortAudio.Device do
         when params: [
                input: stream_params | nil,
                output: stream_params | nil,
-               sample_rate: float | nil
+               sample_rate: float | nil,
+               frames_per_buffer: pos_integer | nil,
+               delivery: [chunk_duration: float, max_latency: float] | nil
              ]
 
   @doc """
@@ -77,6 +99,10 @@ defmodule PortAudio.Device do
       only stream.
       * `output` - The output stream parameters or `nil` if using an input
       only stream.
+      * `frames_per_buffer` - The number of frames in each host buffer.
+      Defaults to letting the host decide.
+      * `delivery` - The delivery policy for reads from an input stream. See
+      `PortAudio.Stream.set_delivery/2` for the available options.
 
   If neither `input` or `output` are set an `ArgumentError` exception will
   be raised.
@@ -102,9 +128,11 @@ defmodule PortAudio.Device do
       raise ArgumentError, "Either input or output parameters are expected"
     end
 
-    with {:ok, s} <- PortAudio.Stream.new(input_params, output_params, sample_rate),
-         {:ok, s} <- PortAudio.Stream.start(s),
-         do: {:ok, s}
+    open_opts = Keyword.take(params, [:frames_per_buffer])
+
+    with {:ok, s} <- PortAudio.Stream.new(input_params, output_params, sample_rate, open_opts) do
+      configure_and_start(s, Keyword.get(params, :delivery))
+    end
   end
 
   @doc """
@@ -118,6 +146,22 @@ defmodule PortAudio.Device do
     end
   end
 
+  # Closes the stream on failure rather than leaving it open until it's
+  # garbage collected
+  defp configure_and_start(stream, delivery) do
+    with {:ok, s} <- set_delivery(stream, delivery),
+         {:ok, s} <- PortAudio.Stream.start(s) do
+      {:ok, s}
+    else
+      error ->
+        PortAudio.Stream.close(stream)
+        error
+    end
+  end
+
+  defp set_delivery(stream, nil), do: {:ok, stream}
+  defp set_delivery(stream, delivery), do: PortAudio.Stream.set_delivery(stream, delivery)
+
   defp add_defaults_to_params(_device, nil, _latencies) do
     nil
   end
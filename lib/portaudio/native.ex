@@ -53,6 +53,25 @@ defmodule PortAudio.Native do
   """
   def version, do: nif_error()
 
+  @type realtime_state :: :disabled | :pending | :ok | {:error, atom}
+
+  @spec realtime_status() :: %{
+          priority: realtime_state,
+          affinity: realtime_state,
+          lock_memory: realtime_state
+        }
+
+  @doc """
+  Returns whether the real-time settings from the `:realtime` application
+  environment took effect on the native audio threads.
+
+  Each setting is `:disabled` if not configured and `:pending` until the
+  first thread or buffer uses it. A failure, such as `{:error, :eperm}`
+  when lacking the permissions for a real-time priority, is kept even if
+  later threads succeed. The affected threads carry on as normal.
+  """
+  def realtime_status, do: nif_error()
+
   @spec host_api_count() :: non_neg_integer
 
   @doc """
@@ -130,6 +149,25 @@ defmodule PortAudio.Native do
   """
   def device_info(_index), do: nif_error()
 
+  @type capabilities :: %{
+          input: [{sample_format, sample_rate :: float, channel_counts :: [pos_integer]}],
+          output: [{sample_format, sample_rate :: float, channel_counts :: [pos_integer]}]
+        }
+
+  @spec device_capabilities(non_neg_integer) :: {:ok, capabilities} | {:error, atom}
+
+  @doc """
+  Returns the sample formats, standard sample rates and channel counts
+  supported by the device at the given index, or `{:error, :not_found}` if
+  the device doesn't exist.
+
+  The full matrix is probed the first time a device is queried, which may
+  take a while as the device may be opened for every combination. Later
+  calls return the cached result, except for a device found to support
+  nothing, perhaps because it was busy, which is probed again.
+  """
+  def device_capabilities(_index), do: nif_error()
+
   @spec stream_format_supported(
           input :: stream_params,
           output :: stream_params,
@@ -141,14 +179,26 @@ defmodule PortAudio.Native do
   """
   def stream_format_supported(_input, _output, _sample_format), do: nif_error()
 
+  @spec stream_open(
+          input :: stream_params | nil,
+          output :: stream_params | nil,
+          sample_rate :: float,
+          flags :: [stream_flag],
+          frames_per_buffer :: pos_integer | nil
+        ) :: {:ok, reference} | {:error, atom}
+
   @doc """
   Open a new stream with the given input and output parameters.
 
   If the `input_params` are specified as `nil`, the device will only
   be used for output and vice-versa when `output_params` is `nil`.
+
+  `frames_per_buffer` sets the size of the buffers used by the host. If
+  `nil`, the host picks a size itself, which may vary between buffers.
   """
 
-  def stream_open(_input_params, _output_params, _sample_rate, _flags), do: nif_error()
+  def stream_open(_input_params, _output_params, _sample_rate, _flags, _frames_per_buffer),
+    do: nif_error()
 
   @spec stream_start(reference) :: :ok | {:error, atom}
 
@@ -184,7 +234,18 @@ defmodule PortAudio.Native do
   """
   def stream_abort(_stream), do: nif_error()
 
-  @spec stream_is_active(reference) :: boolean
+  @spec stream_close(reference) :: :ok | {:error, atom}
+
+  @doc """
+  Close the given stream, releasing any host resources held by it. Active
+  streams are aborted first.
+
+  Any further calls using the stream will return `{:error, :stream_closed}`.
+  Streams that are never closed will be closed when garbage collected.
+  """
+  def stream_close(_stream), do: nif_error()
+
+  @spec stream_is_active(reference) :: boolean | {:error, :stream_closed}
 
   @doc """
   Returns `true` if the given stream is active.
@@ -192,7 +253,7 @@ defmodule PortAudio.Native do
 
   def stream_is_active(_stream), do: nif_error()
 
-  @spec stream_is_stopped(reference) :: boolean
+  @spec stream_is_stopped(reference) :: boolean | {:error, :stream_closed}
 
   @doc """
   Returns `true` if the given stream is stopped. This includes streams
@@ -201,10 +262,14 @@ defmodule PortAudio.Native do
 
   def stream_is_stopped(_stream), do: nif_error()
 
-  @spec stream_read(reference) :: {:ok, binary} | {:error, atom}
+  @spec stream_read(reference) :: {:ok, binary | %{atom => binary}} | {:error, atom}
 
   @doc """
-  Read bytes from the given input stream.
+  Read bytes from the given input stream. Only the frames that are already
+  available are read, so this never blocks.
+
+  If the stream has a routing matrix, a map of route names to binaries is
+  returned instead of a single binary.
 
   Will return `{:error, :stream_empty}` if there is no data to be read yet.
   `{:error, :output_only_stream}` will be returned if the device is only
@@ -222,20 +287,396 @@ defmodule PortAudio.Native do
   Write the given data to an output stream. May block if the buffer
   is full.
 
+  Data that fits in the stream's buffer is written on a normal scheduler,
+  yielding between chunks for large writes. The call only moves on to a
+  dirty scheduler once it has to wait for the buffer to drain.
+
   Will return `{:error, :input_only_stream}` if the device is only
   opened for input.
 
+  With an underrun policy set by `stream_set_underrun_policy/2` the data
+  goes to the stream's write queue instead, waiting on a dirty scheduler
+  while the queue is full.
+
   Other errors may be thrown by PortAudio, but they are considered
   exceptional.
   """
   def stream_write(_stream, _data), do: nif_error()
 
+  @spec stream_frames_written(reference) :: non_neg_integer
+
+  @doc """
+  Returns the number of frames `stream_write/2` has accepted on a stream,
+  whether written to the stream or to its write queue.
+  """
+  def stream_frames_written(_stream), do: nif_error()
+
+  @spec stream_set_delivery(reference, chunk_duration :: float | nil, max_latency :: float) ::
+          :ok | {:error, atom}
+
+  @doc """
+  Set the delivery policy used by `stream_read/1` on an input stream.
+
+  Frames read from the host are merged or split in to chunks of
+  `chunk_duration` seconds. A partial chunk is returned early once its
+  oldest frame is `max_latency` seconds old. Passing a `nil` chunk duration
+  returns to reading whatever the host has available.
+
+  Frames buffered under a previous policy are dropped.
+  """
+  def stream_set_delivery(_stream, _chunk_duration, _max_latency), do: nif_error()
+
+  @type route_channel :: non_neg_integer | [{source :: non_neg_integer, weight :: float}]
+
+  @spec stream_set_routing(reference, [{atom, [route_channel]}] | nil) :: :ok | {:error, atom}
+
+  @doc """
+  Set the channel routing matrix used by `stream_read/1` on an input stream.
+
+  Each route has a name and a list of output channels. An output channel is
+  either the index of the input channel to copy, or a list of
+  `{input_channel, weight}` tuples that are mixed together. Only the
+  selected channels are copied out of each frame. Passing `nil` removes the
+  routing matrix.
+
+  Raises an `ArgumentError` if a route is malformed or refers to an input
+  channel the stream doesn't have.
+  """
+  def stream_set_routing(_stream, _routes), do: nif_error()
+
+  @type spectrum_window :: :rectangular | :hann | :hamming | :blackman
+  @type spectrum_bands :: nil | {:mel, pos_integer} | :third_octave
+
+  @spec stream_set_spectrum(
+          reference,
+          {size :: pos_integer, hop :: pos_integer, spectrum_window, spectrum_bands} | nil
+        ) :: :ok | {:error, atom}
+
+  @doc """
+  Analyse the audio captured from an input stream, or stop with `nil`.
+
+  Every `hop` frames the last `size` frames of each channel are windowed and
+  transformed, and the magnitude of each bin is sent to subscribers added
+  with `stream_subscribe_spectrum/3`. `size` must be a power of two between
+  32 and 16384. Magnitudes are scaled so a full scale sine reads about 1.0.
+
+  With `{:mel, count}` bands the bins are combined in to `count` triangular
+  bands evenly spaced on the mel scale, and with `:third_octave` in to the
+  standard third octave bands from 25Hz up to nyquist that contain a bin.
+
+  Raises an `ArgumentError` if the analysis is malformed, or if a mel band
+  would be narrower than a bin.
+  """
+  def stream_set_spectrum(_stream, _analysis), do: nif_error()
+
+  @spec stream_spectrum_info(reference) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns the spectrum analysis of a stream, along with the center
+  frequency of every bin or band in `frequencies`.
+  """
+  def stream_spectrum_info(_stream), do: nif_error()
+
+  @spec stream_subscribe(reference, pid, route :: atom | nil, max_queue :: non_neg_integer) ::
+          :ok | {:error, atom}
+
+  @doc """
+  Subscribe `pid` to the buffers read from an input stream.
+
+  A native thread reads from the stream while it has subscribers and sends
+  each buffer to every one of them as
+  `{:portaudio_buffer, stream, route, binary}`. All subscribers share the
+  same binary. If `route` is not `nil`, only the channels of that route are
+  sent, and `{:error, :unknown_route}` is returned if the stream's routing
+  matrix has no such route. Subscribers to a route that a later
+  `stream_set_routing/2` removes receive nothing until they subscribe again.
+
+  A subscriber with `max_queue` unacknowledged buffers has further buffers
+  dropped until it calls `stream_ack/2`. A `max_queue` of `0` never drops
+  buffers.
+
+  While there are subscribers `stream_read/1` returns
+  `{:error, :stream_subscribed}`.
+  """
+  def stream_subscribe(_stream, _pid, _route, _max_queue), do: nif_error()
+
+  @spec stream_subscribe_spectrum(reference, pid, max_queue :: non_neg_integer) ::
+          :ok | {:error, atom}
+
+  @doc """
+  Subscribe `pid` to the spectrum analysis of an input stream, see
+  `stream_set_spectrum/2`.
+
+  Analyses are sent as `{:portaudio_spectrum, stream, binary}`. The binary
+  holds one or more analyses, each made up of the native endian 32 bit
+  float magnitudes of every channel in turn. Buffers that complete no
+  analysis send nothing.
+
+  Spectrum subscribers are otherwise like those added with
+  `stream_subscribe/4`, and are listed with the route `:spectrum`.
+  """
+  def stream_subscribe_spectrum(_stream, _pid, _max_queue), do: nif_error()
+
+  @spec stream_unsubscribe(reference, pid) :: :ok | {:error, atom}
+
+  @doc """
+  Remove a subscriber, stopping the capture thread if it was the last one.
+
+  Subscribers are removed automatically when they exit.
+  """
+  def stream_unsubscribe(_stream, _pid), do: nif_error()
+
+  @spec stream_ack(reference, non_neg_integer) :: :ok | {:error, atom}
+
+  @doc """
+  Acknowledge that the calling process has handled `n` buffers, allowing
+  more to be sent to it.
+  """
+  def stream_ack(_stream, _n), do: nif_error()
+
+  @spec stream_subscribers(reference) :: [
+          {pid, route :: atom | nil, in_flight :: non_neg_integer, dropped :: non_neg_integer}
+        ]
+
+  @doc """
+  Returns the subscribers of a stream, along with the number of buffers
+  each has yet to acknowledge and the number dropped because its queue was
+  full.
+  """
+  def stream_subscribers(_stream), do: nif_error()
+
+  @spec stream_capture_stats(reference) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns the number of buffers the capture thread of an input stream has
+  read for its subscribers, and how many of those reads overflowed. Input
+  overflows are only counted here, since subscribers never see the
+  `{:error, :input_overflowed}` that `stream_read/1` would return.
+  """
+  def stream_capture_stats(_stream), do: nif_error()
+
+  @spec stream_set_jitter_buffer(
+          reference,
+          {min_depth :: float, max_depth :: float, concealment :: :repeat | :fade | :silence}
+          | nil
+        ) :: :ok | {:error, atom}
+
+  @doc """
+  Attach a jitter buffer to an output stream, or remove it with `nil`.
+
+  A native thread plays packets pushed with `stream_jitter_push/4` in
+  sequence order, keeping between `min_depth` and `max_depth` seconds
+  buffered depending on how irregularly packets arrive. Missing packets
+  are concealed by repeating the last packet while fading it out
+  (`:repeat`), by fading out its last frame (`:fade`) or with `:silence`.
+
+  While the jitter buffer is attached `stream_write/2` returns
+  `{:error, :stream_playing}`. Replacing the jitter buffer discards any
+  packets it holds.
+  """
+  def stream_set_jitter_buffer(_stream, _opts), do: nif_error()
+
+  @spec stream_jitter_push(
+          reference,
+          seq :: non_neg_integer,
+          timestamp :: non_neg_integer,
+          iodata
+        ) :: :ok | {:error, atom}
+
+  @doc """
+  Push a packet of whole frames in the stream's sample format to its jitter
+  buffer.
+
+  `seq` and `timestamp` are 32 bit and may wrap around, as in RTP. The
+  timestamp counts frames and is only used to measure jitter. Returns
+  `{:error, :discarded}` for duplicates and packets arriving after their
+  turn to play. Eight late packets in a row, or one further behind than the
+  buffer can hold, are taken as the sender restarting its sequence numbers,
+  and playout continues from that packet.
+  """
+  def stream_jitter_push(_stream, _seq, _timestamp, _packet), do: nif_error()
+
+  @spec stream_jitter_stats(reference) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns statistics about the jitter buffer of a stream, including the
+  current and target depth in seconds, the measured jitter, counts of late,
+  lost and dropped packets and the number of times it resynchronized to a
+  restarted sequence.
+  """
+  def stream_jitter_stats(_stream), do: nif_error()
+
+  @spec stream_set_underrun_policy(
+          reference,
+          {policy :: :silence | :repeat | :fade, max_queue :: float} | nil
+        ) :: :ok | {:error, atom}
+
+  @doc """
+  Queue writes to an output stream natively, filling in for the writer
+  whenever the queue runs dry. Passing `nil` removes the queue, failing any
+  writes waiting for room with `{:error, :no_write_queue}`.
+
+  A native thread plays the queue, holding up to `max_queue` seconds, at
+  most 300. A write that finds the queue full while the stream is stopped
+  returns `{:error, :stream_stopped}` rather than waiting. When it runs dry
+  the output is filled with `:silence`, by replaying the most recent audio
+  while fading it out (`:repeat`), or by fading its last frame out
+  (`:fade`). Audio fades back in once writes catch up, except after
+  `:silence`.
+  """
+  def stream_set_underrun_policy(_stream, _policy), do: nif_error()
+
+  @type generator ::
+          :silence
+          | {:sine, frequency :: number, amplitude :: number}
+          | {:white_noise, amplitude :: number}
+          | {:pink_noise, amplitude :: number}
+          | {:sweep, from :: number, to :: number, duration :: number, amplitude :: number}
+
+  @spec stream_set_generator(reference, generator | nil) :: :ok | {:error, atom}
+
+  @doc """
+  Play a test signal on an output stream from a native thread, or stop
+  with `nil`.
+
+  Tones are played on every channel, while noise is independent on each.
+  A sweep rises or falls exponentially from `from` to `to` Hz over
+  `duration` seconds, then starts again. `:silence` keeps the stream fed
+  without playing anything. Amplitudes range from `0.0` to `1.0`.
+
+  The generator is mixed with the jitter buffer and write queue, if
+  either are attached. Raises an `ArgumentError` if a frequency isn't
+  below nyquist, or if a sweep's `duration` is shorter than a frame.
+  """
+  def stream_set_generator(_stream, _generator), do: nif_error()
+
+  @spec stream_queue_stats(reference) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns statistics about the write queue of a stream, including the
+  audio queued and the queue's capacity in seconds, and the number of
+  underruns and frames filled in for them.
+  """
+  def stream_queue_stats(_stream), do: nif_error()
+
+  @spec stream_set_schedule(reference, max_queue :: float | nil) :: :ok | {:error, atom}
+
+  @doc """
+  Attach a schedule to an output stream, which plays clips at exact frames
+  from a native thread. `max_queue` limits the audio waiting to be played,
+  in seconds, and must come to at least one frame and at most 300 seconds.
+  Passing `nil` removes the schedule, dropping everything on it.
+
+  Frames are counted from the first chunk the schedule plays, and only
+  advance while the stream is active.
+  """
+  def stream_set_schedule(_stream, _max_queue), do: nif_error()
+
+  @type schedule_target :: :next | {:frame, non_neg_integer} | {:time, float}
+
+  @spec stream_schedule(reference, iodata, schedule_target, crossfade :: float) ::
+          {:ok, non_neg_integer} | {:error, atom}
+
+  @doc """
+  Schedule a clip in the stream's sample format, returning the frame it
+  will start on.
+
+  The clip starts on an exact `{:frame, index}`, or at a stream time as
+  given by `Pa_GetStreamTime` with `{:time, seconds}`. Stream times are
+  converted to frames using the stream's reported output latency, so are
+  only as accurate as the host API's estimate. With `:next`, the clip
+  starts right after everything already scheduled, without a gap.
+
+  Clips that overlap are mixed together. With a `crossfade`, in seconds,
+  the clip fades in while any clip already playing fades out and stops,
+  and `:next` overlaps the clips by that much. A `crossfade` longer than
+  the schedule's `max_queue` raises an `ArgumentError`.
+
+  Returns `{:error, :too_late}` if the frame has already been played,
+  `{:error, :schedule_full}` if there is no room for the clip, and
+  `{:error, :stream_time_unknown}` when scheduling by time before the
+  schedule has started playing.
+  """
+  def stream_schedule(_stream, _clip, _at, _crossfade), do: nif_error()
+
+  @spec stream_schedule_info(reference) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns the frame the schedule is about to play and its estimated stream
+  time, along with the number of clips, the frame after the last one ends
+  and the audio queued in seconds.
+  """
+  def stream_schedule_info(_stream), do: nif_error()
+
+  @spec bridge_start(
+          input :: reference,
+          output :: reference,
+          target_latency :: float,
+          chunk_frames :: pos_integer | nil
+        ) :: {:ok, reference} | {:error, atom}
+
+  @doc """
+  Start a bridge moving audio from an input stream to an output stream.
+
+  A native thread reads `chunk_frames` frames at a time from the input and
+  writes them to the output, resampling continuously so that the output
+  keeps `target_latency` seconds of audio queued, even as the clocks of the
+  two devices drift apart. If `chunk_frames` is `nil`, the buffer size of
+  the input stream is used.
+
+  The bridge runs until stopped, until either stream is closed or until the
+  returned reference is garbage collected. Until then it owns both streams,
+  and reading, writing, subscribing, attaching a playback source or starting
+  another bridge on either returns `{:error, :stream_bridged}`. A stream that
+  is already subscribed or playing can't be bridged.
+
+  `target_latency` can be at most 10 seconds and `chunk_frames` at most
+  65536. A `target_latency` longer than the output's buffer returns
+  `{:error, :latency_too_large}`.
+  """
+  def bridge_start(_input, _output, _target_latency, _chunk_frames), do: nif_error()
+
+  @spec bridge_stop(reference) :: :ok
+
+  @doc """
+  Stop a bridge, waiting for its thread to exit.
+  """
+  def bridge_stop(_bridge), do: nif_error()
+
+  @spec bridge_stats(reference) :: map
+
+  @doc """
+  Returns statistics about a bridge, including the current resampling
+  ratio, the estimated drift in parts per million and the smoothed number of
+  frames queued on the output.
+  """
+  def bridge_stats(_bridge), do: nif_error()
+
   ############################################################
   # Nif utils
   ############################################################
   defp load_nif do
     path = :filename.join(:code.priv_dir(:ex_portaudio), 'portaudio_nif')
-    :erlang.load_nif(path, 0)
+    :erlang.load_nif(path, realtime_config())
+  end
+
+  # Settings for the native audio threads, for example:
+  #
+  #     config :ex_portaudio, :realtime,
+  #       priority: 70,
+  #       policy: :fifo,
+  #       cpus: [2, 3],
+  #       lock_memory: true
+  #
+  defp realtime_config do
+    opts = Application.get_env(:ex_portaudio, :realtime, [])
+
+    %{
+      priority: Keyword.get(opts, :priority),
+      policy: Keyword.get(opts, :policy, :fifo),
+      cpus: Keyword.get(opts, :cpus),
+      lock_memory: Keyword.get(opts, :lock_memory, false)
+    }
   end
 
   defp nif_error, do: :erlang.nif_error(:nif_not_loaded)
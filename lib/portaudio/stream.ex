@@ -14,10 +14,13 @@ defmodule PortAudio.Stream do
           suggested_latency: float
         }
 
+  @type open_opts :: [frames_per_buffer: pos_integer | nil]
+
   @spec new(
           input_params :: stream_params | nil,
           output_params :: stream_params | nil,
-          sample_rate :: float
+          sample_rate :: float,
+          opts :: open_opts
         ) :: {:ok, t} | {:error, atom}
 
   # TODO: accept flags
@@ -26,19 +29,25 @@ defmodule PortAudio.Stream do
 
   If the input parameters are nil then only then output device will be used
   and vice-versa for output parameters.
-  """
-  def new(input_params, output_params, sample_rate) do
-    input_params =
-      if input_params do
-        param_map_to_native(input_params)
-      end
 
-    output_params =
-      if output_params do
-        param_map_to_native(output_params)
-      end
+  ## Options
 
-    with {:ok, s} <- PortAudio.Native.stream_open(input_params, output_params, sample_rate, []) do
+      * `frames_per_buffer` - The number of frames in each buffer used by the
+      host. Defaults to `nil`, letting the host pick.
+  """
+  def new(input_params, output_params, sample_rate, opts \\ []) do
+    input_params = param_map_to_native(input_params)
+    output_params = param_map_to_native(output_params)
+    frames_per_buffer = Keyword.get(opts, :frames_per_buffer)
+
+    with {:ok, s} <-
+           PortAudio.Native.stream_open(
+             input_params,
+             output_params,
+             sample_rate,
+             [],
+             frames_per_buffer
+           ) do
       {:ok, %PortAudio.Stream{resource: s}}
     end
   end
@@ -46,15 +55,16 @@ defmodule PortAudio.Stream do
   @spec new!(
           input_params :: PortAudio.Native.stream_params() | nil,
           output_params :: PortAudio.Native.stream_params() | nil,
-          sample_rate :: float
+          sample_rate :: float,
+          opts :: open_opts
         ) :: t | no_return
 
   @doc """
   Same as `new`, but will throw a `PortAudio.StreamError` on failure instead
   of returning `{:error, reason}`.
   """
-  def new!(input_params, output_params, sample_rate) do
-    case new(input_params, output_params, sample_rate) do
+  def new!(input_params, output_params, sample_rate, opts \\ []) do
+    case new(input_params, output_params, sample_rate, opts) do
       {:ok, s} ->
         s
 
@@ -63,7 +73,10 @@ defmodule PortAudio.Stream do
     end
   end
 
-  defp param_map_to_native(map) do
+  @doc false
+  def param_map_to_native(nil), do: nil
+
+  def param_map_to_native(map) do
     {
       map.device.index,
       map.channel_count,
@@ -108,7 +121,18 @@ defmodule PortAudio.Stream do
     end
   end
 
-  @spec active?(t) :: boolean
+  @spec close(t) :: :ok | {:error, atom}
+
+  @doc """
+  Close the stream, releasing its host resources immediately instead of
+  waiting for it to be garbage collected. Returns `:ok` on success or
+  `{:error, reason}` on failure.
+  """
+  def close(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_close(s)
+  end
+
+  @spec active?(t) :: boolean | {:error, :stream_closed}
 
   @doc """
   Returns `true` if the stream is active.
@@ -117,7 +141,7 @@ defmodule PortAudio.Stream do
     PortAudio.Native.stream_is_active(s)
   end
 
-  @spec stopped?(t) :: boolean
+  @spec stopped?(t) :: boolean | {:error, :stream_closed}
 
   @doc """
   Returns `true` if the stream has been stopped either through calling `stop`
@@ -127,17 +151,76 @@ defmodule PortAudio.Stream do
     PortAudio.Native.stream_is_stopped(s)
   end
 
-  @spec read(t) :: {:ok, binary} | {:error, atom}
+  @spec set_delivery(t, chunk_duration: float | nil, max_latency: float) ::
+          {:ok, t} | {:error, atom}
+
+  @doc """
+  Set how audio read from an input stream is chunked.
+
+  By default `read/1` returns whatever the host has buffered, which can be
+  anything from a handful of frames to several hundred milliseconds worth.
+  Setting a delivery policy makes `read/1` return chunks of a fixed
+  duration instead, trading message rate against latency.
+
+  ## Options
+
+      * `chunk_duration` - The duration of each chunk in seconds. Set to `nil`
+      to go back to returning whatever is available.
+      * `max_latency` - The longest time in seconds a frame will wait for its
+      chunk to fill up before a partial chunk is returned. Defaults to
+      `chunk_duration`.
+  """
+  def set_delivery(%PortAudio.Stream{resource: s} = stream, opts) do
+    chunk_duration = Keyword.fetch!(opts, :chunk_duration)
+    max_latency = Keyword.get(opts, :max_latency, chunk_duration || 0.0)
+
+    with :ok <- PortAudio.Native.stream_set_delivery(s, chunk_duration, max_latency) do
+      {:ok, stream}
+    end
+  end
+
+  @spec set_routing(t, [{atom, [PortAudio.Native.route_channel()]}] | nil) ::
+          {:ok, t} | {:error, atom}
+
+  @doc """
+  Route the channels of an input stream to named outputs, so each consumer
+  only receives the channels it needs.
+
+  Once set, `read/1` returns a map of route names to binaries, each holding
+  the interleaved channels of that route.
+
+  ## Example
+
+      iex> PortAudio.Stream.set_routing(stream,
+      ...>   vocals: [3],
+      ...>   ambience: [[{0, 0.5}, {1, 0.5}], [{30, 0.5}, {31, 0.5}]]
+      ...> )
+      {:ok, stream}
+      iex> PortAudio.Stream.read(stream)
+      {:ok, %{vocals: <<...>>, ambience: <<...>>}}
+
+  Passing `nil` removes the routing.
+  """
+  def set_routing(%PortAudio.Stream{resource: s} = stream, routes) do
+    with :ok <- PortAudio.Native.stream_set_routing(s, routes) do
+      {:ok, stream}
+    end
+  end
+
+  @spec read(t) :: {:ok, binary | %{atom => binary}} | {:error, atom}
 
   @doc """
   Read a binary from the audio stream. Will return `{:ok, binary}` on success
   or `{:error, reason}` on failure.
+
+  If the stream has a routing matrix, a map of route names to binaries is
+  returned instead.
   """
   def read(%PortAudio.Stream{resource: s}) do
     PortAudio.Native.stream_read(s)
   end
 
-  @spec read!(t) :: binary | no_return
+  @spec read!(t) :: binary | %{atom => binary} | no_return
 
   @doc """
   Same as `read`, but throws a `PortAudio.StreamError` instead of returning
@@ -153,6 +236,335 @@ defmodule PortAudio.Stream do
     end
   end
 
+  @spec set_spectrum(t,
+          size: pos_integer,
+          hop: pos_integer,
+          window: PortAudio.Native.spectrum_window(),
+          bands: PortAudio.Native.spectrum_bands()
+        ) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Analyse the spectrum of the audio captured by an input stream, so
+  subscribers added with `spectrum: true` receive magnitudes rather than
+  samples. Passing `nil` stops the analysis.
+
+  ## Options
+
+      * `size` - The FFT size in frames, a power of two. Defaults to `2048`.
+      * `hop` - The frames between analyses. Defaults to half of `size`.
+      * `window` - One of `:hann`, `:hamming`, `:blackman` or
+      `:rectangular`. Defaults to `:hann`.
+      * `bands` - `nil` for every bin, `{:mel, count}` or `:third_octave`.
+      Defaults to `nil`.
+  """
+  def set_spectrum(stream, opts \\ [])
+
+  def set_spectrum(%PortAudio.Stream{resource: s} = stream, nil) do
+    with :ok <- PortAudio.Native.stream_set_spectrum(s, nil) do
+      {:ok, stream}
+    end
+  end
+
+  def set_spectrum(%PortAudio.Stream{resource: s} = stream, opts) do
+    size = Keyword.get(opts, :size, 2048)
+    hop = Keyword.get(opts, :hop, div(size, 2))
+    window = Keyword.get(opts, :window, :hann)
+    bands = Keyword.get(opts, :bands)
+
+    with :ok <- PortAudio.Native.stream_set_spectrum(s, {size, hop, window, bands}) do
+      {:ok, stream}
+    end
+  end
+
+  @spec spectrum_info(t) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns the spectrum analysis of the stream, including the center
+  frequency of each value in `frequencies`.
+  """
+  def spectrum_info(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_spectrum_info(s)
+  end
+
+  @spec subscribe(t, pid,
+          route: atom | nil,
+          spectrum: boolean,
+          max_queue: non_neg_integer | :infinity
+        ) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Subscribe a process to the audio captured by an input stream.
+
+  Instead of reading from the stream, each subscriber is sent every buffer
+  as a message of the form:
+
+      {:portaudio_buffer, resource, route, binary}
+
+  where `resource` is the `resource` field of the stream. Every subscriber
+  receives the same binary, so adding subscribers doesn't copy the audio.
+
+  Subscribers must call `ack/2` once they've handled a buffer. Buffers are
+  dropped for a subscriber with `max_queue` unacknowledged buffers, so one
+  slow subscriber doesn't hold up the others.
+
+  ## Options
+
+      * `route` - Only receive the channels of the given route, see
+      `set_routing/2`. Returns `{:error, :unknown_route}` if the stream
+      has no such route. Defaults to `nil`, receiving every channel.
+      * `spectrum` - Receive `{:portaudio_spectrum, resource, binary}`
+      messages with the analysis set by `set_spectrum/2` instead of
+      buffers. Defaults to `false`.
+      * `max_queue` - The maximum number of unacknowledged buffers. Defaults
+      to `16`. Set to `:infinity` to never drop buffers.
+  """
+  def subscribe(%PortAudio.Stream{resource: s} = stream, pid \\ self(), opts \\ []) do
+    route = Keyword.get(opts, :route)
+
+    max_queue =
+      case Keyword.get(opts, :max_queue, 16) do
+        :infinity -> 0
+        n -> n
+      end
+
+    result =
+      if Keyword.get(opts, :spectrum, false) do
+        PortAudio.Native.stream_subscribe_spectrum(s, pid, max_queue)
+      else
+        PortAudio.Native.stream_subscribe(s, pid, route, max_queue)
+      end
+
+    with :ok <- result do
+      {:ok, stream}
+    end
+  end
+
+  @spec unsubscribe(t, pid) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Stop sending buffers to the given process.
+  """
+  def unsubscribe(%PortAudio.Stream{resource: s} = stream, pid \\ self()) do
+    with :ok <- PortAudio.Native.stream_unsubscribe(s, pid) do
+      {:ok, stream}
+    end
+  end
+
+  @spec ack(t, pos_integer) :: :ok | {:error, atom}
+
+  @doc """
+  Acknowledge `n` buffers received by the calling process.
+  """
+  def ack(%PortAudio.Stream{resource: s}, n \\ 1) do
+    PortAudio.Native.stream_ack(s, n)
+  end
+
+  @spec capture_stats(t) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns statistics about the thread capturing for the stream's
+  subscribers, including how many of its reads overflowed.
+  """
+  def capture_stats(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_capture_stats(s)
+  end
+
+  @spec set_jitter_buffer(
+          t,
+          [min_depth: float, max_depth: float, concealment: :repeat | :fade | :silence] | nil
+        ) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Play an output stream from a jitter buffer, for audio arriving as
+  packets over an unreliable network.
+
+  Packets pushed with `push_packet/4` are reordered and played by a native
+  thread, at a depth adapted to how irregularly they arrive. Gaps left by
+  lost packets are concealed instead of played as silence. While the
+  jitter buffer is attached `write/2` returns `{:error, :stream_playing}`.
+
+  Passing `nil` removes the jitter buffer and stops playback.
+
+  ## Options
+
+      * `min_depth` - The least audio to buffer, in seconds. Defaults to
+      `0.02`.
+      * `max_depth` - The most audio to buffer, in seconds. Defaults to
+      `0.2`.
+      * `concealment` - How to fill gaps: `:repeat` the last packet while
+      fading it out, `:fade` out its last frame, or play `:silence`.
+      Defaults to `:repeat`.
+  """
+  def set_jitter_buffer(stream, opts \\ [])
+
+  def set_jitter_buffer(%PortAudio.Stream{resource: s} = stream, nil) do
+    with :ok <- PortAudio.Native.stream_set_jitter_buffer(s, nil) do
+      {:ok, stream}
+    end
+  end
+
+  def set_jitter_buffer(%PortAudio.Stream{resource: s} = stream, opts) do
+    min_depth = Keyword.get(opts, :min_depth, 0.02)
+    max_depth = Keyword.get(opts, :max_depth, max(min_depth, 0.2))
+    concealment = Keyword.get(opts, :concealment, :repeat)
+
+    with :ok <-
+           PortAudio.Native.stream_set_jitter_buffer(s, {min_depth, max_depth, concealment}) do
+      {:ok, stream}
+    end
+  end
+
+  @spec push_packet(t, non_neg_integer, non_neg_integer, iodata) :: :ok | {:error, atom}
+
+  @doc """
+  Push a packet to the stream's jitter buffer.
+
+  `seq` orders the packets and `timestamp` gives the position of the first
+  frame in frames. Both wrap around at 32 bits. Returns
+  `{:error, :discarded}` if the packet is a duplicate or came too late to
+  be played, unless enough late packets arrive in a row that the sender
+  appears to have restarted, see `PortAudio.Native.stream_jitter_push/4`.
+  """
+  def push_packet(%PortAudio.Stream{resource: s}, seq, timestamp, packet) do
+    PortAudio.Native.stream_jitter_push(s, seq, timestamp, packet)
+  end
+
+  @spec jitter_stats(t) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns statistics about the stream's jitter buffer.
+  """
+  def jitter_stats(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_jitter_stats(s)
+  end
+
+  @spec set_underrun_policy(t, [policy: :silence | :repeat | :fade, max_queue: float] | nil) ::
+          {:ok, t} | {:error, atom}
+
+  @doc """
+  Queue writes to the stream natively, so the output keeps playing
+  smoothly when the writer falls behind.
+
+  Once set, `write/2` adds to a queue played by a native thread, and only
+  blocks while the queue is full. Writes can fill the queue before the
+  stream is started, but return `{:error, :stream_stopped}` once it is full. Whenever the queue runs dry the policy
+  fills the gap. Passing `nil` goes back to writing to the stream directly.
+
+  ## Options
+
+      * `policy` - Play `:silence`, `:repeat` the most recent audio while
+      fading it out, or `:fade` out the last frame. Defaults to `:fade`.
+      * `max_queue` - The most audio to queue, in seconds, up to `300`.
+      Defaults to `0.2`.
+  """
+  def set_underrun_policy(stream, opts \\ [])
+
+  def set_underrun_policy(%PortAudio.Stream{resource: s} = stream, nil) do
+    with :ok <- PortAudio.Native.stream_set_underrun_policy(s, nil) do
+      {:ok, stream}
+    end
+  end
+
+  def set_underrun_policy(%PortAudio.Stream{resource: s} = stream, opts) do
+    policy = Keyword.get(opts, :policy, :fade)
+    max_queue = Keyword.get(opts, :max_queue, 0.2)
+
+    with :ok <- PortAudio.Native.stream_set_underrun_policy(s, {policy, max_queue}) do
+      {:ok, stream}
+    end
+  end
+
+  @spec queue_stats(t) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns statistics about the stream's write queue.
+  """
+  def queue_stats(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_queue_stats(s)
+  end
+
+  @spec set_schedule(t, [max_queue: number] | nil) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Play clips on the stream at exact frames or stream times, see
+  `schedule/3`. Passing `nil` removes the schedule.
+
+  ## Options
+
+      * `max_queue` - The most audio waiting to be played, in seconds, at
+      most `300`. Defaults to `60`.
+  """
+  def set_schedule(stream, opts \\ [])
+
+  def set_schedule(%PortAudio.Stream{resource: s} = stream, nil) do
+    with :ok <- PortAudio.Native.stream_set_schedule(s, nil) do
+      {:ok, stream}
+    end
+  end
+
+  def set_schedule(%PortAudio.Stream{resource: s} = stream, opts) do
+    max_queue = Keyword.get(opts, :max_queue, 60)
+
+    with :ok <- PortAudio.Native.stream_set_schedule(s, max_queue / 1) do
+      {:ok, stream}
+    end
+  end
+
+  @spec schedule(t, iodata, keyword) :: {:ok, non_neg_integer} | {:error, atom}
+
+  @doc """
+  Schedule a clip to play on the stream, returning the frame it starts on.
+  See `PortAudio.Native.stream_schedule/4`.
+
+  ## Options
+
+      * `at` - `:next` to follow the last clip without a gap,
+      `{:frame, index}` or `{:time, stream_time}`. Defaults to `:next`.
+      * `crossfade` - Seconds to crossfade from the clip already playing.
+      Defaults to `0`.
+
+  ## Example
+
+      iex> {:ok, start} = PortAudio.Stream.schedule(stream, intro)
+      iex> PortAudio.Stream.schedule(stream, song, crossfade: 0.5)
+  """
+  def schedule(%PortAudio.Stream{resource: s}, clip, opts \\ []) do
+    at =
+      case Keyword.get(opts, :at, :next) do
+        {:time, time} -> {:time, time / 1}
+        at -> at
+      end
+
+    crossfade = Keyword.get(opts, :crossfade, 0)
+    PortAudio.Native.stream_schedule(s, clip, at, crossfade / 1)
+  end
+
+  @spec schedule_info(t) :: {:ok, map} | {:error, atom}
+
+  @doc """
+  Returns the position and contents of the stream's schedule.
+  """
+  def schedule_info(%PortAudio.Stream{resource: s}) do
+    PortAudio.Native.stream_schedule_info(s)
+  end
+
+  @spec set_generator(t, PortAudio.Native.generator() | nil) :: {:ok, t} | {:error, atom}
+
+  @doc """
+  Play a test signal on the stream without a process writing to it, see
+  `PortAudio.Native.stream_set_generator/2`. Passing `nil` stops it.
+
+  ## Example
+
+      iex> PortAudio.Stream.set_generator(stream, {:sine, 440, 0.25})
+      {:ok, stream}
+  """
+  def set_generator(%PortAudio.Stream{resource: s} = stream, generator) do
+    with :ok <- PortAudio.Native.stream_set_generator(s, generator) do
+      {:ok, stream}
+    end
+  end
+
   @spec write(t, binary) :: :ok | {:error, atom}
 
   @doc """
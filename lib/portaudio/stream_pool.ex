@@ -0,0 +1,291 @@
+defmodule PortAudio.StreamPool do
+  @moduledoc """
+  A pool of warm streams, keyed by their device, channel count, sample format,
+  latency, sample rate and buffer size.
+
+  Opening a stream can take several milliseconds on some host API's. The pool
+  keeps streams that have been checked in open, but stopped, and hands them
+  out again to the next caller asking for the same parameters. Streams left
+  over the `max_idle` limit for their key are closed, keeping the number of
+  open host resources bounded.
+
+  ## Example
+
+      iex> {:ok, pool} = PortAudio.StreamPool.start_link(max_idle: 2)
+      iex> {:ok, dev} = PortAudio.default_output_device()
+      iex> params = %{device: dev, channel_count: 2, sample_format: :int16,
+      ...>            suggested_latency: 0.1}
+      iex> PortAudio.StreamPool.warm(pool, nil, params, 44100.0, 2)
+      :ok
+      iex> {:ok, s} = PortAudio.StreamPool.checkout(pool, nil, params, 44100.0)
+      iex> PortAudio.Stream.start(s)
+      iex> PortAudio.StreamPool.checkin(pool, s)
+      :ok
+
+  A stream checked out by a process that exits without checking it back in
+  is closed.
+  """
+  use GenServer
+
+  alias PortAudio.{Native, Stream}
+
+  @default_max_idle 2
+
+  @type stream_params :: Stream.stream_params() | nil
+
+  @spec start_link(keyword) :: GenServer.on_start()
+
+  @doc """
+  Start a stream pool.
+
+  ## Options
+
+      * `max_idle` - The maximum number of stopped streams to keep open for
+      each set of stream parameters. Defaults to `#{@default_max_idle}`.
+      * `name` - The name to register the pool under, if any.
+  """
+  def start_link(opts \\ []) do
+    {gen_opts, opts} = Keyword.split(opts, [:name])
+    GenServer.start_link(__MODULE__, opts, gen_opts)
+  end
+
+  @spec checkout(GenServer.server(), stream_params, stream_params, float, Stream.open_opts()) ::
+          {:ok, Stream.t()} | {:error, atom}
+
+  @doc """
+  Check out a stopped stream with the given parameters, opening a new one
+  if none are available.
+
+  The parameters are the same as those given to `PortAudio.Stream.new/4`.
+  The stream is owned by the calling process until it is checked in again.
+  """
+  def checkout(pool, input_params, output_params, sample_rate, opts \\ []) do
+    GenServer.call(pool, {:checkout, input_params, output_params, sample_rate, opts})
+  end
+
+  @spec checkin(GenServer.server(), Stream.t()) :: :ok | {:error, atom}
+
+  @doc """
+  Return a stream to the pool. Streams that are still running are aborted,
+  and every subscriber, playback source and read policy is removed, so the
+  next owner gets a stream just like a newly opened one. Streams that can't
+  be reset, such as bridged streams, are closed instead.
+
+  Will return `{:error, :not_checked_out}` if the stream was not checked out
+  from this pool.
+  """
+  def checkin(pool, %Stream{} = stream) do
+    GenServer.call(pool, {:checkin, stream})
+  end
+
+  @spec warm(
+          GenServer.server(),
+          stream_params,
+          stream_params,
+          float,
+          pos_integer,
+          Stream.open_opts()
+        ) :: :ok | {:error, atom}
+
+  @doc """
+  Open streams with the given parameters until `count` of them are idle,
+  bounded by `max_idle`.
+  """
+  def warm(pool, input_params, output_params, sample_rate, count, opts \\ []) do
+    GenServer.call(pool, {:warm, input_params, output_params, sample_rate, count, opts})
+  end
+
+  @spec idle_count(GenServer.server()) :: non_neg_integer
+
+  @doc """
+  Returns the total number of idle streams held by the pool.
+  """
+  def idle_count(pool) do
+    GenServer.call(pool, :idle_count)
+  end
+
+  ############################################################
+  # Callbacks
+  ############################################################
+  @impl true
+  def init(opts) do
+    Process.flag(:trap_exit, true)
+
+    state = %{
+      max_idle: Keyword.get(opts, :max_idle, @default_max_idle),
+      # key => [stream]
+      idle: %{},
+      # stream resource => {key, monitor}
+      checked_out: %{}
+    }
+
+    {:ok, state}
+  end
+
+  @impl true
+  def handle_call({:checkout, input_params, output_params, sample_rate, opts}, {pid, _}, state) do
+    key = stream_key(input_params, output_params, sample_rate, opts)
+
+    result =
+      case Map.get(state.idle, key, []) do
+        [stream | rest] ->
+          {:ok, stream, put_idle(state, key, rest)}
+
+        [] ->
+          with {:ok, stream} <- Stream.new(input_params, output_params, sample_rate, opts) do
+            {:ok, stream, state}
+          end
+      end
+
+    case result do
+      {:ok, stream, state} ->
+        ref = Process.monitor(pid)
+        checked_out = Map.put(state.checked_out, stream.resource, {key, ref})
+        {:reply, {:ok, stream}, %{state | checked_out: checked_out}}
+
+      {:error, _} = err ->
+        {:reply, err, state}
+    end
+  end
+
+  def handle_call({:checkin, %Stream{resource: s} = stream}, _from, state) do
+    case Map.pop(state.checked_out, s) do
+      {nil, _} ->
+        {:reply, {:error, :not_checked_out}, state}
+
+      {{key, ref}, checked_out} ->
+        Process.demonitor(ref, [:flush])
+        state = %{state | checked_out: checked_out}
+        {:reply, :ok, return_stream(state, key, stream)}
+    end
+  end
+
+  def handle_call({:warm, input_params, output_params, sample_rate, count, opts}, _from, state) do
+    key = stream_key(input_params, output_params, sample_rate, opts)
+    missing = min(count, state.max_idle) - length(Map.get(state.idle, key, []))
+
+    result =
+      List.duplicate(:open, max(missing, 0))
+      |> Enum.reduce_while({:ok, state}, fn :open, {:ok, state} ->
+        case Stream.new(input_params, output_params, sample_rate, opts) do
+          {:ok, stream} ->
+            {:cont, {:ok, put_idle(state, key, [stream | Map.get(state.idle, key, [])])}}
+
+          {:error, _} = err ->
+            {:halt, {err, state}}
+        end
+      end)
+
+    case result do
+      {:ok, state} -> {:reply, :ok, state}
+      {err, state} -> {:reply, err, state}
+    end
+  end
+
+  def handle_call(:idle_count, _from, state) do
+    count = state.idle |> Map.values() |> Enum.map(&length/1) |> Enum.sum()
+    {:reply, count, state}
+  end
+
+  @impl true
+  def handle_info({:DOWN, ref, :process, _pid, _reason}, state) do
+    {closed, checked_out} =
+      Enum.split_with(state.checked_out, fn {_s, {_key, r}} -> r == ref end)
+
+    for {s, _} <- closed, do: Stream.close(%Stream{resource: s})
+    {:noreply, %{state | checked_out: Map.new(checked_out)}}
+  end
+
+  def handle_info(_msg, state) do
+    {:noreply, state}
+  end
+
+  @impl true
+  def terminate(_reason, state) do
+    for {_key, streams} <- state.idle, stream <- streams, do: Stream.close(stream)
+    :ok
+  end
+
+  defp stream_key(input_params, output_params, sample_rate, opts) do
+    {
+      Stream.param_map_to_native(input_params),
+      Stream.param_map_to_native(output_params),
+      sample_rate,
+      Keyword.get(opts, :frames_per_buffer)
+    }
+  end
+
+  defp return_stream(state, key, stream) do
+    idle = Map.get(state.idle, key, [])
+
+    cond do
+      length(idle) >= state.max_idle ->
+        Stream.close(stream)
+        state
+
+      reset_stream(stream, key) == :ok ->
+        put_idle(state, key, [stream | idle])
+
+      true ->
+        Stream.close(stream)
+        state
+    end
+  end
+
+  # Pooled streams must be stopped so they can be restarted by the next owner,
+  # and have nothing left attached from the last one
+  defp reset_stream(%Stream{resource: s} = stream, {input_params, output_params, _, _}) do
+    with :ok <- stop_stream(stream),
+         :ok <- reset_input(s, input_params) do
+      reset_output(s, output_params)
+    end
+  end
+
+  defp stop_stream(stream) do
+    case Stream.stopped?(stream) do
+      true ->
+        :ok
+
+      false ->
+        with {:ok, _} <- Stream.abort(stream), do: :ok
+
+      {:error, _} = err ->
+        err
+    end
+  end
+
+  defp reset_input(_s, nil), do: :ok
+
+  defp reset_input(s, _params) do
+    unsubscribed =
+      for {pid, _route, _in_flight, _dropped} <- Native.stream_subscribers(s) do
+        # Subscribers that exit meanwhile are removed anyway
+        case Native.stream_unsubscribe(s, pid) do
+          {:error, :not_subscribed} -> :ok
+          result -> result
+        end
+      end
+
+    first_error([
+      Native.stream_set_delivery(s, nil, 0.0),
+      Native.stream_set_routing(s, nil),
+      Native.stream_set_spectrum(s, nil) | unsubscribed
+    ])
+  end
+
+  defp reset_output(_s, nil), do: :ok
+
+  defp reset_output(s, _params) do
+    first_error([
+      Native.stream_set_jitter_buffer(s, nil),
+      Native.stream_set_underrun_policy(s, nil),
+      Native.stream_set_generator(s, nil),
+      Native.stream_set_schedule(s, nil)
+    ])
+  end
+
+  defp first_error(results), do: Enum.find(results, :ok, &(&1 != :ok))
+
+  defp put_idle(state, key, []), do: %{state | idle: Map.delete(state.idle, key)}
+  defp put_idle(state, key, streams), do: %{state | idle: Map.put(state.idle, key, streams)}
+end
@@ -17,6 +17,13 @@ defmodule PortAudio.NativeTest do
     end
   end
 
+  describe "realtime_status/0" do
+    test "reports every setting as disabled when not configured" do
+      assert %{priority: :disabled, affinity: :disabled, lock_memory: :disabled} =
+               Native.realtime_status()
+    end
+  end
+
   describe "default_host_api_index/0" do
     test "returns the default host API index" do
       {:ok, index} = Native.default_host_api_index()
@@ -161,11 +168,458 @@ defmodule PortAudio.NativeTest do
     end
   end
 
+  describe "device_capabilities/1" do
+    test "returns the supported formats of a device" do
+      {:ok, idx} = Native.default_output_device_index()
+      {:ok, caps} = Native.device_capabilities(idx)
+
+      assert is_list(caps.input)
+      assert [_ | _] = caps.output
+
+      for {format, rate, channels} <- caps.output do
+        assert format in [:float32, :int32, :int24, :int16, :int8, :uint8]
+        assert is_float(rate)
+        assert [_ | _] = channels
+      end
+    end
+
+    test "returns cached results on later calls" do
+      {:ok, idx} = Native.default_output_device_index()
+      assert Native.device_capabilities(idx) == Native.device_capabilities(idx)
+    end
+
+    test "returns an error when the device doesn't exist" do
+      assert {:error, :not_found} = Native.device_capabilities(10_000)
+    end
+  end
+
   # TODO: find a way to write this. It can be quite difficult to validate
   # describe "stream_format_supported/3" do
 
   # end
 
+  describe "stream_close/1" do
+    def open_default_output_stream do
+      {:ok, idx} = Native.default_output_device_index()
+      {:ok, info} = Native.device_info(idx)
+      params = {idx, 2, :int16, info.default_high_output_latency}
+      Native.stream_open(nil, params, 44100.0, [], nil)
+    end
+
+    test "closes an open stream" do
+      {:ok, s} = open_default_output_stream()
+      assert :ok = Native.stream_close(s)
+    end
+
+    test "returns an error when using a closed stream" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_close(s)
+
+      assert {:error, :stream_closed} = Native.stream_close(s)
+      assert {:error, :stream_closed} = Native.stream_start(s)
+      assert {:error, :stream_closed} = Native.stream_write(s, <<0, 0, 0, 0>>)
+    end
+  end
+
+  describe "stream_write/2" do
+    test "writes more than a chunk in a single call" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+
+      assert :ok = Native.stream_write(s, <<0::size(10_000 * 2 * 16)>>)
+      assert Native.stream_frames_written(s) == 10_000
+    end
+
+    test "waits on a dirty scheduler once the buffer is full" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+
+      # Far more than the buffer holds, so most of it waits for room
+      {elapsed, result} = :timer.tc(Native, :stream_write, [s, <<0::size(88_200 * 2 * 16)>>])
+
+      assert :ok = result
+      assert Native.stream_frames_written(s) == 88_200
+      assert elapsed > 1_000_000
+    end
+  end
+
+  describe "stream_set_delivery/3" do
+    test "sets the delivery policy of an input stream" do
+      {:ok, idx} = Native.default_input_device_index()
+      {:ok, info} = Native.device_info(idx)
+      params = {idx, 1, :int16, info.default_high_input_latency}
+      {:ok, s} = Native.stream_open(params, nil, 44100.0, [], 256)
+
+      assert :ok = Native.stream_set_delivery(s, 0.02, 0.05)
+      assert :ok = Native.stream_set_delivery(s, nil, 0.0)
+    end
+
+    test "returns an error for output only streams" do
+      {:ok, s} = open_default_output_stream()
+
+      assert {:error, :output_only_stream} = Native.stream_set_delivery(s, 0.02, 0.05)
+    end
+  end
+
+  describe "stream_set_routing/2" do
+    def open_default_input_stream(channels) do
+      {:ok, idx} = Native.default_input_device_index()
+      {:ok, info} = Native.device_info(idx)
+      params = {idx, channels, :int16, info.default_high_input_latency}
+      Native.stream_open(params, nil, 44100.0, [], nil)
+    end
+
+    test "sets the routing matrix of an input stream" do
+      {:ok, s} = open_default_input_stream(2)
+
+      assert :ok = Native.stream_set_routing(s, left: [0], mono: [[{0, 0.5}, {1, 0.5}]])
+      assert :ok = Native.stream_set_routing(s, nil)
+    end
+
+    test "raises when routing a channel that doesn't exist" do
+      {:ok, s} = open_default_input_stream(2)
+
+      assert_raise ArgumentError, fn -> Native.stream_set_routing(s, bad: [2]) end
+      assert_raise ArgumentError, fn -> Native.stream_set_routing(s, bad: [[{5, 1.0}]]) end
+    end
+  end
+
+  describe "stream_subscribe/4" do
+    test "sends captured buffers to every subscriber" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_start(s)
+      parent = self()
+
+      other =
+        spawn_link(fn ->
+          receive do
+            {:portaudio_buffer, ^s, nil, data} -> send(parent, {:other, data})
+          end
+        end)
+
+      assert :ok = Native.stream_subscribe(s, self(), nil, 4)
+      assert :ok = Native.stream_subscribe(s, other, nil, 4)
+
+      assert_receive {:portaudio_buffer, ^s, nil, data}, 1_000
+      assert_receive {:other, other_data}, 1_000
+      assert byte_size(data) == byte_size(other_data)
+      assert {:error, :stream_subscribed} = Native.stream_read(s)
+    end
+
+    test "drops buffers once the queue is full" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_start(s)
+      :ok = Native.stream_subscribe(s, self(), nil, 1)
+
+      assert_receive {:portaudio_buffer, ^s, nil, _}, 1_000
+      refute_receive {:portaudio_buffer, ^s, nil, _}, 200
+      assert [{_, nil, 1, dropped}] = Native.stream_subscribers(s)
+      assert dropped > 0
+
+      :ok = Native.stream_ack(s, 1)
+      assert_receive {:portaudio_buffer, ^s, nil, _}, 1_000
+    end
+
+    test "removes subscribers" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_subscribe(s, self(), nil, 4)
+
+      assert :ok = Native.stream_unsubscribe(s, self())
+      assert [] = Native.stream_subscribers(s)
+      assert {:error, :not_subscribed} = Native.stream_unsubscribe(s, self())
+    end
+
+    test "returns an error for a route that doesn't exist" do
+      {:ok, s} = open_default_input_stream(2)
+
+      assert {:error, :unknown_route} = Native.stream_subscribe(s, self(), :left, 4)
+
+      :ok = Native.stream_set_routing(s, left: [0])
+      assert {:error, :unknown_route} = Native.stream_subscribe(s, self(), :right, 4)
+      assert :ok = Native.stream_subscribe(s, self(), :left, 4)
+    end
+
+    test "removes subscribers that exit and restarts for new ones" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_start(s)
+
+      {pid, ref} = spawn_monitor(fn -> Process.sleep(:infinity) end)
+      :ok = Native.stream_subscribe(s, pid, nil, 4)
+      Process.exit(pid, :kill)
+      assert_receive {:DOWN, ^ref, :process, ^pid, :killed}
+
+      assert :ok = Native.stream_subscribe(s, self(), nil, 4)
+      assert [{_, nil, _, _}] = Native.stream_subscribers(s)
+      assert_receive {:portaudio_buffer, ^s, nil, _}, 1_000
+    end
+
+    test "counts the buffers read and reads that overflowed" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_start(s)
+      :ok = Native.stream_subscribe(s, self(), nil, 0)
+
+      assert_receive {:portaudio_buffer, ^s, nil, _}, 1_000
+      assert {:ok, %{buffers: buffers, input_overflows: overflows}} = Native.stream_capture_stats(s)
+      assert buffers > 0
+      assert is_integer(overflows)
+
+      {:ok, output} = open_default_output_stream()
+      assert {:error, :output_only_stream} = Native.stream_capture_stats(output)
+    end
+  end
+
+  describe "stream_set_spectrum/2" do
+    test "sends spectrum analyses to spectrum subscribers" do
+      {:ok, s} = open_default_input_stream(2)
+      :ok = Native.stream_set_spectrum(s, {1024, 512, :hann, {:mel, 32}})
+      :ok = Native.stream_start(s)
+
+      assert {:ok, %{frequencies: frequencies}} = Native.stream_spectrum_info(s)
+      assert length(frequencies) == 32
+
+      assert :ok = Native.stream_subscribe_spectrum(s, self(), 0)
+      assert_receive {:portaudio_spectrum, ^s, data}, 1_000
+      assert rem(byte_size(data), 2 * 32 * 4) == 0
+      assert [{_, :spectrum, _, _}] = Native.stream_subscribers(s)
+    end
+
+    test "raises for an invalid analysis" do
+      {:ok, s} = open_default_input_stream(2)
+
+      assert_raise ArgumentError, fn -> Native.stream_set_spectrum(s, {1000, 500, :hann, nil}) end
+      assert_raise ArgumentError, fn -> Native.stream_set_spectrum(s, {64, 32, :hann, {:mel, 30}}) end
+      assert {:error, :no_spectrum} = Native.stream_spectrum_info(s)
+    end
+  end
+
+  describe "stream_set_jitter_buffer/2" do
+    test "plays packets pushed to the jitter buffer" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+      :ok = Native.stream_set_jitter_buffer(s, {0.02, 0.2, :repeat})
+
+      packet = :binary.copy(<<0, 0, 0, 0>>, 441)
+
+      for seq <- [0, 1, 3, 2, 5] do
+        assert :ok = Native.stream_jitter_push(s, seq, seq * 441, packet)
+      end
+
+      assert {:error, :discarded} = Native.stream_jitter_push(s, 5, 5 * 441, packet)
+      assert {:error, :stream_playing} = Native.stream_write(s, packet)
+
+      Process.sleep(200)
+
+      assert {:ok, stats} = Native.stream_jitter_stats(s)
+      assert stats.received == 5
+      assert is_float(stats.target_depth)
+
+      assert :ok = Native.stream_set_jitter_buffer(s, nil)
+      assert {:error, :no_jitter_buffer} = Native.stream_jitter_stats(s)
+      assert :ok = Native.stream_write(s, packet)
+    end
+
+    test "resynchronizes when the sequence numbers restart" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+      :ok = Native.stream_set_jitter_buffer(s, {0.02, 0.2, :fade})
+
+      packet = :binary.copy(<<0, 0, 0, 0>>, 441)
+
+      for seq <- 100..104 do
+        :ok = Native.stream_jitter_push(s, seq, seq * 441, packet)
+      end
+
+      Process.sleep(200)
+
+      for seq <- 0..6 do
+        assert {:error, :discarded} = Native.stream_jitter_push(s, seq, seq * 441, packet)
+      end
+
+      assert :ok = Native.stream_jitter_push(s, 7, 7 * 441, packet)
+      assert :ok = Native.stream_jitter_push(s, 8, 8 * 441, packet)
+      assert {:ok, %{late: 7, resyncs: 1}} = Native.stream_jitter_stats(s)
+    end
+
+    test "returns an error for input only streams" do
+      {:ok, s} = open_default_input_stream(1)
+
+      assert {:error, :input_only_stream} =
+               Native.stream_set_jitter_buffer(s, {0.02, 0.2, :fade})
+    end
+  end
+
+  describe "stream_set_underrun_policy/2" do
+    test "queues writes and fills in when the queue runs dry" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+
+      assert :ok = Native.stream_set_underrun_policy(s, {:fade, 0.1})
+      assert :ok = Native.stream_write(s, <<0::size(480 * 2 * 16)>>)
+      Process.sleep(200)
+
+      assert {:ok, %{underruns: underruns}} = Native.stream_queue_stats(s)
+      assert underruns >= 1
+
+      assert :ok = Native.stream_set_underrun_policy(s, nil)
+      assert {:error, :no_write_queue} = Native.stream_queue_stats(s)
+    end
+
+    test "returns an error when the queue is full and the stream is stopped" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_set_underrun_policy(s, {:fade, 0.01})
+
+      assert {:error, :stream_stopped} = Native.stream_write(s, <<0::size(4410 * 2 * 16)>>)
+    end
+
+    test "raises for an unknown policy or an oversized queue" do
+      {:ok, s} = open_default_output_stream()
+
+      assert_raise ArgumentError, fn -> Native.stream_set_underrun_policy(s, {:loop, 0.1}) end
+      assert_raise ArgumentError, fn -> Native.stream_set_underrun_policy(s, {:fade, 1.0e6}) end
+    end
+  end
+
+  describe "stream_set_generator/2" do
+    test "plays a generator in place of writes" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+
+      assert :ok = Native.stream_set_generator(s, {:sine, 440.0, 0.1})
+      assert {:error, :stream_playing} = Native.stream_write(s, <<0::size(64)>>)
+      assert :ok = Native.stream_set_generator(s, {:sweep, 20.0, 2000.0, 1.0, 0.1})
+      assert :ok = Native.stream_set_generator(s, nil)
+      assert :ok = Native.stream_write(s, <<0::size(64)>>)
+    end
+
+    test "raises for a frequency above nyquist" do
+      {:ok, s} = open_default_output_stream()
+
+      assert_raise ArgumentError, fn ->
+        Native.stream_set_generator(s, {:sine, 100_000.0, 0.1})
+      end
+    end
+
+    test "raises for a sweep duration out of range" do
+      {:ok, s} = open_default_output_stream()
+
+      for duration <- [0.0, -1.0, 1.0e-9, 1.0e300] do
+        assert_raise ArgumentError, fn ->
+          Native.stream_set_generator(s, {:sweep, 20.0, 2000.0, duration, 0.1})
+        end
+      end
+    end
+  end
+
+  describe "stream_schedule/4" do
+    test "schedules clips after each other" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+      clip = <<0::size(44100 * 2 * 16)>>
+
+      assert {:error, :no_schedule} = Native.stream_schedule(s, clip, :next, 0.0)
+      assert :ok = Native.stream_set_schedule(s, 5.0)
+
+      assert {:ok, start} = Native.stream_schedule(s, clip, :next, 0.0)
+      assert {:ok, next} = Native.stream_schedule(s, clip, :next, 0.0)
+      assert next == start + 44100
+      assert {:ok, crossfaded} = Native.stream_schedule(s, clip, :next, 0.5)
+      assert crossfaded == next + 44100 - 22050
+
+      assert {:ok, %{items: items}} = Native.stream_schedule_info(s)
+      assert items <= 3
+    end
+
+    test "returns an error for frames already played" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_start(s)
+      :ok = Native.stream_set_schedule(s, 1.0)
+      Process.sleep(100)
+
+      assert {:error, :too_late} = Native.stream_schedule(s, <<0, 0, 0, 0>>, {:frame, 0}, 0.0)
+    end
+
+    test "raises for a queue over the limit or under a frame" do
+      {:ok, s} = open_default_output_stream()
+
+      assert_raise ArgumentError, fn -> Native.stream_set_schedule(s, 1.0e300) end
+      assert_raise ArgumentError, fn -> Native.stream_set_schedule(s, 1.0e-9) end
+      assert {:error, :no_schedule} = Native.stream_schedule_info(s)
+    end
+
+    test "raises for a crossfade over the queue or an out of range time" do
+      {:ok, s} = open_default_output_stream()
+      :ok = Native.stream_set_schedule(s, 1.0)
+      clip = <<0, 0, 0, 0>>
+
+      assert_raise ArgumentError, fn -> Native.stream_schedule(s, clip, :next, 2.0) end
+      assert_raise ArgumentError, fn -> Native.stream_schedule(s, clip, :next, 1.0e300) end
+      assert_raise ArgumentError, fn -> Native.stream_schedule(s, clip, {:time, 1.0e300}, 0.0) end
+      assert_raise ArgumentError, fn -> Native.stream_schedule(s, clip, {:time, -1.0e300}, 0.0) end
+    end
+  end
+
+  describe "bridge_start/4" do
+    test "bridges an input stream to an output stream" do
+      {:ok, input} = open_default_input_stream(2)
+      {:ok, output} = open_default_output_stream()
+      :ok = Native.stream_start(input)
+      :ok = Native.stream_start(output)
+
+      {:ok, bridge} = Native.bridge_start(input, output, 0.05, 256)
+      Process.sleep(200)
+
+      stats = Native.bridge_stats(bridge)
+      assert stats.running
+      assert is_float(stats.ratio)
+      assert {frames_in, _} = stats.frames
+      assert frames_in > 0
+
+      assert :ok = Native.bridge_stop(bridge)
+      refute Native.bridge_stats(bridge).running
+    end
+
+    test "owns both streams until stopped" do
+      {:ok, input} = open_default_input_stream(2)
+      {:ok, output} = open_default_output_stream()
+      :ok = Native.stream_start(input)
+      :ok = Native.stream_start(output)
+
+      {:ok, bridge} = Native.bridge_start(input, output, 0.05, 256)
+
+      assert {:error, :stream_bridged} = Native.bridge_start(input, output, 0.05, 256)
+      assert {:error, :stream_bridged} = Native.stream_read(input)
+      assert {:error, :stream_bridged} = Native.stream_subscribe(input, self(), nil, 4)
+      assert {:error, :stream_bridged} = Native.stream_write(output, <<0, 0, 0, 0>>)
+      assert {:error, :stream_bridged} = Native.stream_set_generator(output, {:sine, 440.0, 0.1})
+
+      :ok = Native.stream_close(input)
+      Process.sleep(100)
+      refute Native.bridge_stats(bridge).running
+      assert :ok = Native.stream_write(output, <<0, 0, 0, 0>>)
+    end
+
+    test "raises for an oversized latency or chunk" do
+      {:ok, input} = open_default_input_stream(2)
+      {:ok, output} = open_default_output_stream()
+
+      assert_raise ArgumentError, fn -> Native.bridge_start(input, output, 60.0, nil) end
+      assert_raise ArgumentError, fn -> Native.bridge_start(input, output, 0.05, 1_000_000) end
+    end
+
+    test "returns an error for a latency the output can't hold" do
+      {:ok, input} = open_default_input_stream(2)
+      {:ok, output} = open_default_output_stream()
+
+      assert {:error, :latency_too_large} = Native.bridge_start(input, output, 5.0, nil)
+    end
+
+    test "returns an error when the directions are wrong" do
+      {:ok, output} = open_default_output_stream()
+
+      assert {:error, :output_only_stream} = Native.bridge_start(output, output, 0.05, nil)
+    end
+  end
+
   describe "garbage collection" do
     test "resources released properly" do
       spawn(fn ->
@@ -175,5 +629,21 @@ defmodule PortAudio.NativeTest do
 
       # Garbage collected here
     end
+
+    test "resources released properly with a playback source attached" do
+      {pid, ref} =
+        spawn_monitor(fn ->
+          {:ok, s} = open_default_output_stream()
+          :ok = Native.stream_start(s)
+          :ok = Native.stream_set_generator(s, {:sine, 440.0, 0.1})
+        end)
+
+      assert_receive {:DOWN, ^ref, :process, ^pid, :normal}, 1_000
+      :erlang.garbage_collect()
+
+      # The device is free again once the playback thread has been stopped
+      {:ok, s} = open_default_output_stream()
+      assert :ok = Native.stream_close(s)
+    end
   end
 end
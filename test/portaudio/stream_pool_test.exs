@@ -0,0 +1,72 @@
+# Assumes a default output device exists on the host system
+defmodule PortAudio.StreamPoolTest do
+  use ExUnit.Case
+
+  alias PortAudio.{Stream, StreamPool}
+
+  setup do
+    {:ok, dev} = PortAudio.default_output_device()
+
+    params = %{
+      device: dev,
+      channel_count: 2,
+      sample_format: :int16,
+      suggested_latency: dev.default_output_latency[:high]
+    }
+
+    {:ok, pool} = StreamPool.start_link(max_idle: 1)
+    {:ok, pool: pool, params: params}
+  end
+
+  test "reuses checked in streams", %{pool: pool, params: params} do
+    {:ok, s} = StreamPool.checkout(pool, nil, params, 44100.0)
+    :ok = StreamPool.checkin(pool, s)
+
+    assert {:ok, ^s} = StreamPool.checkout(pool, nil, params, 44100.0)
+  end
+
+  test "closes streams over the idle limit", %{pool: pool, params: params} do
+    {:ok, s1} = StreamPool.checkout(pool, nil, params, 44100.0)
+    {:ok, s2} = StreamPool.checkout(pool, nil, params, 44100.0)
+    :ok = StreamPool.checkin(pool, s1)
+    :ok = StreamPool.checkin(pool, s2)
+
+    assert StreamPool.idle_count(pool) == 1
+    assert {:error, :stream_closed} = Stream.close(s2)
+  end
+
+  test "warms streams ahead of time", %{pool: pool, params: params} do
+    assert :ok = StreamPool.warm(pool, nil, params, 44100.0, 5)
+    assert StreamPool.idle_count(pool) == 1
+  end
+
+  test "resets streams when they are checked in", %{pool: pool, params: params} do
+    {:ok, input_dev} = PortAudio.default_input_device()
+
+    input_params = %{
+      device: input_dev,
+      channel_count: 1,
+      sample_format: :int16,
+      suggested_latency: input_dev.default_input_latency[:high]
+    }
+
+    {:ok, s} = StreamPool.checkout(pool, input_params, params, 44100.0)
+    {:ok, s} = Stream.set_generator(s, {:sine, 440.0, 0.1})
+    {:ok, s} = Stream.set_delivery(s, chunk_duration: 0.02, max_latency: 0.05)
+    {:ok, s} = Stream.subscribe(s)
+    {:ok, s} = Stream.start(s)
+    :ok = StreamPool.checkin(pool, s)
+
+    assert {:ok, ^s} = StreamPool.checkout(pool, input_params, params, 44100.0)
+    assert [] = PortAudio.Native.stream_subscribers(s.resource)
+
+    # Writes go straight to the stream again with the generator removed
+    {:ok, s} = Stream.start(s)
+    assert :ok = Stream.write(s, <<0, 0, 0, 0>>)
+  end
+
+  test "rejects streams it didn't hand out", %{pool: pool, params: params} do
+    {:ok, s} = Stream.new(nil, params, 44100.0)
+    assert {:error, :not_checked_out} = StreamPool.checkin(pool, s)
+  end
+end